@@ -0,0 +1,64 @@
+// Measures the scanner's throughput in MB/s, on a script given as an argument or on a generated one
+// with the usual mix of indentation, comments, string literals and code
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "scanner.h"
+
+static std::string GenerateSource(size_t size) {
+	const std::string block =
+		"# Sums the lengths of the words of a line, skipping the ones that are too short to count\n"
+		"runnable count(line, least):\n"
+		"\trat total = 0\n"
+		"\tfor word in Split(line, \" \"):\n"
+		"\t\tif len(word) >= least and word != \"the\":\n"
+		"\t\t\ttotal = total + len(word)    # long enough\n"
+		"\t\tendif\n"
+		"\tendfor\n"
+		"\treturn total\n"
+		"endrunnable\n"
+		"\n"
+		"rat message = \"a fairly long string literal, like the messages and formats scripts print\"\n"
+		"print(count(message, 3) * 2 + 1)\n";
+
+	std::string source;
+	source.reserve(size + block.size());
+	while (source.size() < size) source += block;
+	return source;
+}
+
+int main(int argc, char* argv[]) {
+	std::string source;
+	if (argc > 1) {
+		std::ifstream file(argv[1]);
+		if (!file.is_open()) {
+			std::cerr << "Can't open '" << argv[1] << "'\n";
+			return 1;
+		}
+		std::ostringstream stream;
+		stream << file.rdbuf();
+		source = stream.str();
+	}
+	else source = GenerateSource(32 << 20);
+
+	// The best of a few runs, so a run slowed by the rest of the machine doesn't count
+	double best = 0;
+	size_t tokens = 0;
+	for (int run = 0; run < 5; run++) {
+		Scanner scanner(source);
+
+		auto start = std::chrono::steady_clock::now();
+		tokens = scanner.ScanTokens().size();
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+		best = std::max(best, source.size() / elapsed.count() / (1 << 20));
+	}
+
+	std::cout << "Scanned " << source.size() / (1 << 20) << " MB into " << tokens << " tokens: " << best << " MB/s\n";
+	return 0;
+}
@@ -3,37 +3,77 @@
 #include <limits>
 
 Chunk::Chunk() {
-	ip = 0;
 	constants = std::vector<Value>();
 
 	this->natives.insert({ "input",			true });
 	this->natives.insert({ "print",			true });
+	this->natives.insert({ "flush",			true });
+
+	this->natives.insert({ "ReadAllInput",		true });
+	this->natives.insert({ "ReadInputChunk",	true });
+	this->natives.insert({ "InputLines",		true });
 	
 	this->natives.insert({ "ReadFromFile",	true });
 	this->natives.insert({ "WriteToFile",	true });
 	this->natives.insert({ "EmptyFile",		true });
 
+	this->natives.insert({ "ReadFromFileAsync",	true });
+	this->natives.insert({ "WriteToFileAsync",	true });
+	this->natives.insert({ "EmptyFileAsync",	true });
+
+	this->natives.insert({ "Open",			true });
+	this->natives.insert({ "Write",			true });
+	this->natives.insert({ "ReadLine",		true });
+	this->natives.insert({ "Flush",			true });
+	this->natives.insert({ "Close",			true });
+	this->natives.insert({ "lines",			true });
+
 	this->natives.insert({ "Number",		true });
 	this->natives.insert({ "Boolean",		true });
 	this->natives.insert({ "String",		true });
 	this->natives.insert({ "Type",			true });
-}
 
-Chunk::Chunk(Chunk *ToCopy) {
-	this->code = ToCopy->code;
-	this->constants = ToCopy->constants;
+	this->natives.insert({ "Substring",		true });
+	this->natives.insert({ "Split",			true });
+
+	this->natives.insert({ "len",			true });
+	this->natives.insert({ "push",			true });
+	this->natives.insert({ "pop",			true });
+
+	this->natives.insert({ "has",			true });
+	this->natives.insert({ "get",			true });
+	this->natives.insert({ "remove",		true });
+
+	this->natives.insert({ "sum",			true });
+	this->natives.insert({ "min",			true });
+	this->natives.insert({ "max",			true });
+	this->natives.insert({ "dot",			true });
+	this->natives.insert({ "add",			true });
+	this->natives.insert({ "mul",			true });
+	this->natives.insert({ "scale",			true });
+	this->natives.insert({ "where",			true });
+
+	this->natives.insert({ "sort",			true });
+
+	this->natives.insert({ "Channel",		true });
+	this->natives.insert({ "send",			true });
+	this->natives.insert({ "recv",			true });
 
-	this->ip = 0;
+	this->natives.insert({ "pmap",			true });
+	this->natives.insert({ "preduce",		true });
+
+	this->natives.insert({ "resume",		true });
+
+	this->natives.insert({ "SleepAsync",	true });
+	this->natives.insert({ "ExecAsync",		true });
+
+	this->natives.insert({ "CollectorStats",	true });
 }
 
 Chunk::~Chunk() {
 	this->ClearConstants();
 }
 
-uint8_t Chunk::advance() {
-	return code[ip++];
-}
-
 std::vector<Value>& Chunk::GetConstants() {
 	return this->constants;
 }
@@ -50,8 +90,11 @@ uint8_t Chunk::AddConstant(Token& constant) {
 	TokenType t = constant.GetType();
 	switch (t) {
 		case NUM_LITERAL: {
+			// Literals with a decimal point are doubles, the rest are integers
+			const std::string& lexeme = constant.GetLexeme();
 			try {
-				val = Value(std::stof(constant.GetLexeme()));	break;
+				if (lexeme.find('.') == std::string::npos) val = Value((int64_t)std::stoll(lexeme));
+				else val = Value(std::stod(lexeme));
 			}
 			catch (const std::exception& e) {
 				throw std::string("Float overflow");
@@ -66,7 +109,8 @@ uint8_t Chunk::AddConstant(Token& constant) {
 		case IDENTIFIER: {
 			StrValue* o = new StrValue(constant.GetLexeme());
 			val = Value(o); 
-			o->AddReference();
+			o->Hash();  // cached before it's shared with other threads, which only read it
+			o->MakeConstant();
 			break;
 		}
 	}
@@ -82,7 +126,11 @@ uint8_t Chunk::AddConstant(Value v) {
 	}
 
 	constants.push_back(v);
-	if (v.IsObject()) v.GetObjectValue()->AddReference();
+	if (v.IsObject()) {
+		ObjectValue* o = v.GetObjectValue();
+		if (o->GetType() == ObjectValue::STRING_T) ((StrValue*)o)->Hash();  // cached before it's shared with other threads
+		o->MakeConstant();
+	}
 
 	return (uint8_t)(constants.size() - 1); // index of constant
 }
@@ -122,7 +170,7 @@ short Chunk::FindRunnable(Token& identifier) {
 
 			if (o->GetType() == ObjectValue::RUNNABLE_T) {
 				RunnableValue* r = (RunnableValue *)o;
-				if (r->GetName() == name) return i;
+				if (r->GetName() == name && !r->IsMethod()) return i;
 			}
 		}
 	}
@@ -134,6 +182,14 @@ bool Chunk::IsNative(Token& name) {
 	return this->natives.find(name.GetLexeme()) != this->natives.end();
 }
 
+void Chunk::AddClass(Token& name) {
+	this->classes.insert({ name.GetLexeme(), true });
+}
+
+bool Chunk::IsClass(Token& name) {
+	return this->classes.find(name.GetLexeme()) != this->classes.end();
+}
+
 
 void Chunk::Append(uint8_t byte) {
 	code.push_back(byte);
@@ -148,22 +204,14 @@ std::vector<uint8_t>& Chunk::GetCode() {
 	return this->code;
 }
 
-bool Chunk::IsAtEnd() {
-	short i = this->code.size() - 1;  // vector.size() returns an unsigned type 
-				//so it must be converted to a signed type in case the size is 0
-	return this->ip > i; 
-}
-
-
-int Chunk::CountLines(bool CompileTime) {
+int Chunk::CountLines(short end) {
+	// Count the lines in the chunk up to offset 'end'.
+	// For compile-time errors, that is the end of the chunk
+	// For runtime errors, that is the current ip
 	int line = 1;
 	short op = 0;
 
-	short limit = (CompileTime ? this->code.size(): this->ip);
-	// For compile-time errors, we will need the end of the chunk
-	// For runtime errors, we will need the current ip								
-
-	while (op < limit) {
+	while (op < end) {
 		switch (this->code[op]) {
 			case OP_CONSTANT:
 			case OP_DEFINE_GLOBAL:
@@ -195,12 +243,31 @@ int Chunk::CountLines(bool CompileTime) {
 			case OP_BIT_OR_ASSIGN_LOCAL:
 			case OP_BIT_XOR_ASSIGN_LOCAL:
 			case OP_SHIFTL_ASSIGN_LOCAL:
-			case OP_SHIFTR_ASSIGN_LOCAL: {
+			case OP_SHIFTR_ASSIGN_LOCAL:
+			case OP_BUILD_LIST:
+			case OP_BUILD_MAP:
+			case OP_CALL:
+			case OP_SPAWN:
+			case OP_CLASS:
+			case OP_CONSTRUCT: {
 				op += 2;
 				break;
 			}
 
+			case OP_FOR_ITER_GLOBAL:
+			case OP_FOR_ITER_LOCAL:
+			case OP_RANGE_GLOBAL:
+			case OP_RANGE_LOCAL:
+			case OP_RANGE_STEP_GLOBAL:
+			case OP_RANGE_STEP_LOCAL:
+			case OP_GET_FIELD:
+			case OP_SET_FIELD: {
+				op += 4;
+				break;
+			}
+
 			case OP_CALL_NATIVE:
+			case OP_INVOKE:
 			case OP_JUMP:
 			case OP_JUMP_IF_FALSE:
 			case OP_JUMP_IF_TRUE:
@@ -209,7 +276,8 @@ int Chunk::CountLines(bool CompileTime) {
 				break;
 			}
 			
-			case OP_DEFINE_RUNNABLE: {
+			case OP_DEFINE_RUNNABLE:
+			case OP_METHOD: {
 				line += code[op + 2];
 				op += 3;
 				break;
@@ -261,12 +329,31 @@ int Chunk::CountLines(std::string& RunnableName) {
 			case OP_BIT_OR_ASSIGN_LOCAL:
 			case OP_BIT_XOR_ASSIGN_LOCAL:
 			case OP_SHIFTL_ASSIGN_LOCAL:
-			case OP_SHIFTR_ASSIGN_LOCAL: {
+			case OP_SHIFTR_ASSIGN_LOCAL:
+			case OP_BUILD_LIST:
+			case OP_BUILD_MAP:
+			case OP_CALL:
+			case OP_SPAWN:
+			case OP_CLASS:
+			case OP_CONSTRUCT: {
 				op += 2;
 				break;
 			}
 
+			case OP_FOR_ITER_GLOBAL:
+			case OP_FOR_ITER_LOCAL:
+			case OP_RANGE_GLOBAL:
+			case OP_RANGE_LOCAL:
+			case OP_RANGE_STEP_GLOBAL:
+			case OP_RANGE_STEP_LOCAL:
+			case OP_GET_FIELD:
+			case OP_SET_FIELD: {
+				op += 4;
+				break;
+			}
+
 			case OP_CALL_NATIVE:
+			case OP_INVOKE:
 			case OP_JUMP:
 			case OP_JUMP_IF_FALSE:
 			case OP_JUMP_IF_TRUE:
@@ -275,10 +362,11 @@ int Chunk::CountLines(std::string& RunnableName) {
 				break;
 			}
 
-			case OP_DEFINE_RUNNABLE: {
+			case OP_DEFINE_RUNNABLE:
+			case OP_METHOD: {
 				uint8_t index = this->code[op + 1];
 				if (constants[index].ToString() == RunnableName) {
-					return line - 1;
+					return line;
 				}
 				else {
 					line += this->code[op + 2];
@@ -294,18 +382,10 @@ int Chunk::CountLines(std::string& RunnableName) {
 	return line;
 }
 
-short Chunk::GetOffset() {
-	return this->ip;
-}
-
 short Chunk::GetSize() {
 	return this->code.size();
 }
 
-void Chunk::MoveIp(short distance) {
-	ip += distance;
-}
-
 void Chunk::PatchJump(short JumpIndex, short distance) {
 	// JumpIndex is the second byte of the jump command's operand
 	// Function will patch the jump distance as 'distance'
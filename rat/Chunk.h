@@ -80,10 +80,34 @@ typedef enum {
 	OP_REPEAT, 
 	OP_END_REPEAT,
 
+	OP_BUILD_LIST,	// operand: number of elements on the stack
+	OP_BUILD_MAP,	// operand: number of key-value pairs on the stack
+	OP_GET_INDEX,
+	OP_SET_INDEX,
+
+	OP_GET_ITER,
+	OP_FOR_ITER_GLOBAL,	// operands: loop variable, then the jump out of the loop
+	OP_FOR_ITER_LOCAL,
+	OP_RANGE_GLOBAL,	// operands: loop variable, then the jump out of the loop. Bounds are on the stack
+	OP_RANGE_LOCAL,
+	OP_RANGE_STEP_GLOBAL,	// operands: loop variable, then the jump back to the start of the body
+	OP_RANGE_STEP_LOCAL,
+
 	OP_DEFINE_RUNNABLE,
 	OP_CALL,
 	OP_CALL_NATIVE,
 	OP_RETURN,
+	OP_AWAIT,	// waits for a future and swaps it for its result
+	OP_SPAWN,	// operand: the runnable's name. Starts the call as a task, and leaves its future
+	OP_YIELD,	// suspends the generator running in this frame, and leaves the value on top to whoever resumed it
+
+	OP_CLASS,		// operand: the rat's name. Methods are added to it before it's defined as a global
+	OP_METHOD,		// operands: the method, then its number of lines, like OP_DEFINE_RUNNABLE
+	OP_CONSTRUCT,	// operand: number of arguments
+	OP_GET_THIS,
+	OP_GET_FIELD,	// operands: the field's name, then a two-byte inline cache slot
+	OP_SET_FIELD,
+	OP_INVOKE,		// operands: the method's name, then the number of arguments
 	OP_XOR
 } Opcode;
 
@@ -91,14 +115,13 @@ typedef struct Chunk {
 private:
 
 	std::vector<uint8_t> code;
-	short ip;
 
 	std::vector<Value> constants;
 	std::unordered_map<std::string, bool> natives; // names of native runnables
+	std::unordered_map<std::string, bool> classes; // names of the rats declared so far, which are called to construct them
 
 public:
 	Chunk();
-	Chunk(Chunk *);
 	~Chunk();
 
 	
@@ -109,23 +132,22 @@ public:
 	
 	bool IsNative(Token &name);
 
+	void AddClass(Token& name);
+	bool IsClass(Token& name);
+
 	void Append(uint8_t);
 	void Append(uint8_t, uint8_t);
 
-	uint8_t advance();
 	Value ReadConstant(uint8_t index);
 
 	std::vector<uint8_t>& GetCode();
 	std::vector<Value>& GetConstants();
-	bool IsAtEnd();
 
-	short GetOffset();
 	short GetSize();
-	void MoveIp(short distance);
 
 	void PatchJump(short JumpIndex, short distance);
 
-	int CountLines(bool CompileTime);
+	int CountLines(short end);
 	int CountLines(std::string& RunnableName); 
 } Chunk;
 
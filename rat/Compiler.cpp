@@ -5,6 +5,10 @@ Compiler::Compiler(std::vector<Token>& tokens) {
 	CurrentTokenOffset = 0;
 	
 	HadError = false;
+	SkippedLines = 0;
+	CacheSlots = 0;
+	SpawnCall = -1;
+	ct = COMPILE_SCRIPT;
 
 	for (size_t i = 0; i < NumTokenTypes; i++) {
 		RuleTable[i] = { nullptr, nullptr, PREC_NONE };
@@ -44,8 +48,13 @@ Compiler::Compiler(std::vector<Token>& tokens) {
 	RuleTable[LESS] =			{ nullptr, &Compiler::binary, PREC_COMPARE };
 
 	RuleTable[LEFT_PAREN] = { &Compiler::grouping, &Compiler::call, PREC_LITERAL};
+	RuleTable[LEFT_BRACKET] = { &Compiler::list, &Compiler::subscript, PREC_LITERAL };
+	RuleTable[LEFT_BRACE] =	{ &Compiler::map, nullptr, PREC_LITERAL };
+	RuleTable[DOT] =		{ nullptr, &Compiler::dot, PREC_LITERAL };
 
 	RuleTable[BANG] =		{ &Compiler::unary, nullptr, PREC_UNARY };
+	RuleTable[AWAIT] =		{ &Compiler::unary, nullptr, PREC_UNARY };
+	RuleTable[SPAWN] =		{ &Compiler::spawn, nullptr, PREC_UNARY };
 
 	RuleTable[TOKEN_EOF] =		{ nullptr, nullptr, PREC_END };
 	RuleTable[TOKEN_NEWLINE] =	{ nullptr, nullptr, PREC_END };
@@ -53,15 +62,18 @@ Compiler::Compiler(std::vector<Token>& tokens) {
 	RuleTable[RAT] =		{ &Compiler::declaration, nullptr, PREC_NONE };
 
 	RuleTable[IDENTIFIER] = { &Compiler::variable, nullptr, PREC_LITERAL };
+	RuleTable[THIS] =		{ &Compiler::self, nullptr, PREC_LITERAL };
 
 	RuleTable[IF] =			{ &Compiler::declaration, nullptr, PREC_ASSIGN };
 	RuleTable[WHILE] =		{ &Compiler::declaration, nullptr, PREC_ASSIGN };
 	RuleTable[REPEAT] =		{ &Compiler::declaration, nullptr, PREC_ASSIGN };
+	RuleTable[FOR] =		{ &Compiler::declaration, nullptr, PREC_ASSIGN };
 
 	CurrentBody = new RunnableValue(new Chunk);
 }
 
 Compiler::~Compiler() {
+	for (auto& cold : colds) FreeConstant(cold.second);
 }
 
 RunnableValue* Compiler::Compile() {
@@ -94,9 +106,10 @@ void Compiler::ErrorAtCurrent(int e, std::string msg) {
 }
 
 void Compiler::error(int e, std::string msg, Token where) {
-	int line = CurrentChunk()->CountLines(true);
+	int line = CurrentChunk()->CountLines(CurrentChunk()->GetSize()) + SkippedLines;
 	if (CurrentBody->GetEnclosing() != nullptr) {
-		line += CurrentBody->GetEnclosing()->GetChunk()->CountLines(true);
+		// Runnable bodies are compiled after the whole script, so look up where this one was declared
+		line += CurrentBody->GetEnclosing()->GetChunk()->CountLines(CurrentBody->ToString());
 	}
 
 	std::string lexeme =  "'" + where.GetLexeme() + "'";
@@ -173,13 +186,17 @@ uint8_t Compiler::block() {
 			case ENDREPEAT:
 				return BREAK_REPEAT;
 
+			case ENDFOR:
+				return BREAK_FOR;
+
 			case TOKEN_EOF:
 				return UNCLOSED_BLOCK;
 
 			case RETURN: {
 				advance();
-				if (match(TOKEN_NEWLINE)) EmitBytes(OP_NONE, OP_RETURN);
+				if (match(TOKEN_NEWLINE)) EmitBytes(IsInitializer() ? OP_GET_THIS : OP_NONE, OP_RETURN);
 				else {
+					if (IsInitializer()) ErrorAtCurrent(UNEXPECTED_TOKEN, "Can't return a value from 'init'");
 					expression(true);
 					EmitByte(OP_RETURN);
 				}
@@ -187,6 +204,22 @@ uint8_t Compiler::block() {
 				break;
 			}
 
+			case YIELD: {
+				// Makes the runnable a generator: calling it gives a generator, which runs the body up to each yield
+				advance();
+				if (ct != COMPILE_RUNNABLE) ErrorAtPrevious(UNEXPECTED_TOKEN, "Can't yield outside a runnable");
+				if (IsInitializer()) ErrorAtPrevious(UNEXPECTED_TOKEN, "Can't yield from 'init'");
+				if (CurrentBody->IsAsync()) ErrorAtPrevious(UNEXPECTED_TOKEN, "Can't yield from an async runnable");
+
+				if (match(TOKEN_NEWLINE)) EmitByte(OP_NONE);
+				else expression(true);
+				EmitByte(OP_YIELD);
+
+				CurrentBody->MakeGenerator();
+				break;
+			}
+
+			case ASYNC:
 			case RUNNABLE:{
 				try {
 					ErrorAtCurrent(BLOCKED_RUNNABLE, "Can't define a runnable inside a block");
@@ -196,6 +229,16 @@ uint8_t Compiler::block() {
 				}
 				break;
 			}
+
+			case COLD: {
+				try {
+					ErrorAtCurrent(BLOCKED_RUNNABLE, "Can't declare a cold constant inside a block or runnable");
+				}
+				catch (int e) {
+					synchronize();
+				}
+				break;
+			}
 			default:
 				try {
 					declaration(true);
@@ -215,6 +258,16 @@ void Compiler::variable(bool CanAssign) {
 	enum VarType {global, local};
 	VarType CurrentVar = global;
 
+	auto cold = colds.find(Identifier.GetLexeme());
+	if (cold != colds.end() && (ct == COMPILE_SCRIPT || ResolveLocal(Identifier) == -1)) {
+		// The value is known now, so no global is looked up at runtime
+		if (IsAssignment(CurrentToken().GetType())) {
+			ErrorAtCurrent(ASSIGN_COLD, "Can't assign to cold constant '" + Identifier.GetLexeme() + "'");
+		}
+		EmitCold(cold->second);
+		return;
+	}
+
 	if (ct == COMPILE_RUNNABLE) {
 		short sindex = ResolveLocal(Identifier);
 
@@ -332,8 +385,25 @@ void Compiler::variable(bool CanAssign) {
 void Compiler::call(bool CanAssign) {
 	Token name = peek(-1);
 
+	bool spawned = (SpawnCall == CurrentTokenOffset - 1);
+	SpawnCall = -1;
+
 	ObjectValue* o = nullptr;
 	bool native = false;
+
+	Chunk* global = GlobalChunk();
+	bool OnlyNative = CurrentChunk()->IsNative(name) && global->FindRunnable(name) == -1;
+	if (spawned && (global->IsClass(name) || OnlyNative)) {
+		ErrorAtPrevious(UNEXPECTED_TOKEN, "Can only spawn a call to a runnable");
+	}
+
+	if (global->IsClass(name)) {
+		// Constructing an instance. The rat's 'init' runnable is compiled lazily, so its arity is checked at runtime
+		advance();	// advance over opening parenthesis
+		EmitBytes(OP_CONSTRUCT, ArgumentList());
+		return;
+	}
+
 	if (ct == COMPILE_SCRIPT) {
 		short RunnableIndex = CurrentChunk()->FindRunnable(name);
 		
@@ -350,8 +420,6 @@ void Compiler::call(bool CanAssign) {
 		}
 	}
 	else if (ct == COMPILE_RUNNABLE) {
-		Chunk* global = this->CurrentBody->GetEnclosing()->GetChunk();
-
 		short RunnableIndex = global->FindRunnable(name);
 
 		if (RunnableIndex == -1) {
@@ -384,10 +452,122 @@ void Compiler::call(bool CanAssign) {
 				"Rat '" + name.GetLexeme() + "' takes " + std::to_string(((RunnableValue*)o)->GetArity())
 				+ " arguments, but " + std::to_string(arity) + " were passed", name);
 		}
-		EmitBytes(OP_CALL, index);
+		EmitBytes(spawned ? OP_SPAWN : OP_CALL, index);
 	} 
 }
 
+void Compiler::list(bool CanAssign) {
+	// List literal: [a, b, c]. It may span several lines
+	advance();	// consume '['
+
+	uint8_t count = 0;
+	while (true) {
+		while (match(TOKEN_NEWLINE)) literal(true);
+		if (match(RIGHT_BRACKET) || match(TOKEN_EOF)) break;
+
+		if (count == 255) ErrorAtCurrent(TABLE_OVERFLOW, "A list literal can't have over 255 elements");
+		expression(true);
+		count++;
+
+		while (match(TOKEN_NEWLINE)) literal(true);
+		if (!match(COMMA)) break;
+		advance();
+	}
+
+	consume(RIGHT_BRACKET, "Expected ']' after list elements");
+	EmitBytes(OP_BUILD_LIST, count);
+}
+
+void Compiler::map(bool CanAssign) {
+	// Map literal: {key: value, ...}. It may span several lines
+	advance();	// consume '{'
+
+	uint8_t count = 0;
+	while (true) {
+		while (match(TOKEN_NEWLINE)) literal(true);
+		if (match(RIGHT_BRACE) || match(TOKEN_EOF)) break;
+
+		if (count == 255) ErrorAtCurrent(TABLE_OVERFLOW, "A map literal can't have over 255 entries");
+		expression(true);
+		consume(COLON, "Expected ':' after map key");
+		while (match(TOKEN_NEWLINE)) literal(true);
+		expression(true);
+		count++;
+
+		while (match(TOKEN_NEWLINE)) literal(true);
+		if (!match(COMMA)) break;
+		advance();
+	}
+
+	consume(RIGHT_BRACE, "Expected '}' after map entries");
+	EmitBytes(OP_BUILD_MAP, count);
+}
+
+void Compiler::subscript(bool CanAssign) {
+	// Indexing a list or a map: xs[i], or xs[i] = v as an assignment
+	advance();	// consume '['
+	expression(true);
+	consume(RIGHT_BRACKET, "Expected ']' after index");
+
+	if (CanAssign && match(EQUALS)) {
+		advance();
+		expression(true);
+		EmitByte(OP_SET_INDEX);
+	}
+	else EmitByte(OP_GET_INDEX);
+}
+
+void Compiler::dot(bool CanAssign) {
+	// Field of an instance: p.x, or p.x = v as an assignment. Followed by an argument list, a call of its runnable
+	advance();	// consume '.'
+	consume(IDENTIFIER, "Expected field name after '.'");
+	uint8_t index = SafeAddConstant(peek(-1));
+
+	if (match(LEFT_PAREN)) {
+		advance();
+		uint8_t arity = ArgumentList();
+		EmitByte(OP_INVOKE);
+		EmitBytes(index, arity);
+		return;
+	}
+
+	Opcode op = OP_GET_FIELD;
+	if (CanAssign && match(EQUALS)) {
+		advance();
+		expression(true);
+		op = OP_SET_FIELD;
+	}
+
+	// Each access gets its own slot, where the interpreter caches the shapes it has seen there
+	if (CacheSlots == UINT16_MAX) ErrorAtPrevious(TABLE_OVERFLOW, "Too many field accesses in the script");
+	EmitBytes(op, index);
+	EmitBytes((CacheSlots >> 8) & 0xFF, CacheSlots & 0xFF);
+	CacheSlots++;
+}
+
+void Compiler::self(bool CanAssign) {
+	// 'this', the instance that a rat's runnable was called on
+	if (ct != COMPILE_RUNNABLE || !CurrentBody->IsMethod()) {
+		ErrorAtCurrent(UNEXPECTED_TOKEN, "Can only use 'this' inside a rat's runnable");
+	}
+
+	advance();
+	EmitByte(OP_GET_THIS);
+}
+
+
+void Compiler::spawn(bool CanAssign) {
+	// 'spawn f(args)' starts the call as a task, and gives its future
+	advance();	// consume 'spawn'
+
+	if (!match(IDENTIFIER) || peek(1).GetType() != LEFT_PAREN) {
+		ErrorAtCurrent(UNEXPECTED_TOKEN, "Expected a call to a runnable after 'spawn'");
+	}
+	SpawnCall = CurrentTokenOffset;
+
+	ParsePrecedence(PREC_UNARY);
+	SpawnCall = -1;
+}
 
 void Compiler::unary(bool CanAssign) {
 	// Function to handle the 'unary' rule of Hotrat's grammar
@@ -398,6 +578,7 @@ void Compiler::unary(bool CanAssign) {
 	switch (op.GetType()) {
 		case MINUS:	EmitByte(OP_NEGATE); break;
 		case BANG:  EmitByte(OP_NOT);	 break;
+		case AWAIT: EmitByte(OP_AWAIT);	 break;
 
 	default: break;
 	}
@@ -411,9 +592,11 @@ void Compiler::binary(bool CanAssign) {
 	short ConditionJump = -1;
 	if (op.GetType() == AND) {
 		ConditionJump = EmitJump(OP_JUMP_IF_FALSE); // no need to check second condition
+		EmitByte(OP_POP);	// otherwise the right operand's value replaces the left one's
 	}
 	else if (op.GetType() == OR) {
 		ConditionJump = EmitJump(OP_JUMP_IF_TRUE);  // no need to check second condition
+		EmitByte(OP_POP);
 	}
 
 	ParseRule rule = GetRule(op.GetType());
@@ -443,9 +626,9 @@ void Compiler::binary(bool CanAssign) {
 		case XOR:			EmitByte(OP_XOR);				break;
 
 		case AND:
-		case OR: {
+		case OR:
 			PatchJump(ConditionJump);
-		}
+			break;
 
 		default:
 			break;
@@ -478,6 +661,20 @@ void Compiler::declaration(bool CanAssign) {
 			break;
 		}
 
+		case ASYNC: {
+			advance();
+			if (!match(RUNNABLE)) ErrorAtCurrent(UNEXPECTED_TOKEN, "Expected 'runnable' after 'async'");
+			advance();
+			RunnableDeclaration("", true);
+			break;
+		}
+
+		case COLD: {
+			advance();
+			ColdDeclaration();
+			break;
+		}
+
 		default: statement(CanAssign);
 	}
 }
@@ -506,6 +703,12 @@ void Compiler::statement(bool CanAssign) {
 			break;
 		}
 
+		case FOR: {
+			advance();
+			ForStatement();
+			break;
+		}
+
 		default:	ExpressionStatement(); break;
 	}
 }
@@ -531,7 +734,12 @@ void Compiler::VarDeclaration() {
 	if (identifier.GetType() != IDENTIFIER) {
 		ErrorAtPrevious(UNEXPECTED_TOKEN, "Expected identifier after 'rat' keyword");
 	}
+	if (ct == COMPILE_SCRIPT) CheckNotCold(identifier);
 
+	if (match(COLON)) {
+		ClassDeclaration(identifier);
+		return;
+	}
 
 	if (match(EQUALS)) {
 		advance();
@@ -554,6 +762,168 @@ void Compiler::VarDeclaration() {
 	}
 }
 
+void Compiler::ColdDeclaration() {
+	// cold <identifier> = <constant expression>
+	// Evaluated here rather than at runtime. Every later use of the name compiles to the value itself
+
+	Token identifier = advance();
+	if (identifier.GetType() != IDENTIFIER) {
+		ErrorAtPrevious(UNEXPECTED_TOKEN, "Expected identifier after 'cold' keyword");
+	}
+	CheckNotCold(identifier);
+
+	Chunk* global = GlobalChunk();
+	if (global->IsNative(identifier) || global->IsClass(identifier) || global->FindRunnable(identifier) != -1) {
+		ErrorAtPrevious(UNEXPECTED_TOKEN, "'" + identifier.GetLexeme() + "' is already a runnable or a rat");
+	}
+
+	consume(EQUALS, "Expected '=' after cold constant's name");
+	Value v = ConstantExpression(PREC_ASSIGN);
+	colds[identifier.GetLexeme()] = v;
+}
+
+void Compiler::CheckNotCold(Token& identifier) {
+	// Globals, runnables and rats can't take a cold constant's name, its uses were already replaced with the value
+	if (colds.count(identifier.GetLexeme())) {
+		ErrorAtPrevious(ASSIGN_COLD, "'" + identifier.GetLexeme() + "' is already a cold constant");
+	}
+}
+
+bool Compiler::IsAssignment(TokenType type) {
+	// Tokens that assign to the variable before them
+	switch (type) {
+		case EQUALS:	case PLUS_PLUS:		case MINUS_MINUS:
+		case PLUS_ASSIGN:	case MINUS_ASSIGN:	case STAR_ASSIGN:	case SLASH_ASSIGN:
+		case BIT_AND_ASSIGN:	case BIT_OR_ASSIGN:	case BIT_XOR_ASSIGN:
+		case SHIFT_LEFT_ASSIGN:	case SHIFT_RIGHT_ASSIGN:
+			return true;
+
+		default:	return false;
+	}
+}
+
+
+void Compiler::RangeStatement(Token& identifier) {
+	// for <identifier> in range(start, end, step): ... endfor
+	// A counted loop rather than an iterator. start defaults to 0 and step to 1. The three numbers stay on the stack
+	// while the loop runs, the first as the counter, and one instruction at the end of the body advances the counter,
+	// checks it against the end, copies it into the loop variable and jumps back
+
+	uint8_t LocalsCount = 0;
+	uint8_t index;
+	Opcode enter, step;
+
+	if (ct == COMPILE_SCRIPT) {
+		index = SafeAddConstant(identifier);
+		enter = OP_RANGE_GLOBAL;
+		step = OP_RANGE_STEP_GLOBAL;
+	}
+	else {
+		LocalsCount = CurrentBody->GetLocals().size();
+
+		short slot = ResolveLocal(identifier);
+		if (slot == -1) {
+			EmitByte(OP_NONE);	// the loop variable's slot, below the bounds
+			slot = AddLocal(identifier);
+		}
+		index = slot;
+		enter = OP_RANGE_LOCAL;
+		step = OP_RANGE_STEP_LOCAL;
+	}
+
+	advance();	// consume 'range'
+	advance();	// consume '('
+
+	short ArgsStart = CurrentChunk()->GetSize();
+	uint8_t count = 0;
+	while (!match(RIGHT_PAREN) && !match(TOKEN_EOF)) {
+		if (count == 3) ErrorAtCurrent(UNEXPECTED_TOKEN, "range() takes at most 3 arguments");
+		expression(true);
+		count++;
+		if (!match(COMMA)) break;
+		advance();
+	}
+	consume(RIGHT_PAREN, "Expected ')' after range arguments");
+	consume(COLON, "Expected ':' after expression");
+
+	if (count == 0) ErrorAtPrevious(UNEXPECTED_TOKEN, "range() needs at least an end");
+	if (count == 1) {
+		// range(end) starts at 0. The end was already compiled, so the start goes in before it
+		uint8_t zero = SafeAddConstant(Value((int64_t)0));
+		std::vector<uint8_t>& code = CurrentChunk()->GetCode();
+		code.insert(code.begin() + ArgsStart, { OP_CONSTANT, zero });
+	}
+	if (count < 3) EmitBytes(OP_CONSTANT, SafeAddConstant(Value((int64_t)1)));
+
+	if (ct == COMPILE_RUNNABLE) {
+		Token hidden[3] = { Token(IDENTIFIER, " counter"), Token(IDENTIFIER, " end"), Token(IDENTIFIER, " step") };
+		for (int i = 0; i < 3; i++) AddLocal(hidden[i]);
+	}
+
+	EmitBytes(enter, index);
+	EmitBytes(0, 0);	// jump out of the loop if the range is empty
+	short BreakLoop = CurrentChunk()->GetSize() - 1;
+	short BodyStart = BreakLoop;
+
+	uint8_t BodyLocals = (ct == COMPILE_RUNNABLE) ? CurrentBody->GetLocals().size() : 0;
+
+	uint8_t BlockCode = block();
+	switch (BlockCode) {
+		case BREAK_FOR:	advance(); break;
+
+		case UNCLOSED_BLOCK:	ErrorAtCurrent(UNCLOSED_BLOCK, "expected 'endfor'");
+
+		default:	ErrorAtCurrent(UNEXPECTED_TOKEN, "expected 'endfor'");
+	}
+
+	if (ct == COMPILE_RUNNABLE) DiscardLocals(BodyLocals);	// rats declared in the body live for one iteration
+
+	EmitBytes(step, index);
+	EmitBytes(0, 0);
+	short StepEnd = CurrentChunk()->GetSize() - 1;
+	CurrentChunk()->PatchJump(StepEnd, StepEnd - BodyStart);
+
+	PatchJump(BreakLoop);
+
+	if (ct == COMPILE_SCRIPT) {
+		for (int i = 0; i < 3; i++) EmitByte(OP_POP);	// pop the bounds
+	}
+	else DiscardLocals(LocalsCount);
+}
+
+
+void Compiler::ClassDeclaration(Token& identifier) {
+	// rat Name: followed by the rat's runnables, up to 'endrat'.
+	// Instances get their fields when they're first assigned, usually by the 'init' runnable that constructing one calls
+
+	if (ct != COMPILE_SCRIPT) ErrorAtPrevious(BLOCKED_RUNNABLE, "Can't declare a rat inside a runnable");
+
+	advance();	// consume ':'
+	consume(TOKEN_NEWLINE, "Expected newline after rat declaration");
+
+	uint8_t IdIndex = SafeAddConstant(identifier);
+	CurrentChunk()->AddClass(identifier);
+
+	EmitBytes(OP_CLASS, IdIndex);
+	EmitByte(OP_NEWLINE);
+
+	while (true) {
+		while (match(TOKEN_NEWLINE)) literal(true);
+		if (match(ENDRAT)) break;
+
+		if (match(TOKEN_EOF))	ErrorAtCurrent(UNCLOSED_BLOCK, "Expected 'endrat'");
+		bool async = match(ASYNC);
+		if (async) advance();
+		if (!match(RUNNABLE))	ErrorAtCurrent(UNEXPECTED_TOKEN, "A rat's body can only declare runnables");
+
+		advance();
+		RunnableDeclaration(identifier.GetLexeme(), async);
+	}
+
+	advance();	// consume 'endrat'
+	EmitBytes(OP_DEFINE_GLOBAL, IdIndex);
+}
+
 
 void Compiler::IfStatement() {
 	expression(true);	// the condition for the block
@@ -606,6 +976,7 @@ void Compiler::WhileStatement() {
 	consume(COLON, "expected ':' after expression");
 
 	short BreakLoop = EmitJump(OP_JUMP_IF_FALSE); 
+	EmitByte(OP_POP);  // pop the condition result when entering the body
 
 	uint8_t BlockCode = block();
 	switch (BlockCode) {
@@ -618,6 +989,7 @@ void Compiler::WhileStatement() {
 	
 	PatchLoop(Loopstart); // Jump to start of loop
 	PatchJump(BreakLoop); // Set so the breaking of the loop will land here
+	EmitByte(OP_POP);	// pop the condition result when leaving the loop
 }
 
 
@@ -644,10 +1016,83 @@ void Compiler::RepeatStatement() {
 }
 
 
-void Compiler::RunnableDeclaration() {
+void Compiler::ForStatement() {
+	// for <identifier> in <iterable>: ... endfor
+	// The iterator stays on top of the stack while the loop runs, and each step stores the next value in the variable
+
+	if (!match(IDENTIFIER)) ErrorAtCurrent(UNEXPECTED_TOKEN, "Expected identifier after 'for'");
+	Token identifier = advance();
+	if (ct == COMPILE_SCRIPT) CheckNotCold(identifier);
+	consume(IN, "Expected 'in' after loop variable");
+
+	if (match(IDENTIFIER) && CurrentToken().GetLexeme() == "range" && peek(1).GetType() == LEFT_PAREN
+		&& GlobalChunk()->FindRunnable(CurrentToken()) == -1) {
+		RangeStatement(identifier);
+		return;
+	}
+
+	uint8_t LocalsCount = 0;
+	uint8_t index;
+	Opcode step;
+
+	if (ct == COMPILE_SCRIPT) {
+		index = SafeAddConstant(identifier);
+		step = OP_FOR_ITER_GLOBAL;
+	}
+	else {
+		LocalsCount = CurrentBody->GetLocals().size();
+
+		short slot = ResolveLocal(identifier);
+		if (slot == -1) {
+			EmitByte(OP_NONE);	// the loop variable's slot, below the iterator
+			slot = AddLocal(identifier);
+		}
+		index = slot;
+		step = OP_FOR_ITER_LOCAL;
+	}
+
+	expression(true);
+	consume(COLON, "Expected ':' after expression");
+	EmitByte(OP_GET_ITER);
+
+	if (ct == COMPILE_RUNNABLE) {
+		Token hidden = Token(IDENTIFIER, " iterator");  // can't clash with a name from the source
+		AddLocal(hidden);
+	}
+
+	short Loopstart = CurrentChunk()->GetSize() - 1;
+
+	EmitBytes(step, index);
+	EmitBytes(0, 0);	// jump out of the loop once the iterator is exhausted
+	short BreakLoop = CurrentChunk()->GetSize() - 1;
+
+	uint8_t BodyLocals = (ct == COMPILE_RUNNABLE) ? CurrentBody->GetLocals().size() : 0;
+
+	uint8_t BlockCode = block();
+	switch (BlockCode) {
+		case BREAK_FOR:	advance(); break;
+
+		case UNCLOSED_BLOCK:	ErrorAtCurrent(UNCLOSED_BLOCK, "expected 'endfor'");
+
+		default:	ErrorAtCurrent(UNEXPECTED_TOKEN, "expected 'endfor'");
+	}
+
+	if (ct == COMPILE_RUNNABLE) DiscardLocals(BodyLocals);	// rats declared in the body live for one iteration
+
+	PatchLoop(Loopstart);
+	PatchJump(BreakLoop);
+
+	if (ct == COMPILE_SCRIPT) EmitByte(OP_POP);	// pop the iterator
+	else DiscardLocals(LocalsCount);
+}
+
+
+void Compiler::RunnableDeclaration(const std::string& ClassName, bool async) {
 	if (!match(IDENTIFIER)) ErrorAtCurrent(UNEXPECTED_TOKEN, "Expected function name");
 
 	Token identifier = advance();
+	if (ClassName == "") CheckNotCold(identifier);
+	if (async && ClassName != "" && identifier.GetLexeme() == "init") ErrorAtPrevious(UNEXPECTED_TOKEN, "'init' can't be async");
 
 	consume(LEFT_PAREN, "Expected '(' after function name");
 	std::vector<std::string> args = ParameterList();
@@ -655,29 +1100,129 @@ void Compiler::RunnableDeclaration() {
 	consume(TOKEN_NEWLINE, "Expected newline after function declaration");
 
 	RunnableValue *rv = new RunnableValue(CurrentBody, new Chunk, args, identifier.GetLexeme());
+	if (ClassName != "") rv->MakeMethod(ClassName);
+	if (async) rv->MakeAsync();
 	Value v = Value(rv);
 	uint8_t index = SafeAddConstant(rv);
 
-	CurrentBody = rv;
-	this->ct = COMPILE_RUNNABLE;
+	// Only the signature is compiled now. The body is compiled by CompileRunnable when it's first called
+	rv->SetBodyStart(CurrentTokenOffset);
+	SkippedLines = 1;  // the declaration's own line
+	SkipRunnableBody(rv);
 
-	uint8_t BlockCode = block();
-	switch (BlockCode)
-	{
-		case BREAK_RUNNABLE:	EmitBytes(OP_NONE, OP_RETURN);	 break;
-		case UNCLOSED_BLOCK:	ErrorAtCurrent(UNCLOSED_BLOCK, "Expected 'endrunnable'");
+	uint8_t lines = SkippedLines;
+	SkippedLines = 0;
+
+	EmitBytes(ClassName != "" ? OP_METHOD : OP_DEFINE_RUNNABLE, index);
+	EmitByte(lines);  // number of lines in the runnable, to improve runtime error reporting
+}
+
+
+void Compiler::SkipRunnableBody(RunnableValue* runnable) {
+	// Step over the tokens of a runnable's body, up to and including 'endrunnable'.
+	// Counts the body's lines into SkippedLines. Assignments to cold constants are still reported now,
+	// rather than on the first call: any name the body doesn't declare as a parameter or a local is the constant
+
+	std::vector<std::string> locals = runnable->GetLocals();  // the parameters, then the locals declared so far
+
+	while (!match(ENDRUNNABLE)) {
+		switch (CurrentToken().GetType()) {
+			case TOKEN_EOF: {
+				ErrorAtCurrent(UNCLOSED_BLOCK, "Expected 'endrunnable'");
+			}
+
+			case TOKEN_NEWLINE:	SkippedLines++;	break;
+
+			case RAT:
+			case FOR:
+				if (peek(1).GetType() == IDENTIFIER) {
+					locals.push_back(peek(1).GetLexeme());
+					advance();
+				}
+				break;
+
+			case IDENTIFIER: {
+				const std::string& name = CurrentToken().GetLexeme();
+				if (peek(-1).GetType() == DOT || !colds.count(name) || !IsAssignment(peek(1).GetType())) break;
+				if (std::find(locals.begin(), locals.end(), name) != locals.end()) break;
+
+				advance();
+				try {
+					ErrorAtCurrent(ASSIGN_COLD, "Can't assign to cold constant '" + name + "'");
+				}
+				catch (int e) {}  // keep skipping, the body's 'endrunnable' is still ahead
+				continue;
+			}
 
-		default:	ErrorAtCurrent(UNEXPECTED_TOKEN, "Expected 'endrunnable'");
+			case RUNNABLE: {
+				try {
+					ErrorAtCurrent(BLOCKED_RUNNABLE, "Can't define a runnable inside a block");
+				}
+				catch (int e) {
+					// skip over the inner runnable, the enclosing one still needs its own 'endrunnable'
+					while (!match(ENDRUNNABLE) && !match(TOKEN_EOF)) {
+						if (match(TOKEN_NEWLINE)) SkippedLines++;
+						advance();
+					}
+					if (match(TOKEN_EOF)) continue;  // reported as an unclosed block
+				}
+				break;
+			}
+
+			default:	break;
+		}
+		advance();
 	}
 
 	advance();
+}
+
+
+bool Compiler::CompileRunnable(RunnableValue* runnable) {
+	// Compile the body of a runnable that was declared, but not compiled yet.
+	// Called by the interpreter on the runnable's first call. Returns false on a compilation error
+
+	std::lock_guard<std::mutex> lock(LazyLock);
+	if (runnable->IsCompiled()) return true;  // compiled by another interpreter while waiting for the lock
+	if (runnable->HasCompileFailed()) return false;  // its error was already reported, by the first call
 
-	CurrentBody = CurrentBody->GetEnclosing();
+	int ResumeOffset = CurrentTokenOffset;
+	RunnableValue* ResumeBody = CurrentBody;
+
+	CurrentTokenOffset = runnable->GetBodyStart();
+	CurrentBody = runnable;
+	this->ct = COMPILE_RUNNABLE;
+	HadError = false;
+
+	try {
+		uint8_t BlockCode = block();
+		switch (BlockCode)
+		{
+			case BREAK_RUNNABLE:	EmitBytes(IsInitializer() ? OP_GET_THIS : OP_NONE, OP_RETURN);	 break;
+			case UNCLOSED_BLOCK:	ErrorAtCurrent(UNCLOSED_BLOCK, "Expected 'endrunnable'");
+
+			default:	ErrorAtCurrent(UNEXPECTED_TOKEN, "Expected 'endrunnable'");
+		}
+	}
+	catch (int e) {}
+
+	CurrentTokenOffset = ResumeOffset;
+	CurrentBody = ResumeBody;
 	this->ct = COMPILE_SCRIPT;
 
-	uint8_t lines = rv->GetChunk()->CountLines(true);
-	EmitBytes(OP_DEFINE_RUNNABLE, index);
-	EmitByte(lines);  // number of lines in the runnable, to improve runtime error reporting
+	if (HadError) {
+		runnable->GetChunk()->GetCode().clear();
+		runnable->SetCompileFailed();
+		return false;
+	}
+
+	runnable->SetCompiled();
+	return true;
+}
+
+bool Compiler::IsInitializer() {
+	// Constructing a rat calls its 'init' runnable, which always returns the new instance
+	return ct == COMPILE_RUNNABLE && CurrentBody->IsMethod() && CurrentBody->GetName() == "init";
 }
 
 
@@ -749,6 +1294,211 @@ uint8_t Compiler::SafeAddConstant(Value v) {
 }
 
 
+Value Compiler::ConstantExpression(Precedence precedence) {
+	// Evaluate a cold constant's expression while compiling, climbing the same precedences as ParsePrecedence.
+	// Only literals, other cold constants and operators are allowed, so the result never depends on the runtime
+	Value left = ConstantOperand();
+
+	while (precedence <= GetRule(CurrentToken().GetType()).precedence) {
+		Token op = advance();
+		if (GetRule(op.GetType()).infix != &Compiler::binary) {
+			FreeConstant(left);
+			ErrorAtPrevious(NOT_CONSTANT, "A cold constant's value must be known when compiling");
+		}
+
+		Value right = ConstantExpression((Precedence)(GetRule(op.GetType()).precedence + 1));
+		left = FoldBinary(op, left, right);
+	}
+	return left;
+}
+
+Value Compiler::ConstantOperand() {
+	Token tok = advance();
+
+	switch (tok.GetType()) {
+		case NUM_LITERAL: {
+			try {
+				if (tok.GetLexeme().find('.') == std::string::npos) return Value((int64_t)std::stoll(tok.GetLexeme()));
+				return Value(std::stod(tok.GetLexeme()));
+			}
+			catch (const std::exception& e) {
+				ErrorAtPrevious(FLOAT_OVERFLOW, "Value too large - can't be represented as a number value");
+			}
+		}
+		case STRING_LITERAL:	return Value(new StrValue(tok.GetLexeme()));
+		case TRUE:				return Value(true);
+		case FALSE:				return Value(false);
+		case NONE:				return Value();
+
+		case IDENTIFIER: {
+			auto cold = colds.find(tok.GetLexeme());
+			if (cold == colds.end()) {
+				ErrorAtPrevious(NOT_CONSTANT, "'" + tok.GetLexeme() + "' isn't a cold constant, so its value isn't known when compiling");
+			}
+
+			Value v = cold->second;
+			if (v.IsObject()) v = Value(new StrValue(std::string(((StrValue*)v.GetObjectValue())->GetView())));
+			return v;
+		}
+
+		case LEFT_PAREN: {
+			Value v = ConstantExpression(PREC_ASSIGN);
+			if (!match(RIGHT_PAREN)) {
+				FreeConstant(v);
+				ErrorAtCurrent(UNEXPECTED_TOKEN, "Expected ')' after expression");
+			}
+			advance();
+			return v;
+		}
+
+		case MINUS: {
+			Value v = ConstantExpression(PREC_UNARY);
+			if (!v.IsNumber()) {
+				FreeConstant(v);
+				ErrorAtPrevious(NOT_CONSTANT, "Negating a non-number type");
+			}
+			if (v.IsInt()) return Value((int64_t)(0 - (uint64_t)v.GetInt()));
+			return Value(-v.GetNum());
+		}
+
+		case BANG: {
+			Value v = ConstantExpression(PREC_UNARY);
+			if (v.GetType() == Value::BOOL_T) return Value(!v.GetBool());
+			if (v.IsInt()) return Value(~v.GetInt());
+
+			FreeConstant(v);
+			ErrorAtPrevious(NOT_CONSTANT, "'!' takes a boolean or an integer");
+		}
+
+		default:
+			ErrorAtPrevious(NOT_CONSTANT, "A cold constant's value must be known when compiling");
+	}
+	return Value();
+}
+
+Value Compiler::FoldBinary(Token& op, Value a, Value b) {
+	// The same results the interpreter would give for the operator. Frees the operands that aren't returned
+	TokenType type = op.GetType();
+
+	if (type == AND || type == OR) {
+		bool ShortCircuit = (type == AND) ? !a.IsTruthy() : a.IsTruthy();
+		FreeConstant(ShortCircuit ? b : a);
+		return ShortCircuit ? a : b;
+	}
+
+	Value result;
+	bool numbers = a.IsNumber() && b.IsNumber();
+	bool integers = a.IsInt() && b.IsInt();	// wrap around on overflow, as the interpreter's integers do
+	bool strings = a.IsObject() && b.IsObject();
+	std::string msg = "";
+
+	uint64_t x = integers ? (uint64_t)a.GetInt() : 0, y = integers ? (uint64_t)b.GetInt() : 0;
+	int shift = (int)(y & 63);
+
+	switch (type) {
+		case PLUS:
+			if (integers) result = Value((int64_t)(x + y));
+			else if (numbers) result = Value(a.GetNum() + b.GetNum());
+			else if (strings) {
+				result = Value(new StrValue(std::string(((StrValue*)a.GetObjectValue())->GetView())
+					+ std::string(((StrValue*)b.GetObjectValue())->GetView())));
+			}
+			else msg = "Can only use the '+' operator between two numbers or two strings";
+			break;
+
+		case MINUS:
+			if (integers) result = Value((int64_t)(x - y));
+			else if (numbers) result = Value(a.GetNum() - b.GetNum());
+			else msg = "Can't perform this operation on a non-number";
+			break;
+
+		case STAR:
+			if (integers) result = Value((int64_t)(x * y));
+			else if (numbers) result = Value(a.GetNum() * b.GetNum());
+			else msg = "Can't perform this operation on a non-number";
+			break;
+
+		case SLASH:
+			// Two integers that divide exactly give an integer, anything else a double
+			if (integers && b.GetInt() != 0 && !(b.GetInt() == -1 && a.GetInt() == INT64_MIN) && a.GetInt() % b.GetInt() == 0) {
+				result = Value(a.GetInt() / b.GetInt());
+			}
+			else if (numbers) result = Value(a.GetNum() / b.GetNum());
+			else msg = "Can't perform this operation on a non-number";
+			break;
+
+		case BIT_AND:		if (integers) result = Value((int64_t)(x & y));			else msg = "Can't perform this operation on a non-integer"; break;
+		case BIT_OR:		if (integers) result = Value((int64_t)(x | y));			else msg = "Can't perform this operation on a non-integer"; break;
+		case BIT_XOR:		if (integers) result = Value((int64_t)(x ^ y));			else msg = "Can't perform this operation on a non-integer"; break;
+		case SHIFT_LEFT:	if (integers) result = Value((int64_t)(x << shift));	else msg = "Can't perform this operation on a non-integer"; break;
+		case SHIFT_RIGHT:	if (integers) result = Value(a.GetInt() >> shift);		else msg = "Can't perform this operation on a non-integer"; break;
+
+		case GREATER:		if (integers) result = Value(a.GetInt() > b.GetInt());		else if (numbers) result = Value(a.GetNum() > b.GetNum());		else msg = "Can't perform this operation on a non-number"; break;
+		case LESS:			if (integers) result = Value(a.GetInt() < b.GetInt());		else if (numbers) result = Value(a.GetNum() < b.GetNum());		else msg = "Can't perform this operation on a non-number"; break;
+		case GREATER_EQUAL:	if (integers) result = Value(a.GetInt() >= b.GetInt());	else if (numbers) result = Value(!(a.GetNum() < b.GetNum()));	else msg = "Can't perform this operation on a non-number"; break;
+		case LESS_EQUAL:	if (integers) result = Value(a.GetInt() <= b.GetInt());	else if (numbers) result = Value(!(a.GetNum() > b.GetNum()));	else msg = "Can't perform this operation on a non-number"; break;
+
+		case DOUBLE_EQUALS:
+		case BANG_EQUALS: {
+			bool equal = a.GetType() == b.GetType() || numbers;
+			if (integers) equal = a.GetInt() == b.GetInt();
+			else if (numbers) equal = a.GetNum() == b.GetNum();
+			else if (equal) {
+				switch (a.GetType()) {
+					case Value::BOOL_T:		equal = a.GetBool() == b.GetBool();	break;
+					case Value::OBJECT_T:
+						equal = ((StrValue*)a.GetObjectValue())->GetView() == ((StrValue*)b.GetObjectValue())->GetView();
+						break;
+					default: break;
+				}
+			}
+			result = Value(type == DOUBLE_EQUALS ? equal : !equal);
+			break;
+		}
+
+		case XOR:	result = Value(a.IsTruthy() != b.IsTruthy()); break;
+
+		default:	msg = "A cold constant's value must be known when compiling"; break;
+	}
+
+	FreeConstant(a);
+	FreeConstant(b);
+	if (msg != "") ErrorAtPrevious(NOT_CONSTANT, msg);
+	return result;
+}
+
+void Compiler::FreeConstant(Value& v) {
+	// Strings built while folding belong to the compiler until they're copied into a chunk
+	if (v.IsObject()) delete v.GetObjectValue();
+}
+
+void Compiler::EmitCold(Value& v) {
+	// A cold constant's value, at the place it's used. Reuses an equal constant the chunk already has
+	switch (v.GetType()) {
+		case Value::BOOL_T:	EmitByte(v.GetBool() ? OP_TRUE : OP_FALSE);	return;
+		case Value::NONE_T:	EmitByte(OP_NONE);	return;
+		default: break;
+	}
+
+	std::vector<Value>& constants = CurrentChunk()->GetConstants();
+	for (size_t i = 0; i < constants.size(); i++) {
+		Value& c = constants[i];
+		if (c.GetType() != v.GetType()) continue;
+
+		bool same = (v.GetType() == Value::INT_T) ? c.GetInt() == v.GetInt()
+			: (v.GetType() == Value::NUM_T) ? c.GetNum() == v.GetNum()
+			: c.GetObjectValue()->IsString() && ((StrValue*)c.GetObjectValue())->GetView() == ((StrValue*)v.GetObjectValue())->GetView();
+		if (same) {
+			EmitBytes(OP_CONSTANT, (uint8_t)i);
+			return;
+		}
+	}
+
+	if (v.IsObject()) EmitBytes(OP_CONSTANT, SafeAddConstant(Value(new StrValue(std::string(((StrValue*)v.GetObjectValue())->GetView())))));
+	else EmitBytes(OP_CONSTANT, SafeAddConstant(v));
+}
+
+
 uint8_t Compiler::AddLocal(Token& Identifier) {
 	if (this->CurrentBody->GetLocals().size() >= 255) {
 		ErrorAtPrevious(TABLE_OVERFLOW, "Too many local variables in a runnable");
@@ -761,6 +1511,16 @@ short Compiler::ResolveLocal(Token& Identifier) {
 	return this->CurrentBody->ResolveLocal(Identifier.GetLexeme());
 }
 
+void Compiler::DiscardLocals(uint8_t count) {
+	// Pop the locals declared after the first 'count' ones, and forget their names
+	std::vector<std::string>& locals = this->CurrentBody->GetLocals();
+
+	while (locals.size() > count) {
+		EmitByte(OP_POP);
+		locals.pop_back();
+	}
+}
+
 
 Compiler::ParseRule& Compiler::GetRule(TokenType type) {
 	return RuleTable[type];
@@ -829,6 +1589,10 @@ Chunk *Compiler::CurrentChunk() {
 	return CurrentBody->GetChunk();
 }
 
+Chunk *Compiler::GlobalChunk() {
+	return (ct == COMPILE_SCRIPT) ? CurrentChunk() : CurrentBody->GetEnclosing()->GetChunk();
+}
+
 void Compiler::EmitByte(uint8_t byte) {
 	CurrentChunk()->Append(byte);
 }
@@ -6,7 +6,10 @@
 #include "Value.h"
 
 #include <vector>
+#include <algorithm>
 #include <iostream>
+#include <mutex>
+#include <unordered_map>
 
 typedef enum Precedence{
 	PREC_END,
@@ -32,13 +35,23 @@ public:
 	~Compiler();
 
 	RunnableValue* Compile();
+	bool CompileRunnable(RunnableValue* runnable);
 
 private:
 	std::vector<Token> tokens;
 	int CurrentTokenOffset;
 	bool HadError;
 
-	static enum ExitCode {
+	int SkippedLines;	// lines of a runnable body that was stepped over, but not compiled yet
+	std::mutex LazyLock;	// interpreters on different threads may reach the same uncompiled runnable
+
+	uint16_t CacheSlots;	// inline cache slots handed out to field accesses so far, one per access
+
+	int SpawnCall;	// offset of the runnable name after 'spawn', whose call starts a task. -1 if there's none
+
+	std::unordered_map<std::string, Value> colds;	// values of the cold constants, compiled into every use
+
+	enum ExitCode {
 		COMPILE_OK = 0,
 
 		UNRECOGNIZED_TOKEN = 101,
@@ -49,16 +62,19 @@ private:
 		TABLE_OVERFLOW,
 		BLOCKED_RUNNABLE,
 		UNDEFINED_RUNNABLE,
+		ASSIGN_COLD,
+		NOT_CONSTANT,
 
 		BREAK_IF = 150,
 		BREAK_WHILE,
 		BREAK_REPEAT,
+		BREAK_FOR,
 		BREAK_RUNNABLE,
 		BREAK_RAT
 	} ExitCode;// compile error code
 
 
-	static enum ChunkType {
+	enum ChunkType {
 		COMPILE_SCRIPT,
 		COMPILE_RUNNABLE,
 	};  // type of chunk currently being compiled
@@ -78,10 +94,11 @@ private:
 
 	RunnableValue* CurrentBody;
 	Chunk *CurrentChunk();
+	Chunk *GlobalChunk();	// the script's chunk, where runnables and rats are declared
 
-	void error(int e, std::string msg, Token where);
-	void ErrorAtPrevious(int e, std::string msg);
-	void ErrorAtCurrent(int e, std::string msg);
+	[[noreturn]] void error(int e, std::string msg, Token where);	// throws e
+	[[noreturn]] void ErrorAtPrevious(int e, std::string msg);
+	[[noreturn]] void ErrorAtCurrent(int e, std::string msg);
 
 	void synchronize();
 	void SynchronizeBlock();
@@ -90,6 +107,12 @@ private:
 	void literal(bool CanAssign);
 	void variable(bool CanAssign);
 	void call(bool CanAssign);
+	void list(bool CanAssign);
+	void map(bool CanAssign);
+	void subscript(bool CanAssign);
+	void dot(bool CanAssign);
+	void self(bool CanAssign);
+	void spawn(bool CanAssign);
 	void unary(bool CanAssign);
 	void binary(bool CanAssign);
 	void grouping(bool CanAssign);
@@ -98,7 +121,13 @@ private:
 	void declaration(bool CanAssign);
 
 	void VarDeclaration();
-	void RunnableDeclaration();
+	void ColdDeclaration();
+	void CheckNotCold(Token& identifier);
+	bool IsAssignment(TokenType type);
+	void ClassDeclaration(Token& identifier);
+	void RunnableDeclaration(const std::string& ClassName = "", bool async = false);	// a method of ClassName, if given
+	bool IsInitializer();
+	void SkipRunnableBody(RunnableValue* runnable);
 
 	void ExpressionStatement();
 	
@@ -107,6 +136,8 @@ private:
 	void IfStatement();
 	void WhileStatement();
 	void RepeatStatement();
+	void ForStatement();
+	void RangeStatement(Token& identifier);
 
 	uint8_t ArgumentList();
 	std::vector<std::string> ParameterList();
@@ -131,7 +162,15 @@ private:
 	uint8_t SafeAddConstant(Token& Constant);
 	uint8_t SafeAddConstant(Value v);  // for objects that have to be defined as values before insertion
 
+	// cold constants
+	Value ConstantExpression(Precedence precedence);
+	Value ConstantOperand();
+	Value FoldBinary(Token& op, Value a, Value b);
+	void FreeConstant(Value& v);
+	void EmitCold(Value& v);
+
 	uint8_t AddLocal(Token& identifier);
 	short ResolveLocal(Token& identifier);
+	void DiscardLocals(uint8_t count);
 };
 
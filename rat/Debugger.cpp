@@ -23,6 +23,15 @@ void Debugger::ConstantOperation(const std::string& name) {
 	offset += 2;
 }
 
+void Debugger::CountOperation(const std::string& name) {
+	// Print an opcode with one operand, a number of values on the stack
+	uint8_t count = code[offset + 1];
+
+	std::cout << std::setw(OPCODE_NAME_LEN) << std::left << name << "count = " << std::to_string(count) << "\n";
+
+	offset += 2;
+}
+
 void Debugger::SimpleOperation(const std::string& name) {
 	// Print a opcode with no operands
 	std::cout << std::setw(OPCODE_NAME_LEN) << std::left << name << "\t\n";
@@ -41,6 +50,26 @@ void Debugger::JumpOperation(const std::string& name) {
 	offset += 3;
 }
 
+void Debugger::ForIterOperation(const std::string& name) {
+	// Print a 'for' loop step. Its operands are the loop variable and the jump out of the loop,
+	// or back to the start of the body for the step at the end of a range loop
+	uint8_t variable = code[offset + 1];
+
+	short distance = (short)((code[offset + 2] << 8));
+	distance += (short)(code[offset + 3] & 0xFF);
+
+	std::string target = "exit --> ";
+	if (name.find("OP_RANGE_STEP") == 0) {
+		distance *= -1;
+		target = "loop --> ";
+	}
+
+	std::cout << std::setw(OPCODE_NAME_LEN) << std::left << name << std::setw(4) << std::left <<
+		std::to_string(variable) << target << std::to_string(offset + 4 + distance) << "\n";
+
+	offset += 4;
+}
+
 
 void Debugger::CallNativeOperation(const std::string& name) {
 	// Print the opcode to call a native runnable. The opcode has special operands.
@@ -55,6 +84,17 @@ void Debugger::CallNativeOperation(const std::string& name) {
 }
 
 
+void Debugger::FieldOperation(const std::string& name) {
+	// Print a field access. Its operands are the field's name and the access's inline cache slot
+	uint8_t constant = code[offset + 1];
+	uint16_t slot = (code[offset + 2] << 8) | code[offset + 3];
+
+	std::cout << std::setw(OPCODE_NAME_LEN) << std::left << name << std::setw(4) << std::left <<
+		std::to_string(constant) << "cache = " << std::to_string(slot) << "\n";
+
+	offset += 4;
+}
+
 void Debugger::RunnableDefinition(const std::string& name) {
 	// Print the opcode to define a user-defined runnable. The opcode has special operands.
 
@@ -101,6 +141,11 @@ void Debugger::DisassembleRunnable(RunnableValue *runnable, int LineOffset) {
 	this->ChunkName = runnable->GetName();
 	std::cout << "\n\n\n==" << ChunkName << "==\n";
 
+	if (!runnable->IsCompiled()) {
+		std::cout << "<compiled on first call>\n\n\n";
+		return;
+	}
+
 	this->offset = 0;
 	this->chunk = runnable->GetChunk();
 	this->code = this->chunk->GetCode();
@@ -196,13 +241,37 @@ void Debugger::DisassembleInstruction() {
 		case OP_REPEAT:				SimpleOperation("OP_REPEAT");		break;
 		case OP_END_REPEAT:			SimpleOperation("OP_END_REPEAT");	break;
 
+		case OP_BUILD_LIST:			CountOperation("OP_BUILD_LIST");			break;
+		case OP_BUILD_MAP:			CountOperation("OP_BUILD_MAP");				break;
+		case OP_GET_INDEX:			SimpleOperation("OP_GET_INDEX");			break;
+		case OP_SET_INDEX:			SimpleOperation("OP_SET_INDEX");			break;
+
+		case OP_GET_ITER:			SimpleOperation("OP_GET_ITER");				break;
+		case OP_FOR_ITER_GLOBAL:	ForIterOperation("OP_FOR_ITER_GLOBAL");		break;
+		case OP_FOR_ITER_LOCAL:		ForIterOperation("OP_FOR_ITER_LOCAL");		break;
+		case OP_RANGE_GLOBAL:		ForIterOperation("OP_RANGE_GLOBAL");		break;
+		case OP_RANGE_LOCAL:		ForIterOperation("OP_RANGE_LOCAL");			break;
+		case OP_RANGE_STEP_GLOBAL:	ForIterOperation("OP_RANGE_STEP_GLOBAL");	break;
+		case OP_RANGE_STEP_LOCAL:	ForIterOperation("OP_RANGE_STEP_LOCAL");	break;
+
 
 		case OP_DEFINE_RUNNABLE:	RunnableDefinition("OP_DEFINE_RUNNABLE");	break;
 		case OP_CALL:				ConstantOperation("OP_CALL");				break;
 		case OP_RETURN:				SimpleOperation("OP_RETURN");				break;
+		case OP_AWAIT:				SimpleOperation("OP_AWAIT");				break;
+		case OP_SPAWN:				ConstantOperation("OP_SPAWN");				break;
+		case OP_YIELD:				SimpleOperation("OP_YIELD");				break;
 
 		case OP_CALL_NATIVE:		CallNativeOperation("OP_CALL_NATIVE");				break;
 
+		case OP_CLASS:				ConstantOperation("OP_CLASS");				break;
+		case OP_METHOD:				RunnableDefinition("OP_METHOD");			break;
+		case OP_CONSTRUCT:			CountOperation("OP_CONSTRUCT");				break;
+		case OP_GET_THIS:			SimpleOperation("OP_GET_THIS");				break;
+		case OP_GET_FIELD:			FieldOperation("OP_GET_FIELD");				break;
+		case OP_SET_FIELD:			FieldOperation("OP_SET_FIELD");				break;
+		case OP_INVOKE:				CallNativeOperation("OP_INVOKE");			break;
+
 		default: {
 			std::cout << "Unrecognized instruction" << instruction << "\t\n";
 			offset++;
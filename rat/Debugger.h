@@ -20,9 +20,12 @@ private:
 	std::string PrintLineNum;
 
 	void ConstantOperation(const std::string& name);
+	void CountOperation(const std::string& name);
 	void SimpleOperation(const std::string& name);
 	void JumpOperation(const std::string& name);
+	void ForIterOperation(const std::string& name);
 	void CallNativeOperation(const std::string& name);
+	void FieldOperation(const std::string& name);
 	void RunnableDefinition(const std::string& name);
 	
 	void DisassembleInstruction();
@@ -0,0 +1,193 @@
+#include "EventLoop.h"
+
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+
+#include <fcntl.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+
+extern char** environ;
+
+
+Wakeup::Wakeup() {
+	this->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+}
+
+Wakeup::~Wakeup() {
+	if (this->fd != -1) close(this->fd);
+}
+
+void Wakeup::Signal() {
+	uint64_t one = 1;
+	ssize_t written = write(this->fd, &one, sizeof(one));
+	(void)written;	// only fails when the counter is already set, which wakes the loop anyway
+}
+
+void Wakeup::Drain() {
+	uint64_t count;
+	while (read(this->fd, &count, sizeof(count)) > 0);
+}
+
+
+EventLoop::EventLoop() {
+	this->epoll = epoll_create1(EPOLL_CLOEXEC);
+	this->wakeup = std::make_shared<Wakeup>();
+
+	epoll_event event = {};
+	event.events = EPOLLIN;
+	event.data.fd = this->wakeup->fd;
+	epoll_ctl(this->epoll, EPOLL_CTL_ADD, this->wakeup->fd, &event);
+}
+
+EventLoop::~EventLoop() {
+	// Whatever is still in flight is dropped. Commands keep running, but nothing reads their output
+	for (auto& o : this->operations) {
+		close(o.first);
+		delete o.second;
+	}
+	close(this->epoll);
+}
+
+bool EventLoop::Idle() {
+	return this->operations.empty();
+}
+
+bool EventLoop::Watch(FutureValue* future) {
+	return future->Notify(this->wakeup);
+}
+
+void EventLoop::Add(int fd, Operation* operation) {
+	epoll_event event = {};
+	event.events = EPOLLIN;
+	event.data.fd = fd;
+	epoll_ctl(this->epoll, EPOLL_CTL_ADD, fd, &event);
+
+	this->operations[fd] = operation;
+}
+
+void EventLoop::Remove(int fd) {
+	epoll_ctl(this->epoll, EPOLL_CTL_DEL, fd, nullptr);
+	close(fd);
+
+	delete this->operations[fd];
+	this->operations.erase(fd);
+}
+
+bool EventLoop::Sleep(double ms, std::shared_ptr<FutureValue::State> state, std::string& ErrorMsg) {
+	// A timerfd that becomes readable once the time is up
+	int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (fd == -1) {
+		ErrorMsg = std::string("Couldn't create a timer: ") + strerror(errno);
+		return false;
+	}
+
+	long long ns = (ms > 0) ? (long long)std::llround(ms * 1e6) : 0;
+	if (ns == 0) ns = 1;	// a zero expiration would disarm the timer
+
+	itimerspec spec = {};
+	spec.it_value.tv_sec = ns / 1000000000;
+	spec.it_value.tv_nsec = ns % 1000000000;
+	timerfd_settime(fd, 0, &spec, nullptr);
+
+	Operation* operation = new Operation();
+	operation->kind = Operation::TIMER;
+	operation->state = state;
+	Add(fd, operation);
+	return true;
+}
+
+bool EventLoop::Exec(const std::string& command, std::shared_ptr<FutureValue::State> state, std::string& ErrorMsg) {
+	// Start a command with the shell, its standard output going to a pipe that the loop reads as it fills
+	int fds[2];
+	if (pipe2(fds, O_CLOEXEC) == -1) {
+		ErrorMsg = std::string("Couldn't create a pipe for '" + command + "': ") + strerror(errno);
+		return false;
+	}
+
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+
+	const char* argv[] = { "sh", "-c", command.c_str(), nullptr };
+	pid_t pid;
+	int result = posix_spawn(&pid, "/bin/sh", &actions, nullptr, (char* const*)argv, environ);
+	posix_spawn_file_actions_destroy(&actions);
+	close(fds[1]);
+
+	if (result != 0) {
+		close(fds[0]);
+		ErrorMsg = "Couldn't run '" + command + "': " + strerror(result);
+		return false;
+	}
+
+	fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+
+	Operation* operation = new Operation();
+	operation->kind = Operation::COMMAND;
+	operation->state = state;
+	operation->command = command;
+	operation->pid = pid;
+	Add(fds[0], operation);
+	return true;
+}
+
+void EventLoop::ReadOutput(int fd, Operation* operation) {
+	// Take whatever the command wrote so far. Once it closes its end, its output is complete
+	char buffer[1 << 16];
+	while (true) {
+		ssize_t n = read(fd, buffer, sizeof(buffer));
+		if (n > 0) {
+			operation->output.append(buffer, n);
+			continue;
+		}
+		if (n == -1 && errno == EINTR) continue;
+		if (n == -1 && errno == EAGAIN) return;	// the rest comes with a later event
+		break;
+	}
+
+	// Closing its output almost always means the command is done, so this hardly ever waits
+	int status = 0;
+	while (waitpid(operation->pid, &status, 0) == -1 && errno == EINTR);
+
+	std::string ErrorMsg;
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		int code = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+		ErrorMsg = "Command '" + operation->command + "' exited with status " + std::to_string(code);
+	}
+
+	std::shared_ptr<FutureValue::State> state = operation->state;
+	Value output = ErrorMsg == "" ? Value(new StrValue(operation->output)) : Value();
+	Remove(fd);
+	state->Complete(output, ErrorMsg);
+}
+
+void EventLoop::Poll() {
+	static const int MaxEvents = 64;
+	epoll_event events[MaxEvents];
+
+	int count = epoll_wait(this->epoll, events, MaxEvents, -1);
+	for (int i = 0; i < count; i++) {
+		int fd = events[i].data.fd;
+		if (fd == this->wakeup->fd) {
+			this->wakeup->Drain();  // a future completed elsewhere. Its waiters are found by whoever polled
+			continue;
+		}
+
+		auto o = this->operations.find(fd);
+		if (o == this->operations.end()) continue;
+		Operation* operation = o->second;
+
+		if (operation->kind == Operation::TIMER) {
+			std::shared_ptr<FutureValue::State> state = operation->state;
+			Remove(fd);
+			state->Complete(Value(), "");
+		}
+		else ReadOutput(fd, operation);
+	}
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include <sys/types.h>
+
+#include "Value.h"
+
+
+struct Wakeup {
+	// An eventfd that wakes a loop blocked in epoll_wait. Held by the futures the loop waits on, so a future
+	// completed on another thread after its loop is gone still has somewhere to write
+	int fd;
+
+	Wakeup();
+	~Wakeup();
+
+	void Signal();
+	void Drain();
+};
+
+
+class EventLoop
+{
+	// Non-blocking I/O for the async runnables of one interpreter, run on the interpreter's own thread.
+	// Timers are timerfds and the output of commands is read from pipes, all watched by a single epoll
+	// instance, so any number of them can be in flight at once. Regular files can't be watched by epoll,
+	// so their operations stay on the I/O pool, and the futures they complete wake the loop through an eventfd
+private:
+	struct Operation {
+		enum Kind { TIMER, COMMAND } kind;
+		std::shared_ptr<FutureValue::State> state;
+
+		std::string command;
+		std::string output;	// read so far
+		pid_t pid;
+	};
+
+	int epoll;
+	std::shared_ptr<Wakeup> wakeup;
+	std::unordered_map<int, Operation*> operations;	// by the watched fd
+
+	void Add(int fd, Operation* operation);
+	void Remove(int fd);
+
+	void ReadOutput(int fd, Operation* operation);
+
+public:
+	EventLoop();
+	~EventLoop();
+
+	bool Idle();	// no timers or commands left, so nothing but another thread can complete a future
+	bool Watch(FutureValue* future);	// wake the loop once future is done. Returns true if it already is
+
+	bool Sleep(double ms, std::shared_ptr<FutureValue::State> state, std::string& ErrorMsg);
+	bool Exec(const std::string& command, std::shared_ptr<FutureValue::State> state, std::string& ErrorMsg);
+
+	void Poll();	// waits for at least one event, and completes the futures of what finished
+};
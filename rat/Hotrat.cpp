@@ -0,0 +1,77 @@
+#include "Hotrat.h"
+
+#include "scanner.h"
+#include "Compiler.h"
+#include "Interpreter.h"
+
+
+Program::Program(const std::string& src) {
+	this->compiler = nullptr;
+	this->script = nullptr;
+
+	Scanner* scanner = new Scanner(src);
+	std::vector<Token> tokens = scanner->ScanTokens();
+	delete scanner;
+
+	if (tokens.empty()) {
+		CompileCode = 1;  // scanner error
+		return;
+	}
+
+	this->compiler = new Compiler(tokens);
+	this->script = compiler->Compile();
+
+	CompileCode = (script == nullptr) ? 100 : 0;  // compilation error
+}
+
+Program::~Program() {
+	delete this->script;
+	delete this->compiler;
+}
+
+int Program::GetCompileCode() {
+	return this->CompileCode;
+}
+
+RunnableValue* Program::GetScript() {
+	return this->script;
+}
+
+Compiler* Program::GetCompiler() {
+	return this->compiler;
+}
+
+
+
+Context::Context(Program* program) {
+	this->interpreter = new Interpreter(program->GetScript(), program->GetCompiler());
+	this->interpreter->DefineRunnables();
+}
+
+Context::~Context() {
+	delete this->interpreter;
+}
+
+int Context::Run() {
+	return interpreter->interpret();
+}
+
+int Context::Call(const std::string& runnable, std::vector<Value>& args) {
+	return interpreter->CallRunnable(runnable, args);
+}
+
+Value Context::GetReturnValue() {
+	return interpreter->GetReturnValue();
+}
+
+Value Context::NewString(const std::string& s) {
+	return interpreter->NewString(s);
+}
+
+void Context::SetGlobal(const std::string& name, Value value) {
+	interpreter->SetGlobal(name, value);
+}
+
+bool Context::GetGlobal(const std::string& name, Value& value) {
+	return interpreter->GetGlobal(name, value);
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "Value.h"
+
+class Compiler;
+class Interpreter;
+
+
+class HOTRAT_API Program {
+	// A compiled Hotrat script. Compiled once, then shared by any number of Contexts.
+	// Runnable bodies are still compiled on their first call, by whichever Context calls them first
+private:
+	Compiler* compiler;
+	RunnableValue* script;
+
+	int CompileCode;
+
+public:
+	Program(const std::string& src);
+	~Program();
+
+	int GetCompileCode();  // 0 if the program compiled, otherwise the scanner/compiler exit code
+	RunnableValue* GetScript();
+	Compiler* GetCompiler();
+};
+
+
+class HOTRAT_API Context {
+	// A VM instance running a Program. All runnables of the program are defined when the context is created,
+	// so they can be called without running the script's top level first.
+	//
+	// Strings made by NewString belong to the context once they are passed to Call or SetGlobal
+private:
+	Interpreter* interpreter;
+
+public:
+	Context(Program* program);
+	~Context();
+
+	int Run();	// run the script's top level
+	int Call(const std::string& runnable, std::vector<Value>& args);
+	Value GetReturnValue();  // return value of the last successful Call, valid until the next one
+
+	Value NewString(const std::string& s);
+	void SetGlobal(const std::string& name, Value value);
+	bool GetGlobal(const std::string& name, Value& value);
+};
@@ -0,0 +1,52 @@
+#include "IOPool.h"
+
+#include <algorithm>
+
+IOPool::IOPool(int threads) {
+	this->stopping = false;
+
+	for (int i = 0; i < threads; i++) {
+		workers.emplace_back(&IOPool::WorkerLoop, this);
+	}
+}
+
+IOPool::~IOPool() {
+	// Let the workers finish what's queued, then join them
+	{
+		std::lock_guard<std::mutex> guard(this->lock);
+		this->stopping = true;
+	}
+	available.notify_all();
+
+	for (int i = 0; i < workers.size(); i++) workers[i].join();
+}
+
+IOPool* IOPool::Get() {
+	// I/O bound jobs mostly wait, so there are more workers than cores on small machines
+	static IOPool pool(std::max(4, (int)std::thread::hardware_concurrency()));
+	return &pool;
+}
+
+void IOPool::Submit(std::function<void()> job) {
+	{
+		std::lock_guard<std::mutex> guard(this->lock);
+		jobs.push(std::move(job));
+	}
+	available.notify_one();
+}
+
+void IOPool::WorkerLoop() {
+	while (true) {
+		std::function<void()> job;
+		{
+			std::unique_lock<std::mutex> guard(this->lock);
+			available.wait(guard, [this] { return this->stopping || !this->jobs.empty(); });
+
+			if (this->jobs.empty()) return;  // stopping, and nothing left to do
+
+			job = std::move(jobs.front());
+			jobs.pop();
+		}
+		job();
+	}
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <queue>
+#include <vector>
+#include <functional>
+
+class IOPool
+{
+	// Worker threads for blocking file operations, so that the interpreter can keep running
+	// while they wait on the OS. Shared by every interpreter in the process
+private:
+	std::vector<std::thread> workers;
+	std::queue<std::function<void()>> jobs;
+
+	std::mutex lock;
+	std::condition_variable available;
+	bool stopping;
+
+	IOPool(int threads);
+	void WorkerLoop();
+
+public:
+	~IOPool();
+
+	static IOPool* Get();  // started on first use
+	void Submit(std::function<void()> job);
+};
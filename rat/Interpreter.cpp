@@ -1,17 +1,32 @@
 #include "Interpreter.h"
-
-#include <Windows.h>
-
-Value NewValue(float f) {
+#include "Compiler.h"
+#include "IOPool.h"
+#include "VectorOps.h"
+#include "Sort.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+
+Value NewValue(double f) {
 	return Value(f);
 }
 
+Value NewValue(int64_t i) {
+	return Value(i);
+}
+
 
 Value NewValue(bool b) {
 	return Value(b);
 }
 
-Value Interpreter::NewObject(std::string& s) {
+Value Interpreter::NewObject(const std::string& s) {
 	StrValue* res = new StrValue(s);
 	Value v = this->NewObject(res);
 
@@ -26,6 +41,11 @@ Value Interpreter::NewObject(ObjectValue* o) {
 
 	obj->SetNext(this->objects);
 	this->objects = obj;
+
+	// Made during a cycle, the cycle keeps it. Otherwise the next cycle's mark differs anyway
+	obj->SetMark(this->collector.cycle);
+	this->collector.count++;
+	this->collector.allocations++;
 	return v;
 }
 
@@ -36,7 +56,7 @@ Value NewValue() {
 }
 
 
-float GetNumValue(Value& v) {
+double GetNumValue(Value& v) {
 	return v.GetNum();
 }
 
@@ -53,10 +73,35 @@ bool ValueIsNone(Value& v) {
 }
 
 bool IsIntegerValue(Value& f) {
+	// An integer, or a double with nothing after the point
+	if (f.GetType() == Value::INT_T) return true;
 	if (f.GetType() != Value::NUM_T) return false;
-	float n = GetNumValue(f);
-	if (n == (int)n) return true;
-	return false;
+	double n = GetNumValue(f);
+	return n >= -9.2e18 && n <= 9.2e18 && n == (double)(int64_t)n;
+}
+
+int64_t GetIntValue(Value& v) {
+	// Only for values that passed IsIntegerValue
+	if (v.GetType() == Value::INT_T) return v.GetInt();
+	return (int64_t)v.GetNum();
+}
+
+Value Divide(Value& a, Value& b) {
+	// Two integers that divide exactly give an integer, anything else a double
+	if (a.GetType() == Value::INT_T && b.GetType() == Value::INT_T) {
+		int64_t n1 = a.GetInt(), n2 = b.GetInt();
+		if (n2 != 0 && !(n2 == -1 && n1 == INT64_MIN) && n1 % n2 == 0) return Value(n1 / n2);
+	}
+	return Value(a.GetNum() / b.GetNum());
+}
+
+int64_t ShiftLeft(int64_t n, int64_t count) {
+	// Only the low 6 bits of the count are used, as on the processor
+	return (int64_t)((uint64_t)n << (count & 63));
+}
+
+int64_t ShiftRight(int64_t n, int64_t count) {
+	return n >> (count & 63);
 }
 
 
@@ -68,12 +113,70 @@ void Interpreter::NativeInput() {
 	Value PreInput = peek(0);
 	StrValue * s = ExtractStrValue(&PreInput, "Argument to 'input' must be a string");
 	
-	std::cout << s->GetValue();
-	std::string str;
-	std::getline(std::cin, str);
+	this->out->Write(s->GetView());
+	FlushOutput();  // the prompt, and anything printed before it, must show before waiting for input
+
+	StrValue* line = new StrValue("");
+	bool eof;
+	if (!this->in->ReadLine(line->GetValue(), eof)) {
+		delete line;
+		error(INTERNAL_ERROR, "Error reading from " + this->in->ToString());
+	}
 
 	pop();  // remove reference to 'PreInput'
-	Value t = NewObject(str);
+	Value t = NewObject(line);
+	push(t);
+}
+
+void Interpreter::NativeReadAllInput() {
+	// Code for native runnable that reads the rest of stdin into one string, for scripts used as filters
+
+	FlushOutput();
+
+	StrValue* contents = new StrValue("");
+	if (!this->in->ReadRest(contents->GetValue())) {
+		delete contents;
+		error(INTERNAL_ERROR, "Error reading from " + this->in->ToString());
+	}
+
+	Value t = NewObject(contents);
+	push(t);
+}
+
+void Interpreter::NativeReadInputChunk() {
+	// Code for native runnable that reads the next block of stdin, up to the given size.
+	// Returns none at the end of the input
+
+	Value SizeValue = peek(0);
+	if (!IsIntegerValue(SizeValue) || GetIntValue(SizeValue) <= 0) {
+		error(TYPE_ERROR, "Argument to 'ReadInputChunk' must be a positive whole number");
+	}
+
+	FlushOutput();
+
+	StrValue* chunk = new StrValue("");
+	if (!this->in->ReadChunk(chunk->GetValue(), (size_t)GetIntValue(SizeValue))) {
+		delete chunk;
+		error(INTERNAL_ERROR, "Error reading from " + this->in->ToString());
+	}
+
+	pop();  // remove SizeValue
+
+	if (chunk->GetValue().empty()) {
+		delete chunk;
+		Value t = NewValue();
+		push(t);  // none
+		return;
+	}
+
+	Value t = NewObject(chunk);
+	push(t);
+}
+
+void Interpreter::NativeInputLines() {
+	// Code for native runnable that returns stdin's handle, to iterate over its lines in a 'for' loop
+
+	Value t = Value(this->in);
 	push(t);
 }
 
@@ -81,45 +184,137 @@ void Interpreter::NativePrint() {
 	// Code for native runnable, to print a value to the screen.
 
 	Value v = peek(0);
-	std::cout << v.ToString() + "\n";
+	if (v.IsObject() && v.GetObjectValue()->IsString()) {
+		this->out->WriteLine(((StrValue*)v.GetObjectValue())->GetView());  // don't copy large strings
+	}
+	else this->out->WriteLine(v.ToString());
+
+	if (this->LineBuffered) FlushOutput();
 	pop();  // remove reference to v
 
 	Value t = NewValue();
 	push(t);  // none
 }
 
-void Interpreter::NativeReadFromFile() {
-	// Code for native runnable that reads an entire file and returns a strvalue
+void Interpreter::NativeFlushOutput() {
+	// Code for native runnable that writes out everything printed so far
 
-	Value v = peek(0);  // Keep value in stack so it still has at least one reference
+	FlushOutput();
 
-	std::string FileName = ExtractStrValue(&v, "Argument to 'ReadFromFile' must be a valid path string")->ToString();
-	LPCSTR filename = FileName.c_str();
+	Value t = NewValue();
+	push(t);  // none
+}
 
-	HANDLE handle = CreateFileA(filename, GENERIC_READ, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
-	if (handle == INVALID_HANDLE_VALUE) error(INTERNAL_ERROR, "There was an error opening the file '" + FileName + 
-		"'.\n\tAre you sure the path is correct ? ");
-	
-	DWORD NumToReadH;
-	DWORD NumToReadL = GetFileSize(handle, &NumToReadH);
-	
-	const int toread = ((NumToReadH << 8) | (NumToReadL));
-	char* buff = new char[toread + 1];
+void Interpreter::FlushOutput() {
+	this->out->Flush();
+}
+
+// File operations shared by the blocking natives and their async variants, which run them on the I/O pool.
+// They don't touch the interpreter, and report failures through ErrorMsg
+
+static StrValue* ReadWholeFile(const std::string& FileName, std::string& ErrorMsg) {
+	int fd = open(FileName.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd == -1) {
+		ErrorMsg = "There was an error opening the file '" + FileName + "'.\n\tAre you sure the path is correct ? ";
+		return nullptr;
+	}
+
+	struct stat info;
+	if (fstat(fd, &info) == -1) {
+		close(fd);
+		ErrorMsg = "Error reading the file '" + FileName + "'";
+		return nullptr;
+	}
+
+	StrValue* contents = nullptr;
+	if (S_ISREG(info.st_mode) && info.st_size > 0) {
+		// Regular files are mapped and viewed in place, so reading them costs page faults rather than copies.
+		// The mapping lives as long as the string object
+		void* mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (mapping != MAP_FAILED) {
+			madvise(mapping, info.st_size, MADV_SEQUENTIAL);
+			contents = new StrValue((const char*)mapping, info.st_size);
+		}
+	}
+
+	if (contents == nullptr) {
+		// Pipes, devices and empty files can't be mapped, so read them in blocks straight into the string
+		contents = new StrValue("");
+		std::string& buff = contents->GetValue();
+
+		size_t used = 0;
+		buff.resize(65536);
+		while (true) {
+			if (used == buff.size()) buff.resize(buff.size() * 2);
+
+			ssize_t n = read(fd, &buff[used], buff.size() - used);
+			if (n > 0) used += n;
+			else if (n == 0) break;
+			else if (errno != EINTR) {
+				delete contents;
+				close(fd);
+				ErrorMsg = "Error reading the file '" + FileName + "'";
+				return nullptr;
+			}
+		}
+		buff.resize(used);
+	}
+
+	close(fd);
+	return contents;
+}
 
-	bool success = ReadFile(handle, buff, toread, NULL, NULL);
-	if (success == FALSE) error(INTERNAL_ERROR, "Error reading the file '" + FileName + "'");
-	buff[toread] = 0;
+static bool AppendToFile(const std::string& filename, std::string_view buff, std::string& ErrorMsg) {
+	int fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	if (fd == -1) {
+		if (errno == EACCES || errno == EROFS) ErrorMsg = "The file '" + filename +
+			"' cannot be written to.\n\tAre you sure the path is correct ? ";
+		else ErrorMsg = "There was an error opening the file '" + filename +
+			"'.\n\tAre you sure the path is correct ? ";
+		return false;
+	}
+
+	size_t written = 0;
+	while (written < buff.size()) {
+		ssize_t n = write(fd, buff.data() + written, buff.size() - written);
+		if (n >= 0) written += n;
+		else if (errno != EINTR) {
+			close(fd);
+			ErrorMsg = "Error writing to file '" + filename + "'";
+			return false;
+		}
+	}
+
+	close(fd);
+	return true;
+}
+
+static bool TruncateFile(const std::string& filename, std::string& ErrorMsg) {
+	if (truncate(filename.c_str(), 0) == -1) {
+		if (errno == EACCES || errno == EROFS) ErrorMsg = "The file '" + filename +
+			"' cannot be emptied.\n\tAre you sure the path is correct ? ";
+		else ErrorMsg = "There was an error emptying the file '" + filename +
+			"'.\n\tAre you sure the path is correct ? ";
+		return false;
+	}
+	return true;
+}
+
+
+void Interpreter::NativeReadFromFile() {
+	// Code for native runnable that reads an entire file and returns a strvalue
 
-	std::string strbuf = std::string(buff);
+	Value v = peek(0);  // Keep value in stack so it still has at least one reference
 
-	delete[] buff;
-	buff = nullptr;
+	std::string FileName = ExtractStrValue(&v, "Argument to 'ReadFromFile' must be a valid path string")->GetValue();
 
-	CloseHandle(handle);
+	std::string ErrorMsg;
+	StrValue* contents = ReadWholeFile(FileName, ErrorMsg);
+	if (contents == nullptr) error(INTERNAL_ERROR, ErrorMsg);
 	
 	pop();	// remove reference to filename string
 
-	Value t = NewObject(strbuf);
+	Value t = NewObject(contents);
 	push(t);
 }
 
@@ -129,78 +324,312 @@ void Interpreter::NativeWriteToFile() {
 	Value BuffValue = peek(0);  // Keep value in stack so it still has at least one reference
 	std::string errormsg = "Arguments to 'WriteToFile' must be strings";
 
-	std::string buff = ExtractStrValue(&BuffValue, errormsg)->ToString();  // Value to insert
+	std::string_view buff = ExtractStrValue(&BuffValue, errormsg)->GetView();  // Value to insert
+
+	Value FileValue = peek(1);
+	std::string filename = ExtractStrValue(&FileValue, errormsg)->GetValue(); // File to insert to
+
+	std::string ErrorMsg;
+	if (!AppendToFile(filename, buff, ErrorMsg)) error(INTERNAL_ERROR, ErrorMsg);
+
+	pop(); // remove reference to BuffValue
+	pop(); // remove reference to FileValue
+
+	Value t = NewValue();
+	push(t);  // none
+}
+
+void Interpreter::NativeEmptyFile() {
+	// Code for native runnable that clears the contents of a file
+
+	Value FileValue = peek(0);  // Keep value in stack so it still has at least one reference
+
+	StrValue * filestr = ExtractStrValue(&FileValue, "EmptyFile's argument must be a string value");
+	std::string filename = filestr->GetValue();
+
+	std::string ErrorMsg;
+	if (!TruncateFile(filename, ErrorMsg)) error(INTERNAL_ERROR, ErrorMsg);
+
+	pop(); // remove reference to FileValue
+
+	Value v = NewValue();
+	push(v); // none
+}
+
+void Interpreter::NativeReadFromFileAsync() {
+	// Code for native runnable that starts reading a file on the I/O pool.
+	// Returns a future, 'await' gives the file's contents
+
+	Value v = peek(0);  // Keep value in stack so it still has at least one reference
+
+	std::string FileName = ExtractStrValue(&v, "Argument to 'ReadFromFileAsync' must be a valid path string")->GetValue();
+
+	FutureValue* future = new FutureValue("ReadFromFile " + FileName);
+	std::shared_ptr<FutureValue::State> state = future->GetState();
+
+	IOPool::Get()->Submit([state, FileName] {
+		std::string ErrorMsg;
+		StrValue* contents = ReadWholeFile(FileName, ErrorMsg);
+		state->Complete(contents == nullptr ? Value() : Value(contents), ErrorMsg);
+	});
+
+	pop();	// remove reference to filename string
+
+	Value t = NewObject(future);
+	push(t);
+}
+
+void Interpreter::NativeWriteToFileAsync() {
+	// Code for native runnable that appends text to a file on the I/O pool. Returns a future, 'await' gives none
+
+	Value BuffValue = peek(0);  // Keep value in stack so it still has at least one reference
+	std::string errormsg = "Arguments to 'WriteToFileAsync' must be strings";
+
+	// Copied, since the string object can't be shared with another thread
+	std::string buff = std::string(ExtractStrValue(&BuffValue, errormsg)->GetView());
 
 	Value FileValue = peek(1);
-	std::string filename = ExtractStrValue(&FileValue, errormsg)->ToString(); // File to insert to
-	LPCSTR CFileName = filename.c_str();
+	std::string filename = ExtractStrValue(&FileValue, errormsg)->GetValue();
+
+	FutureValue* future = new FutureValue("WriteToFile " + filename);
+	std::shared_ptr<FutureValue::State> state = future->GetState();
+
+	IOPool::Get()->Submit([state, filename, buff = std::move(buff)] {
+		std::string ErrorMsg;
+		AppendToFile(filename, buff, ErrorMsg);
+		state->Complete(Value(), ErrorMsg);
+	});
+
+	pop(); // remove reference to BuffValue
+	pop(); // remove reference to FileValue
+
+	Value t = NewObject(future);
+	push(t);
+}
+
+void Interpreter::NativeEmptyFileAsync() {
+	// Code for native runnable that clears a file on the I/O pool. Returns a future, 'await' gives none
+
+	Value FileValue = peek(0);  // Keep value in stack so it still has at least one reference
+
+	std::string filename = ExtractStrValue(&FileValue, "EmptyFileAsync's argument must be a string value")->GetValue();
+
+	FutureValue* future = new FutureValue("EmptyFile " + filename);
+	std::shared_ptr<FutureValue::State> state = future->GetState();
+
+	IOPool::Get()->Submit([state, filename] {
+		std::string ErrorMsg;
+		TruncateFile(filename, ErrorMsg);
+		state->Complete(Value(), ErrorMsg);
+	});
+
+	pop(); // remove reference to FileValue
+
+	Value t = NewObject(future);
+	push(t);
+}
+
+void Interpreter::NativeSleepAsync() {
+	// Code for native runnable that starts a timer on the event loop.
+	// Returns a future, 'await' gives none once the given number of milliseconds have passed
+
+	Value v = peek(0);  // Keep value in stack so it still has at least one reference
+	if (!v.IsNumber()) error(TYPE_ERROR, "Argument to 'SleepAsync' must be a number of milliseconds");
+
+	FutureValue* future = new FutureValue("Sleep " + v.ToString());
+	Value t = NewObject(future);
+
+	std::string ErrorMsg;
+	if (!GetLoop()->Sleep(v.GetNum(), future->GetState(), ErrorMsg)) {
+		RemoveObject(future);
+		error(INTERNAL_ERROR, ErrorMsg);
+	}
+
+	pop(); // remove reference to v
+	push(t);
+}
+
+void Interpreter::NativeExecAsync() {
+	// Code for native runnable that starts a shell command, whose output is read by the event loop.
+	// Returns a future, 'await' gives everything the command wrote to its standard output
+
+	Value v = peek(0);  // Keep value in stack so it still has at least one reference
+	std::string command = ExtractStrValue(&v, "Argument to 'ExecAsync' must be a command string")->GetValue();
+
+	FlushOutput();  // what was printed before comes before anything the command prints itself
+
+	FutureValue* future = new FutureValue("Exec " + command);
+	Value t = NewObject(future);
+
+	std::string ErrorMsg;
+	if (!GetLoop()->Exec(command, future->GetState(), ErrorMsg)) {
+		RemoveObject(future);
+		error(INTERNAL_ERROR, ErrorMsg);
+	}
+
+	pop(); // remove reference to v
+	push(t);
+}
+
+void Interpreter::NativeCollectorStats() {
+	// Code for native runnable that returns a map of the cycle collector's work so far: the cycles it finished,
+	// the objects they freed, the objects alive now, and the pauses of its steps, in milliseconds
+
+	std::vector<double> pauses = this->collector.pauses;
+	std::sort(pauses.begin(), pauses.end());
 
-	DWORD attribute = GetFileAttributesA(CFileName);
-	if (attribute != INVALID_FILE_ATTRIBUTES) {
-		bool ReadOnly = attribute & FILE_ATTRIBUTE_READONLY;
-		if (ReadOnly) error(INTERNAL_ERROR, "The file '" + filename +
-			"' cannot be written to.\n\tAre you sure the path is correct ? ");
+	double total = 0;
+	for (size_t i = 0; i < pauses.size(); i++) total += pauses[i];
+
+	// Nearest rank: the smallest pause that at least 99% of the pauses don't exceed
+	size_t rank = (size_t)std::ceil(pauses.size() * 0.99);
+	double p99 = pauses.empty() ? 0 : pauses[std::max(rank, (size_t)1) - 1];
+
+	MapValue* map = new MapValue();
+	Value t = NewObject(map);
+	push(t);
+
+	std::pair<std::string, Value> stats[] = {
+		{ "cycles",		NewValue((int64_t)this->collector.cycles) },
+		{ "collected",	NewValue((int64_t)this->collector.collected) },
+		{ "heap",		NewValue((int64_t)this->collector.count) },
+		{ "pauses",		NewValue((int64_t)pauses.size()) },
+		{ "total",		NewValue(total) },
+		{ "max",		NewValue(pauses.empty() ? 0.0 : pauses.back()) },
+		{ "p99",		NewValue(p99) },
+	};
+
+	for (auto& stat : stats) {
+		Value key = NewObject(stat.first);
+		MapStore(map, key, stat.second);
 	}
+}
+
+void Interpreter::NativeOpen() {
+	// Code for native runnable that opens a file handle, for reading ('r'), writing ('w') or appending ('a')
+
+	Value ModeValue = peek(0);  // Keep values in stack so they still have at least one reference
+	Value PathValue = peek(1);
+
+	std::string errormsg = "Arguments to 'Open' must be strings";
+	std::string mode = ExtractStrValue(&ModeValue, errormsg)->GetValue();
+	std::string filename = ExtractStrValue(&PathValue, errormsg)->GetValue();
 
-	HANDLE handle = CreateFileA(CFileName, GENERIC_WRITE, 0, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
-	if (handle == INVALID_HANDLE_VALUE) {
+	if (mode != "r" && mode != "w" && mode != "a") error(TYPE_ERROR, "File mode must be 'r', 'w' or 'a'");
+
+	FileValue* file = new FileValue(filename, mode);
+	if (!file->IsOpen()) {
+		delete file;
 		error(INTERNAL_ERROR, "There was an error opening the file '" + filename +
 			"'.\n\tAre you sure the path is correct ? ");
 	}
 
-	SetFilePointer(handle, 0, NULL, FILE_END);
+	pop(); // remove reference to ModeValue
+	pop(); // remove reference to PathValue
 
-	bool success = WriteFile(handle, buff.c_str(), buff.size(), NULL, NULL);
-	if (!success) {
-		error(INTERNAL_ERROR, "Error writing to file '" + filename + "'");
-	}
+	Value t = NewObject(file);
+	push(t);
+}
 
-	CloseHandle(handle);
+void Interpreter::NativeWrite() {
+	// Code for native runnable that writes a string to an open file handle, through its buffer
+
+	Value BuffValue = peek(0);  // Keep values in stack so they still have at least one reference
+	Value HandleValue = peek(1);
+
+	FileValue* file = ExtractFileValue(&HandleValue, "First argument to 'Write' must be an open file");
+	std::string_view buff = ExtractStrValue(&BuffValue, "Second argument to 'Write' must be a string")->GetView();
+
+	if (!file->IsWritable()) error(TYPE_ERROR, file->ToString() + " wasn't opened for writing");
+	if (!file->Write(buff)) error(INTERNAL_ERROR, "Error writing to " + file->ToString());
 
 	pop(); // remove reference to BuffValue
-	pop(); // remove reference to FileValue
+	pop(); // remove reference to HandleValue
 
 	Value t = NewValue();
 	push(t);  // none
 }
 
-void Interpreter::NativeEmptyFile() {
-	// Code for native runnable that clears the contents of a file
+void Interpreter::NativeReadLine() {
+	// Code for native runnable that reads the next line from an open file handle. Returns none at the end of the file
 
-	Value FileValue = peek(0);  // Keep value in stack so it still has at least one reference
+	Value HandleValue = peek(0);  // Keep value in stack so it still has at least one reference
 
-	StrValue * filestr = ExtractStrValue(&FileValue, "EmptyFile's argument must be a string value");
-	std::string filename = filestr->GetValue();
+	FileValue* file = ExtractFileValue(&HandleValue, "Argument to 'ReadLine' must be an open file");
+	if (file->IsWritable()) error(TYPE_ERROR, file->ToString() + " wasn't opened for reading");
 
-	DWORD attribute = GetFileAttributesA(filename.c_str());
-	if (attribute != INVALID_FILE_ATTRIBUTES) {
-		bool ReadOnly = attribute & FILE_ATTRIBUTE_READONLY;
-		if (ReadOnly) error(INTERNAL_ERROR, "The file '" + filename +
-			"' cannot be emptied.\n\tAre you sure the path is correct ? ");
-	}
+	std::string line;
+	bool eof;
+	if (!file->ReadLine(line, eof)) error(INTERNAL_ERROR, "Error reading from " + file->ToString());
+
+	pop(); // remove reference to HandleValue
+
+	Value t = eof ? NewValue() : NewObject(line);
+	push(t);
+}
 
-	HANDLE handle = CreateFileA(filename.c_str(), GENERIC_WRITE, NULL, NULL, TRUNCATE_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
-	if (handle == 0) error(INTERNAL_ERROR, "There was an error emptying the file '" + filename +
-		"'.\n\tAre you sure the path is correct ? ");
+void Interpreter::NativeFlush() {
+	// Code for native runnable that writes out everything buffered in a file handle
 
-	CloseHandle(handle);
+	Value HandleValue = peek(0);  // Keep value in stack so it still has at least one reference
 
-	pop(); // remove reference to FileValue
+	FileValue* file = ExtractFileValue(&HandleValue, "Argument to 'Flush' must be an open file");
+	if (!file->Flush()) error(INTERNAL_ERROR, "Error writing to " + file->ToString());
 
-	Value v = NewValue();
-	push(v); // none
+	pop(); // remove reference to HandleValue
+
+	Value t = NewValue();
+	push(t);  // none
+}
+
+void Interpreter::NativeClose() {
+	// Code for native runnable that flushes and closes a file handle.
+	// Handles that are never closed are closed when they are deallocated
+
+	Value HandleValue = peek(0);  // Keep value in stack so it still has at least one reference
+
+	FileValue* file = ExtractFileValue(&HandleValue, "Argument to 'Close' must be an open file");
+	if (file->IsConstant()) error(TYPE_ERROR, "Can't close " + file->ToString() + ", every task reads from it");
+	if (!file->Close()) error(INTERNAL_ERROR, "Error closing " + file->ToString());
+
+	pop(); // remove reference to HandleValue
+
+	Value t = NewValue();
+	push(t);  // none
+}
+
+void Interpreter::NativeLines() {
+	// Code for native runnable that returns an iterator over the lines of a file, for use in 'for' loops.
+	// The file is read through the handle's fixed size buffer, so it never has to fit in memory
+
+	Value PathValue = peek(0);  // Keep value in stack so it still has at least one reference
+
+	std::string filename = ExtractStrValue(&PathValue, "Argument to 'lines' must be a valid path string")->GetValue();
+
+	FileValue* file = new FileValue(filename, "r");
+	if (!file->IsOpen()) {
+		delete file;
+		error(INTERNAL_ERROR, "There was an error opening the file '" + filename +
+			"'.\n\tAre you sure the path is correct ? ");
+	}
+
+	pop(); // remove reference to PathValue
+
+	Value t = NewObject(file);
+	push(t);
 }
 
 void Interpreter::NativeConvertToNum() {
 	// Code for a native function that converts a value to a Number
 
 	Value v = peek(0);  // Keep value in stack so it still has at least one reference
-	float num;
+	Value num;
 	switch (v.GetType())
 	{
-		case Value::BOOL_T:  num = (v.GetBool() ? 1 : 0); break;
-		case Value::NUM_T:	 push(v);	return;
-		case Value::NONE_T:	 num = 0;   break;
+		case Value::BOOL_T:  num = NewValue((int64_t)(v.GetBool() ? 1 : 0)); break;
+		case Value::NUM_T:
+		case Value::INT_T:	 return;  // numbers are their own result
+		case Value::NONE_T:	 num = NewValue((int64_t)0);   break;
 
 		default: {
 			StrValue* s = ExtractStrValue(&v, "Value given to 'Number()' must be of valid type");
@@ -208,18 +637,16 @@ void Interpreter::NativeConvertToNum() {
 			try {
 				std::string strrep = s->ToString();
 
+				// Like literals, a string with a decimal point becomes a double and any other an integer
 				try {
-					num = std::stof(strrep);
+					if (strrep.find('.') == std::string::npos) num = NewValue((int64_t)std::stoll(strrep));
+					else num = NewValue(std::stod(strrep));
 				}
-				catch (const std::exception& e) {
+				catch (const std::out_of_range& e) {
 					error(TYPE_ERROR, "String given to '" + globals["Number"].ToString() + "' is too large - can't be represented as a number");
 				}
 
-				std::stringstream s;
-				s << num;
-				std::string numrep = s.str();
-				
-				if (numrep != strrep) error(TYPE_ERROR, "Can't convert string given to '" + globals["Number"].ToString() + "' to a number");
+				if (num.ToString() != strrep) error(TYPE_ERROR, "Can't convert string given to '" + globals["Number"].ToString() + "' to a number");
 			}
 			catch (std::invalid_argument e) {
 				error(TYPE_ERROR, "Argument to " + globals["Number"].ToString() + " must be representable as a number");
@@ -229,9 +656,7 @@ void Interpreter::NativeConvertToNum() {
 	}
 
 	pop(); // remove reference to v
-
-	Value t = NewValue(num);
-	push(t);
+	push(num);
 }
 
 void Interpreter::NativeConvertToBool() {
@@ -249,6 +674,7 @@ void Interpreter::NativeConvertToStr() {
 	// Code for native runnable that converts a value of any type to a string.
 
 	Value v = peek(0);  // Keep value in stack so it still has at least one reference
+	if (v.IsObject() && v.GetObjectValue()->IsString()) return;  // strings are their own result, nothing to copy
 
 	Value t = NewObject(v.ToString());
 	pop(); // remove reference to v
@@ -256,6 +682,72 @@ void Interpreter::NativeConvertToStr() {
 	push(t);
 }
 
+void Interpreter::NativeSubstring() {
+	// Code for native runnable that returns 'length' characters of a string, from index 'start'.
+	// Long slices share the string's bytes instead of copying them
+
+	Value LengthValue = peek(0);
+	Value StartValue = peek(1);
+	Value StrArg = peek(2);  // Keep values in stack so they still have at least one reference
+
+	StrValue* s = ExtractStrValue(&StrArg, "First argument to 'Substring' must be a string");
+	if (!IsIntegerValue(StartValue) || !IsIntegerValue(LengthValue)) {
+		error(TYPE_ERROR, "Start and length given to 'Substring' must be whole numbers");
+	}
+
+	int64_t start = GetIntValue(StartValue);
+	int64_t length = GetIntValue(LengthValue);
+	size_t size = s->GetView().size();
+	if (start < 0 || length < 0 || (size_t)start + (size_t)length > size) {
+		error(INDEX_ERROR, "Substring from " + StartValue.ToString() + " of length " + LengthValue.ToString() +
+			" is out of range for a string of length " + std::to_string(size));
+	}
+
+	Value t = NewObject(new StrValue(*s, (size_t)start, (size_t)length));
+
+	pop(); // remove reference to LengthValue
+	pop(); // remove reference to StartValue
+	pop(); // remove reference to StrArg
+	push(t);
+}
+
+void Interpreter::NativeSplit() {
+	// Code for native runnable that splits a string around a separator, and returns a list of the pieces.
+	// The pieces are slices of the string
+
+	Value SepArg = peek(0);
+	Value StrArg = peek(1);  // Keep values in stack so they still have at least one reference
+
+	std::string msg = "Arguments to 'Split' must be strings";
+	StrValue* s = ExtractStrValue(&StrArg, msg);
+	std::string separator = ExtractStrValue(&SepArg, msg)->GetValue();
+	if (separator.empty()) error(TYPE_ERROR, "Separator given to 'Split' can't be empty");
+
+	ListValue* list = new ListValue();
+	Value t = NewObject(list);
+	push(t);  // so the list is freed along with the stack on an error
+
+	size_t start = 0;
+	while (true) {
+		size_t end = s->GetView().find(separator, start);
+		if (end == std::string_view::npos) end = s->GetView().size();
+
+		Value piece = NewObject(new StrValue(*s, start, end - start));
+		piece.GetObjectValue()->AddReference();  // held by the list
+		list->Push(piece);
+
+		if (end == s->GetView().size()) break;
+		start = end + separator.size();
+	}
+
+	list->AddReference();  // keep the list while the arguments below it are popped
+	pop();
+	pop(); // remove reference to SepArg
+	pop(); // remove reference to StrArg
+	push(t);
+	list->DeleteReference();
+}
+
 
 void Interpreter::NativeTypeOf() {
 	// Code for native runnable that prints the datatype of a value.
@@ -266,6 +758,7 @@ void Interpreter::NativeTypeOf() {
 	switch (v.GetType()) {
 		case Value::NONE_T:	s = "NONE";		break;
 		case Value::NUM_T:	s = "NUMBER";	break;
+		case Value::INT_T:	s = "INTEGER";	break;
 		case Value::BOOL_T: s = "BOOL";		break;
 
 		case Value::OBJECT_T: {
@@ -275,6 +768,15 @@ void Interpreter::NativeTypeOf() {
 				case ObjectValue::STRING_T:		s = "STRING";	break;
 				case ObjectValue::RUNNABLE_T:	s = "RUNNABLE";	break;
 				case ObjectValue::NATIVE_T:		s = "NATIVE";	break;
+				case ObjectValue::FILE_T:		s = "FILE";		break;
+				case ObjectValue::FUTURE_T:		s = "FUTURE";	break;
+				case ObjectValue::LIST_T:		s = "LIST";		break;
+				case ObjectValue::MAP_T:		s = "MAP";		break;
+				case ObjectValue::ITERATOR_T:	s = "ITERATOR";	break;
+				case ObjectValue::CLASS_T:		s = "RAT";		break;
+				case ObjectValue::INSTANCE_T:	s = ((InstanceValue*)o)->GetClass()->GetName();	break;
+				case ObjectValue::CHANNEL_T:	s = "CHANNEL";	break;
+				case ObjectValue::GENERATOR_T:	s = "GENERATOR";	break;
 			}
 		}
 	}
@@ -286,34 +788,632 @@ void Interpreter::NativeTypeOf() {
 }
 
 
-void Interpreter::DefineNative(const std::string& name, uint8_t arity, NativeRunnable run) {
-	AddGlobal(name, NewObject(new NativeValue(name, arity, run)));
-}
+void Interpreter::NativeLen() {
+	// Code for native runnable that returns the number of elements in a list or a map, or of characters in a string
 
+	Value v = peek(0);  // Keep value in stack so it still has at least one reference
 
-Interpreter::Interpreter(RunnableValue* body) {
-	this->body = body;
-	this->objects = nullptr;
-	stack.count = 0;
+	int64_t size;
+	if (v.IsObject() && v.GetObjectValue()->IsList()) size = ((ListValue*)v.GetObjectValue())->Size();
+	else if (v.IsObject() && v.GetObjectValue()->IsMap()) size = ((MapValue*)v.GetObjectValue())->Size();
+	else size = ExtractStrValue(&v, "Argument to 'len' must be a list, a map or a string")->GetView().size();
 
-	globals = std::unordered_map<std::string, Value>();
+	pop(); // remove reference to v
 
+	Value t = NewValue(size);
+	push(t);
+}
 
-	// Define native functions
-	DefineNative("input",			1, &Interpreter::NativeInput);
-	DefineNative("print",			1, &Interpreter::NativePrint);
-	
-	DefineNative("ReadFromFile",	1, &Interpreter::NativeReadFromFile);
-	DefineNative("WriteToFile",		2, &Interpreter::NativeWriteToFile);
-	DefineNative("EmptyFile",		1, &Interpreter::NativeEmptyFile);
+void Interpreter::NativePush() {
+	// Code for native runnable that appends a value to the end of a list
 
-	DefineNative("Number",			1, &Interpreter::NativeConvertToNum);
-	DefineNative("Boolean",			1, &Interpreter::NativeConvertToBool);
-	DefineNative("String",			1, &Interpreter::NativeConvertToStr);
-	DefineNative("Type",			1, &Interpreter::NativeTypeOf);
-}
+	Value v = peek(0);
+	Value ListArg = peek(1);  // Keep values in stack so they still have at least one reference
+
+	ListValue* list = ExtractListValue(&ListArg, "First argument to 'push' must be a list");
+
+	if (v.IsObject()) v.GetObjectValue()->AddReference();  // held by the list
+	list->Push(v);
+
+	pop(); // remove reference to v
+	pop(); // remove reference to ListArg
+
+	Value t = NewValue();
+	push(t);  // none
+}
+
+void Interpreter::NativePop() {
+	// Code for native runnable that removes the last element of a list and returns it
+
+	Value ListArg = peek(0);  // Keep value in stack so it still has at least one reference
+
+	ListValue* list = ExtractListValue(&ListArg, "Argument to 'pop' must be a list");
+	if (list->Size() == 0) error(INDEX_ERROR, "Can't pop from an empty list");
+
+	Value v = list->Pop();  // still holds the list's reference
+	if (this->collector.phase == COLLECT_MARK) Shade(v);  // no longer reachable through the list
+
+	pop(); // remove reference to ListArg
+	push(v);
+
+	if (v.IsObject()) v.GetObjectValue()->DeleteReference();  // the stack's reference is enough now
+}
+
+void Interpreter::NativeHas() {
+	// Code for native runnable that checks whether a map has a key
+
+	Value key = peek(0);
+	Value MapArg = peek(1);  // Keep values in stack so they still have at least one reference
+
+	MapValue* map = ExtractMapValue(&MapArg, "First argument to 'has' must be a map");
+	CheckKey(key);
+
+	Value found;
+	Value t = NewValue(map->Get(key, found));
+
+	pop(); // remove reference to key
+	pop(); // remove reference to MapArg
+	push(t);
+}
+
+void Interpreter::NativeGet() {
+	// Code for native runnable that looks up a key in a map, and returns the third argument if it's missing
+
+	Value fallback = peek(0);
+	Value key = peek(1);
+	Value MapArg = peek(2);  // Keep values in stack so they still have at least one reference
+
+	MapValue* map = ExtractMapValue(&MapArg, "First argument to 'get' must be a map");
+	CheckKey(key);
+
+	Value v;
+	if (!map->Get(key, v)) v = fallback;
+	if (v.IsObject()) v.GetObjectValue()->AddReference();  // keep it alive while the arguments are popped
+
+	pop(); // remove reference to fallback
+	pop(); // remove reference to key
+	pop(); // remove reference to MapArg
+	push(v);
+
+	if (v.IsObject()) v.GetObjectValue()->DeleteReference();
+}
+
+void Interpreter::NativeRemove() {
+	// Code for native runnable that removes a key from a map, and returns its value. none if it was missing
+
+	Value key = peek(0);
+	Value MapArg = peek(1);  // Keep values in stack so they still have at least one reference
+
+	MapValue* map = ExtractMapValue(&MapArg, "First argument to 'remove' must be a map");
+	CheckKey(key);
+
+	Value OldKey, OldValue;
+	map->Remove(key, OldKey, OldValue);  // both still hold the map's references
+	Release(OldKey);
+	if (this->collector.phase == COLLECT_MARK) Shade(OldValue);  // no longer reachable through the map
+
+	pop(); // remove reference to key
+	pop(); // remove reference to MapArg
+	push(OldValue);
+
+	if (OldValue.IsObject()) OldValue.GetObjectValue()->DeleteReference();  // the stack's reference is enough now
+}
+
+
+void Interpreter::NativeSum() {
+	// Code for native runnable that adds up a list of numbers
+
+	Value v = peek(0);  // Keep value in stack so it still has at least one reference
+
+	NumericList l;
+	NumericData(v, "sum", l);
+	Value t = l.whole ? NewValue(VectorOps::Sum(l.integers, l.size)) : NewValue(VectorOps::Sum(l.numbers, l.size));
+
+	pop(); // remove reference to v
+	push(t);
+}
+
+void Interpreter::NativeMin() {
+	// Code for native runnable that returns the smallest number in a list
+
+	Value v = peek(0);
+
+	NumericList l;
+	NumericData(v, "min", l);
+	if (l.size == 0) error(INDEX_ERROR, "Can't take the minimum of an empty list");
+
+	Value t = l.whole ? NewValue(VectorOps::Min(l.integers, l.size)) : NewValue(VectorOps::Min(l.numbers, l.size));
+
+	pop();
+	push(t);
+}
+
+void Interpreter::NativeMax() {
+	// Code for native runnable that returns the largest number in a list
+
+	Value v = peek(0);
+
+	NumericList l;
+	NumericData(v, "max", l);
+	if (l.size == 0) error(INDEX_ERROR, "Can't take the maximum of an empty list");
+
+	Value t = l.whole ? NewValue(VectorOps::Max(l.integers, l.size)) : NewValue(VectorOps::Max(l.numbers, l.size));
+
+	pop();
+	push(t);
+}
+
+void Interpreter::NativeDot() {
+	// Code for native runnable that returns the dot product of two lists of numbers
+
+	Value b = peek(0);
+	Value a = peek(1);
+
+	NumericList x, y;
+	NumericData(a, "dot", x);
+	NumericData(b, "dot", y);
+	if (x.size != y.size) error(INDEX_ERROR, "Lists passed to 'dot' must have the same size");
+
+	Value t = (x.whole && y.whole) ? NewValue(VectorOps::Dot(x.integers, y.integers, x.size))
+		: NewValue(VectorOps::Dot(x.Doubles(), y.Doubles(), x.size));
+
+	pop();
+	pop();
+	push(t);
+}
+
+void Interpreter::NativeAdd() {
+	// Code for native runnable that adds two lists of numbers element by element, into a new list
+	VectorBinary("add", &VectorOps::Add, &VectorOps::Add);
+}
+
+void Interpreter::NativeMul() {
+	// Code for native runnable that multiplies two lists of numbers element by element, into a new list
+	VectorBinary("mul", &VectorOps::Mul, &VectorOps::Mul);
+}
+
+void Interpreter::NativeScale() {
+	// Code for native runnable that multiplies every number in a list by a number, into a new list
+
+	Value k = peek(0);
+	Value v = peek(1);
+
+	NumericList l;
+	NumericData(v, "scale", l);
+	if (!k.IsNumber()) error(TYPE_ERROR, "Second argument to 'scale' must be a number");
+
+	Value t;
+	if (l.whole && k.IsInt()) {
+		std::vector<int64_t> result(l.size);
+		VectorOps::Scale(l.integers, k.GetInt(), result.data(), l.size);
+		t = NewObject(new ListValue(result));
+	}
+	else {
+		std::vector<double> result(l.size);
+		VectorOps::Scale(l.Doubles(), k.GetNum(), result.data(), l.size);
+		t = NewObject(new ListValue(result));
+	}
+
+	pop();
+	pop();
+	push(t);
+}
+
+void Interpreter::NativeWhere() {
+	// Code for native runnable that picks each element from the second list where the first one isn't 0,
+	// and from the third list where it is. Returns a new list
+
+	Value b = peek(0);
+	Value a = peek(1);
+	Value mask = peek(2);
+
+	NumericList m, x, y;
+	NumericData(mask, "where", m);
+	NumericData(a, "where", x);
+	NumericData(b, "where", y);
+	if (m.size != x.size || m.size != y.size) error(INDEX_ERROR, "Lists passed to 'where' must have the same size");
+
+	Value t;
+	if (m.whole && x.whole && y.whole) {
+		std::vector<int64_t> result(m.size);
+		VectorOps::Where(m.integers, x.integers, y.integers, result.data(), m.size);
+		t = NewObject(new ListValue(result));
+	}
+	else {
+		std::vector<double> result(m.size);
+		VectorOps::Where(m.Doubles(), x.Doubles(), y.Doubles(), result.data(), m.size);
+		t = NewObject(new ListValue(result));
+	}
+
+	pop();
+	pop();
+	pop();
+	push(t);
+}
+
+
+void Interpreter::NativeSort() {
+	// Code for native runnable that sorts a list of numbers or of strings in place, and returns it.
+	// Given a key runnable, the list is ordered by the key of each element instead, and elements with equal keys keep their order
+
+	Value key = peek(0);
+	Value ListArg = peek(1);  // Keep values in stack so they still have at least one reference
+
+	ListValue* list = ExtractListValue(&ListArg, "First argument to 'sort' must be a list");
+
+	if (key.IsNone()) SortList(list);
+	else SortListByKey(list, key);
+
+	list->AddReference();  // keep the list alive while its argument slot is popped
+	pop();
+	pop();
+	push(ListArg);
+	list->DeleteReference();
+}
+
+
+void Interpreter::NativeChannel() {
+	// Code for native runnable that makes a channel, which holds up to 'capacity' values that were sent and not yet received
+
+	Value v = peek(0);
+	if (!IsIntegerValue(v) || GetIntValue(v) < 1) error(TYPE_ERROR, "A channel's capacity must be a positive integer");
+
+	Value channel = NewObject(new ChannelValue((size_t)GetIntValue(v)));
+
+	pop();
+	push(channel);
+}
+
+void Interpreter::NativeSend() {
+	// Code for native runnable that sends a copy of a value through a channel. Waits while the channel is full
+
+	Value v = peek(0);
+	Value ChannelArg = peek(1);  // Keep values in stack so they still have at least one reference
+
+	ChannelValue* channel = ExtractChannelValue(&ChannelArg, "First argument to 'send' must be a channel");
+
+	FlushOutput();	// what was printed before the send comes before anything the receiver prints after it
+
+	Value message = Detach(v);
+	if (!channel->Send(message, Waiter())) {
+		FreeDetached(message);  // copied again when the task is woken
+		this->suspended = true;
+		return;
+	}
+
+	pop(); // remove reference to v
+	pop(); // remove reference to ChannelArg
+
+	Value t = NewValue();
+	push(t);  // none
+}
+
+void Interpreter::NativeReceive() {
+	// Code for native runnable that takes the oldest value sent through a channel. Waits while the channel is empty
+
+	Value ChannelArg = peek(0);  // Keep value in stack so it still has at least one reference
+
+	ChannelValue* channel = ExtractChannelValue(&ChannelArg, "Argument to 'recv' must be a channel");
+
+	Value message;
+	if (!channel->Receive(message, Waiter())) {
+		this->suspended = true;
+		return;
+	}
+
+	message = Adopt(message);
+
+	pop(); // remove reference to ChannelArg
+	push(message);
+}
+
+
+void Interpreter::NativeParallelMap() {
+	// Code for native runnable that applies a runnable to every element of a list in parallel, and returns a new list
+	// of the results, in order. The runnable must be pure, since every chunk of the list runs in an interpreter of its own
+
+	Value f = peek(0);
+	Value ListArg = peek(1);  // Keep values in stack so they still have at least one reference
+
+	ListValue* list = ExtractListValue(&ListArg, "First argument to 'pmap' must be a list");
+
+	std::vector<Value> results;
+	RunParallel(list, f, false, "pmap", results);
+
+	ListValue* mapped = new ListValue();
+	Value res = NewObject(mapped);
+
+	for (size_t i = 0; i < results.size(); i++) {
+		Value part = Adopt(results[i]);
+		ListValue* chunk = (ListValue*)part.GetObjectValue();
+
+		for (size_t j = 0; j < chunk->Size(); j++) {
+			Value v = chunk->Get(j);
+			if (v.IsObject()) v.GetObjectValue()->AddReference();  // held by the new list
+			mapped->Push(v);
+		}
+		RemoveObject(chunk);
+	}
+
+	pop(); // remove reference to f
+	pop(); // remove reference to ListArg
+	push(res);
+}
+
+void Interpreter::NativeParallelReduce() {
+	// Code for native runnable that folds a list with a runnable of two arguments, in parallel. Every chunk of the list
+	// is folded from its first element, so the runnable must be associative as well as pure. The chunks' results are
+	// then folded here, in order, starting from 'init'
+
+	Value init = peek(0);
+	Value f = peek(1);
+	Value ListArg = peek(2);  // Keep values in stack so they still have at least one reference
+
+	ListValue* list = ExtractListValue(&ListArg, "First argument to 'preduce' must be a list");
+
+	std::vector<Value> results;
+	RunParallel(list, f, true, "preduce", results);
+
+	push(init);  // the accumulator stays on top of the stack
+	bool pure = this->pure;
+	this->pure = true;
+
+	size_t i = 0;
+	try {
+		for (; i < results.size(); i++) {
+			Value args[2] = { peek(0), Adopt(results[i]) };
+			results[i].SetAsNone();
+			CallWithArguments(f, args, 2);
+
+			Value acc = peek(0);
+			if (acc.IsObject()) acc.GetObjectValue()->AddReference();  // keep it alive while the old one is popped
+			pop();
+			pop();
+			push(acc);
+			if (acc.IsObject()) acc.GetObjectValue()->DeleteReference();
+		}
+	}
+	catch (ExitCode e) {
+		for (; i < results.size(); i++) FreeDetached(results[i]);
+		this->pure = pure;
+		throw e;
+	}
+	this->pure = pure;
+
+	Value acc = peek(0);
+	if (acc.IsObject()) acc.GetObjectValue()->AddReference();
+	pop(); // remove the accumulator
+	pop(); // remove reference to init
+	pop(); // remove reference to f
+	pop(); // remove reference to ListArg
+	push(acc);
+	if (acc.IsObject()) acc.GetObjectValue()->DeleteReference();
+}
+
+void Interpreter::NativeResume() {
+	// Code for native runnable that runs a generator up to its next yield, and returns the yielded value.
+	// Returns none once the generator has finished
+
+	Value v = peek(0);  // Keep value in stack so it still has at least one reference
+	if (!v.IsObject() || !v.GetObjectValue()->IsGenerator()) error(TYPE_ERROR, "Argument to 'resume' must be a generator");
+
+	if (!Resume((GeneratorValue*)v.GetObjectValue())) {
+		pop(); // remove reference to v
+		Value t = NewValue();
+		push(t);
+		return;
+	}
+
+	Value res = peek(0);
+	if (res.IsObject()) res.GetObjectValue()->AddReference();
+	pop(); // remove the yielded value
+	pop(); // remove reference to v
+	push(res);
+	if (res.IsObject()) res.GetObjectValue()->DeleteReference();
+}
+
+
+void Interpreter::DefineNative(const std::string& name, uint8_t arity, NativeRunnable run, uint8_t optional) {
+	AddGlobal(name, NewObject(new NativeValue(name, arity, run, optional)));
+}
+
+void Interpreter::CallNative(NativeValue* native, uint8_t arity) {
+	// Run a native whose value and arguments are on top of the stack, and replace them with its result
+
+	uint8_t least = native->GetArity() - native->GetOptional();
+	if (arity < least || arity > native->GetArity()) {
+		std::string accepts = std::to_string(native->GetArity());
+		if (native->GetOptional() > 0) accepts = std::to_string(least) + " to " + accepts;
+
+		error(TYPE_ERROR, native->ToString() + " called with " + std::to_string(arity) + " arguments, but accepts " + accepts);
+	}
+
+	for (int i = arity; i < native->GetArity(); i++) {
+		Value v = NewValue();
+		push(v);  // left out optional arguments
+	}
+
+	NativeRunnable n = native->GetRunnable();
+
+	this->NativeDepth++;
+	try {
+		(this->*n)(); // Call native runnable
+	}
+	catch (ExitCode e) {
+		this->NativeDepth--;
+		throw e;
+	}
+	this->NativeDepth--;
+
+	if (this->suspended) {
+		// The native has to wait, and will be called again with the same arguments
+		for (int i = arity; i < native->GetArity(); i++) pop();
+		return;
+	}
+
+	if (peek(0).IsObject()) peek(0).GetObjectValue()->AddReference();
+	// so it doesn't get deleted when popping before call frame
+
+	Value ReturnValue = pop();
+
+	pop(); // remove runnable from stack
+
+	push(ReturnValue);
+	if (ReturnValue.IsObject()) peek(0).GetObjectValue()->DeleteReference();
+}
+
+void Interpreter::CallWithArguments(Value& callee, Value* args, uint8_t count) {
+	// Call a runnable or a native from inside a native, and run it until it returns.
+	// The result is left on top of the stack
+
+	push(callee);
+	for (int i = 0; i < count; i++) push(args[i]);
+
+	ObjectValue* o = callee.IsObject() ? callee.GetObjectValue() : nullptr;
+	if (o != nullptr && o->IsRunnable()) {
+		RunnableValue* runnable = (RunnableValue*)o;
+		if (runnable->GetArity() != count) {
+			error(TYPE_ERROR, runnable->ToString() + " called with " + std::to_string(count) +
+				" arguments, but accepts " + std::to_string(runnable->GetArity()));
+		}
+
+		// The native's own C++ frame is below this loop, so a task can't be parked until it returns
+		bool suspendable = this->suspendable;
+		this->suspendable = false;
+
+		uint8_t CallerFrames = frames.count;
+		EnterRunnable(runnable);
+		while (frames.count > CallerFrames) {
+			if (this->pure) CheckPure();
+			RunCommand();
+		}
+
+		this->suspendable = suspendable;
+	}
+	else if (o != nullptr && o->IsNative()) {
+		bool suspendable = this->suspendable;
+		this->suspendable = false;
+		CallNative((NativeValue*)o, count);
+		this->suspendable = suspendable;
+	}
+	else {
+		error(TYPE_ERROR, "Can't call " + callee.ToString() + ", it isn't a runnable");
+	}
+}
+
+
+Interpreter::Interpreter(RunnableValue* script, Compiler* compiler, Task* task) {
+	this->compiler = compiler;
+
+	this->task = task;
+	if (task != nullptr) this->group = task->GetSharedGroup();
+	this->suspendable = false;
+	this->suspended = false;
+	this->pure = false;
+	this->loop = nullptr;
+
+	this->collector.phase = COLLECT_IDLE;
+	this->collector.cycle = 0;
+	this->collector.SweepPrev = nullptr;
+	this->collector.count = 0;
+	this->collector.threshold = MinCollectHeap;
+	this->collector.allocations = 0;
+	this->collector.StepAt = CollectPace;
+	this->collector.cycles = 0;
+	this->collector.collected = 0;
+	this->NativeDepth = 0;
+
+	frames.count = 1;
+	frames.frm[0] = { script, 0, 0, nullptr };  // the script's frame stays at the bottom
+	this->objects = nullptr;
+	stack.count = 0;
+
+	this->out = new FileValue(STDOUT_FILENO, "<stdout>", true);
+	this->LineBuffered = isatty(STDOUT_FILENO);
+
+	this->in = FileValue::Stdin();
+
+	globals = std::unordered_map<std::string, Value>();
+
+
+	// Define native functions
+	DefineNative("input",			1, &Interpreter::NativeInput);
+	DefineNative("print",			1, &Interpreter::NativePrint);
+	DefineNative("flush",			0, &Interpreter::NativeFlushOutput);
+
+	DefineNative("ReadAllInput",	0, &Interpreter::NativeReadAllInput);
+	DefineNative("ReadInputChunk",	1, &Interpreter::NativeReadInputChunk);
+	DefineNative("InputLines",		0, &Interpreter::NativeInputLines);
+	
+	DefineNative("ReadFromFile",	1, &Interpreter::NativeReadFromFile);
+	DefineNative("WriteToFile",		2, &Interpreter::NativeWriteToFile);
+	DefineNative("EmptyFile",		1, &Interpreter::NativeEmptyFile);
+
+	DefineNative("ReadFromFileAsync",	1, &Interpreter::NativeReadFromFileAsync);
+	DefineNative("WriteToFileAsync",	2, &Interpreter::NativeWriteToFileAsync);
+	DefineNative("EmptyFileAsync",		1, &Interpreter::NativeEmptyFileAsync);
+
+	DefineNative("Open",			2, &Interpreter::NativeOpen);
+	DefineNative("Write",			2, &Interpreter::NativeWrite);
+	DefineNative("ReadLine",		1, &Interpreter::NativeReadLine);
+	DefineNative("Flush",			1, &Interpreter::NativeFlush);
+	DefineNative("Close",			1, &Interpreter::NativeClose);
+	DefineNative("lines",			1, &Interpreter::NativeLines);
+
+	DefineNative("Number",			1, &Interpreter::NativeConvertToNum);
+	DefineNative("Boolean",			1, &Interpreter::NativeConvertToBool);
+	DefineNative("String",			1, &Interpreter::NativeConvertToStr);
+	DefineNative("Type",			1, &Interpreter::NativeTypeOf);
+
+	DefineNative("Substring",		3, &Interpreter::NativeSubstring);
+	DefineNative("Split",			2, &Interpreter::NativeSplit);
+
+	DefineNative("len",				1, &Interpreter::NativeLen);
+	DefineNative("push",			2, &Interpreter::NativePush);
+	DefineNative("pop",				1, &Interpreter::NativePop);
+
+	DefineNative("has",				2, &Interpreter::NativeHas);
+	DefineNative("get",				3, &Interpreter::NativeGet);
+	DefineNative("remove",			2, &Interpreter::NativeRemove);
+
+	DefineNative("sum",				1, &Interpreter::NativeSum);
+	DefineNative("min",				1, &Interpreter::NativeMin);
+	DefineNative("max",				1, &Interpreter::NativeMax);
+	DefineNative("dot",				2, &Interpreter::NativeDot);
+	DefineNative("add",				2, &Interpreter::NativeAdd);
+	DefineNative("mul",				2, &Interpreter::NativeMul);
+	DefineNative("scale",			2, &Interpreter::NativeScale);
+	DefineNative("where",			3, &Interpreter::NativeWhere);
+
+	DefineNative("sort",			2, &Interpreter::NativeSort, 1);
+
+	DefineNative("Channel",			1, &Interpreter::NativeChannel);
+	DefineNative("send",			2, &Interpreter::NativeSend);
+	DefineNative("recv",			1, &Interpreter::NativeReceive);
+
+	DefineNative("pmap",			2, &Interpreter::NativeParallelMap);
+	DefineNative("preduce",			3, &Interpreter::NativeParallelReduce);
+
+	DefineNative("resume",			1, &Interpreter::NativeResume);
+
+	DefineNative("SleepAsync",		1, &Interpreter::NativeSleepAsync);
+	DefineNative("ExecAsync",		1, &Interpreter::NativeExecAsync);
+
+	DefineNative("CollectorStats",	0, &Interpreter::NativeCollectorStats);
+}
+
+Interpreter::~Interpreter() {
+	// Tasks run code of the script's program, so they have to be done before it can be freed
+	if (this->task == nullptr && this->group != nullptr) {
+		FlushOutput();
+		this->group->Join();
+	}
+
+	delete this->out;  // flushes what's left of the output
+	delete this->loop;
+
+	for (size_t i = 0; i < this->collector.dead.size(); i++) delete this->collector.dead[i];
 
-Interpreter::~Interpreter() {
 	if (objects == nullptr) return;
 	
 	ObjectValue* v = objects;
@@ -327,37 +1427,59 @@ Interpreter::~Interpreter() {
 }
 
 int Interpreter::interpret() {
-	while (!(CurrentChunk()->IsAtEnd())) {
+	frames.count = 1;
+	frames.frm[0].ip = 0;
+
+	while (!IsAtEnd()) {
 		try {
 			RunCommand();
 		}
 		catch (ExitCode e) {
+			// leave the context usable for calls from the host
+			while (this->stack.count > 0) pop();
+			frames.count = 1;
 			return e;
 		}
 	}
 
+	try {
+		RunLoop(nullptr);  // async calls that nothing awaited still run to the end
+	}
+	catch (ExitCode e) {
+		while (this->stack.count > 0) pop();
+		frames.count = 1;
+		return e;
+	}
+
 	return 0;
 }
 
 void Interpreter::RunCommand() {
 	// Run a single command
 
+	// Between commands everything the script holds is on the stack or in globals, which the collector sees.
+	// Inside a native, its C++ frame may hold objects that nothing else reaches
+	if (this->collector.allocations >= this->collector.StepAt && this->NativeDepth == 0) CollectStep();
+
 #ifdef DEBUG_TRACE_STACK
-	int offset = CurrentChunk()->GetOffset();
+	int offset = CurrentFrame().ip;
 #endif // DEBUG_TRACE_STACK
 
 
-// Arithmetic operations + - * / on numbers
+// Arithmetic operations + - * on numbers. Two integers give an integer, wrapping around on overflow,
+// and a double on either side makes the result a double
 #define BINARY_NUM_OP(op)  {\
 	Value b = peek(0); \
 	Value a = peek(1); \
-	if (b.GetType() == Value::NUM_T && a.GetType() == Value::NUM_T){\
+	if (a.GetType() == Value::INT_T && b.GetType() == Value::INT_T) {\
 		pop();\
 		pop();\
-		float n1 = GetNumValue(a); \
-		float n2 = GetNumValue(b); \
-		\
-		Value v = NewValue(n1 op n2);\
+		Value v = NewValue((int64_t)((uint64_t)a.GetInt() op (uint64_t)b.GetInt()));\
+		push(v);\
+	} else if (a.IsNumber() && b.IsNumber()){\
+		pop();\
+		pop();\
+		Value v = NewValue(GetNumValue(a) op GetNumValue(b));\
 		push(v);\
 	} else {\
 		error(TYPE_ERROR, "Can't perform this operation on a non-number");\
@@ -369,13 +1491,15 @@ void Interpreter::RunCommand() {
 #define BINARY_COMP_OP(op) {\
 	Value b = peek(0); \
 	Value a = peek(1); \
-	if (b.GetType() == Value::NUM_T && a.GetType() == Value::NUM_T){\
+	if (a.GetType() == Value::INT_T && b.GetType() == Value::INT_T) {\
 		pop(); \
 		pop(); \
-		float n1 = GetNumValue(a); \
-		float n2 = GetNumValue(b); \
-		\
-		Value v = NewValue((bool)(n1 op n2));\
+		Value v = NewValue((bool)(a.GetInt() op b.GetInt()));\
+		push(v);\
+	} else if (a.IsNumber() && b.IsNumber()){\
+		pop(); \
+		pop(); \
+		Value v = NewValue((bool)(GetNumValue(a) op GetNumValue(b)));\
 		push(v);\
 	} else {\
 		error(TYPE_ERROR, "Can't perform this operation on a non-number");\
@@ -383,18 +1507,18 @@ void Interpreter::RunCommand() {
 }
 
 
-// Bitwise operations & | ^ >> << on integer values
-#define BINARY_BIT_OP(op) {\
+// Bitwise operations & | ^ >> << on integer values, given as an expression of n1 and n2
+#define BINARY_BIT_OP(expr) {\
 	Value b = peek(0); \
 	Value a = peek(1); \
 	if (IsIntegerValue(b) && IsIntegerValue(a)){\
 		pop(); \
 		pop(); \
 		\
-		int n1 = GetNumValue(a); \
-		int n2 = GetNumValue(b); \
+		int64_t n1 = GetIntValue(a); \
+		int64_t n2 = GetIntValue(b); \
 		\
-		Value v = NewValue((float)(n1 op n2));\
+		Value v = NewValue((int64_t)(expr));\
 		push(v); \
 	} else {\
 		error(TYPE_ERROR, "Can't perform this operation on a non-integer");\
@@ -402,11 +1526,16 @@ void Interpreter::RunCommand() {
 }
 
 
-// Variable assignment operations on numbers	+= -= *= /= 
+// Variable assignment operations on numbers	+= -= *=
 #define BINARY_ASSIGN_OP(a, op, IsPlus) {\
 \
 	Value b = peek(0); \
-	if (a->GetType() == Value::NUM_T && b.GetType() == Value::NUM_T){\
+	if (a->GetType() == Value::INT_T && b.GetType() == Value::INT_T) {\
+		pop(); \
+		a->SetValue((int64_t)((uint64_t)a->GetInt() op (uint64_t)b.GetInt()));\
+		Value v = *a; \
+		push(v); \
+	} else if (a->IsNumber() && b.IsNumber()){\
 		pop(); \
 		a->SetValue(GetNumValue(*a) op GetNumValue(b));\
 		Value v = *a; \
@@ -420,14 +1549,16 @@ void Interpreter::RunCommand() {
 }
 
 
-// Variable assignment operations on integer values &= |= ^\ >>= <<=
-#define BINARY_BIT_ASSIGN_OP(a, op) {\
+// Variable assignment operations on integer values &= |= ^\ >>= <<=, given as an expression of n1 and n2
+#define BINARY_BIT_ASSIGN_OP(a, expr) {\
 \
 	Value b = peek(0); \
 	\
 	if (IsIntegerValue(*a) && IsIntegerValue(b) ){\
 		pop(); \
-		a->SetValue((float)((int)GetNumValue(*a) op (int)GetNumValue(b))); \
+		int64_t n1 = GetIntValue(*a); \
+		int64_t n2 = GetIntValue(b); \
+		a->SetValue((int64_t)(expr)); \
 		Value v = *a;\
 		push(v); \
 	} else {\
@@ -435,13 +1566,13 @@ void Interpreter::RunCommand() {
 	}\
 }
 
-	uint8_t opcode = CurrentChunk()->advance();
+	uint8_t opcode = ReadByte();
 	switch (opcode)
 	{
 		case OP_NEWLINE:	break; 
 
 		case OP_CONSTANT: {
-			Value v = CurrentChunk()->ReadConstant(CurrentChunk()->advance());
+			Value v = CurrentChunk()->ReadConstant(ReadByte());
 			push(v);
 			break;
 		}
@@ -468,8 +1599,14 @@ void Interpreter::RunCommand() {
 		case OP_NEGATE: {
 			Value a = peek(0);
 
-			if (a.GetType() == Value::NUM_T) {
-				float n = GetNumValue(a);
+			if (a.GetType() == Value::INT_T) {
+				Value v = NewValue((int64_t)(0 - (uint64_t)a.GetInt()));
+
+				pop();
+				push(v);
+			}
+			else if (a.GetType() == Value::NUM_T) {
+				double n = GetNumValue(a);
 				Value v = NewValue(-n);
 
 				pop();
@@ -486,13 +1623,13 @@ void Interpreter::RunCommand() {
 			Value a = peek(0);
 			Value::datatype t = a.GetType();
 			switch (t) {
+				case Value::INT_T:
 				case Value::NUM_T: {
+					if (!IsIntegerValue(a)) error(TYPE_ERROR, "Can't perform bitwise operation on a non-integer");
 					pop();
 
-					float n = GetNumValue(a);
-					Value v = NewValue((float)(~(int)n));
-					if (n / 1 == n)	push(v);
-					else error(TYPE_ERROR, "Can't perform bitwise operation on a non-integer");
+					Value v = NewValue((int64_t)~GetIntValue(a));
+					push(v);
 					break;
 				}
 				case Value::BOOL_T: {
@@ -519,6 +1656,7 @@ void Interpreter::RunCommand() {
 
 		case OP_ADD: {
 			switch (peek(0).GetType()) {
+				case Value::INT_T:
 				case Value::NUM_T:	BINARY_NUM_OP(+);	break;
 				case Value::OBJECT_T: {
 
@@ -529,7 +1667,7 @@ void Interpreter::RunCommand() {
 					StrValue* a = ExtractStrValue(&v1, msg);
 					StrValue* b = ExtractStrValue(&v2, msg);
 
-					Value v = NewObject((std::string&)(*a + *b));
+					Value v = NewObject(*a + *b);
 					
 					pop();  // remove reference to v2
 					pop();  // remove reference to v1 
@@ -545,17 +1683,28 @@ void Interpreter::RunCommand() {
 		}
 		case OP_SUB:			BINARY_NUM_OP(-);	break;
 		case OP_MULTIPLY: 		BINARY_NUM_OP(*);	break;
-		case OP_DIVIDE:			BINARY_NUM_OP(/);	break;
-
-		case OP_BIT_AND:		BINARY_BIT_OP(&);	break;
-		case OP_BIT_OR:			BINARY_BIT_OP(|);	break;
-		case OP_BIT_XOR:		BINARY_BIT_OP(^);	break;
-
-		case OP_SHIFT_LEFT:		BINARY_BIT_OP(<<);	break;
-		case OP_SHIFT_RIGHT:	BINARY_BIT_OP(>>);	break;
+		case OP_DIVIDE: {
+			Value b = peek(0);
+			Value a = peek(1);
+			if (!a.IsNumber() || !b.IsNumber()) error(TYPE_ERROR, "Can't perform this operation on a non-number");
+
+			pop();
+			pop();
+			Value v = Divide(a, b);
+			push(v);
+			break;
+		}
+
+		case OP_BIT_AND:		BINARY_BIT_OP(n1 & n2);	break;
+		case OP_BIT_OR:			BINARY_BIT_OP(n1 | n2);	break;
+		case OP_BIT_XOR:		BINARY_BIT_OP(n1 ^ n2);	break;
+
+		case OP_SHIFT_LEFT:		BINARY_BIT_OP(ShiftLeft(n1, n2));	break;
+		case OP_SHIFT_RIGHT:	BINARY_BIT_OP(ShiftRight(n1, n2));	break;
 
 		case OP_EQUALS: {
 			switch (peek(0).GetType()) {
+				case Value::INT_T:
 				case Value::NUM_T: BINARY_COMP_OP(== ); break;
 				case Value::BOOL_T: {
 					Value v2 = pop();
@@ -577,7 +1726,7 @@ void Interpreter::RunCommand() {
 					Value v2 = pop();
 					Value v1 = peek(0);
 
-					Value v = NewValue(v2.IsNone());
+					Value v = NewValue(v1.IsNone());
 					
 					pop(); // delete reference to v1
 					push(v);
@@ -602,6 +1751,12 @@ void Interpreter::RunCommand() {
 						IsEqual = NewValue(false);
 						
 					}
+					else if (o1->IsString()) {
+						IsEqual = NewValue(((StrValue*)o1)->GetView() == ((StrValue*)o2)->GetView());
+					}
+					else if (o1->IsInstance() || o1->IsClass()) {
+						IsEqual = NewValue(o1 == o2);
+					}
 					else {
 						// If type and string are equal, so are the values
 						IsEqual = NewValue((o1->ToString() == o2->ToString()) && (o1->GetType() == o2->GetType()));
@@ -609,6 +1764,7 @@ void Interpreter::RunCommand() {
 
 					pop(); // delete reference to o2
 					pop(); // delete reference to o1
+					push(IsEqual);
 					break;
 				}
 			}
@@ -618,16 +1774,13 @@ void Interpreter::RunCommand() {
 		case OP_GREATER:	BINARY_COMP_OP(>); break;
 
 		case OP_DEFINE_GLOBAL: {
-			uint8_t IdIndex = CurrentChunk()->advance(); // Index of identifier in constants table
+			uint8_t IdIndex = ReadByte(); // Index of identifier in constants table
 
-			std::string identifier = GetConstantStr(IdIndex);
+			std::string& identifier = GetConstantStr(IdIndex);
 
 			if (IsDefinedGlobal(identifier)) {
-				if (globals[identifier].IsObject() && (globals[identifier].GetObjectValue())->IsNative()) {
-					error(REDECLARED_RAT, "identifier '" + identifier + "' is reserved for a native function, " +
-						"and cannot be a variable or runnable's name");
-				}
-				error(REDECLARED_RAT, "rat with the name '" + identifier + "' already exists");
+				bool native = globals[identifier].IsObject() && globals[identifier].GetObjectValue()->IsNative();
+				if (!native) error(REDECLARED_RAT, "rat with the name '" + identifier + "' already exists");
 			}
 
 			Value v = peek(0);
@@ -638,8 +1791,8 @@ void Interpreter::RunCommand() {
 		}
 
 		case OP_SET_GLOBAL: {
-			uint8_t IdIndex = CurrentChunk()->advance();  // Index of identifier in constants table
-			std::string identifier = GetConstantStr(IdIndex);
+			uint8_t IdIndex = ReadByte();  // Index of identifier in constants table
+			std::string& identifier = GetConstantStr(IdIndex);
 
 			Value v = peek(0); // want to keep value on the stack in case the assignment is part of an expression
 
@@ -649,6 +1802,7 @@ void Interpreter::RunCommand() {
 				ObjectValue* o = globals[identifier].GetObjectValue();
 
 				if (o->GetType() == ObjectValue::RUNNABLE_T) error(TYPE_ERROR, "Can't reassign a runnable");
+				else if (o->GetType() == ObjectValue::CLASS_T) error(TYPE_ERROR, "Can't reassign a rat declared with 'endrat'");
 				else if (o->GetType() == ObjectValue::NATIVE_T) error(TYPE_ERROR, "Can't set a value to a native runnable");
 
 				// Remove reference
@@ -681,9 +1835,9 @@ void Interpreter::RunCommand() {
 		}
 
 		case OP_SET_LOCAL: {
-			uint8_t FrameSlot = CurrentChunk()->advance();
+			uint8_t FrameSlot = ReadByte();
 
-			Value v = this->stack.stk[this->body->GetFrameStart() + FrameSlot + 1];
+			Value v = this->stack.stk[CurrentFrame().FrameStart + FrameSlot + 1];
 			if (v.IsObject()) {
 
 				// Remove reference
@@ -694,7 +1848,7 @@ void Interpreter::RunCommand() {
 				}
 			}
 
-			this->stack.stk[this->body->GetFrameStart() + FrameSlot + 1] = peek(0);
+			this->stack.stk[CurrentFrame().FrameStart + FrameSlot + 1] = peek(0);
 			if (peek(0).IsObject()) {
 				peek(0).GetObjectValue()->AddReference();
 			}
@@ -704,11 +1858,12 @@ void Interpreter::RunCommand() {
 		case OP_INC_GLOBAL: {
 			Value* var = FindGlobal();
 
-			if (var->GetType() != Value::NUM_T) {
+			if (!var->IsNumber()) {
 				error(TYPE_ERROR, "Can't increment a non-number value");
 			}
 
-			var->SetValue(GetNumValue(*var) + 1);
+			if (var->GetType() == Value::INT_T) var->SetValue((int64_t)((uint64_t)var->GetInt() + 1));
+			else var->SetValue(GetNumValue(*var) + 1);
 			
 			push(*var);
 			break;
@@ -717,10 +1872,11 @@ void Interpreter::RunCommand() {
 		case OP_INC_LOCAL: {
 			Value* var = FindLocal();
 
-			if (var->GetType() != Value::NUM_T) {
+			if (!var->IsNumber()) {
 				error(TYPE_ERROR, "Can't increment a non-number value");
 			}
-			var->SetValue(GetNumValue(*var) + 1);
+			if (var->GetType() == Value::INT_T) var->SetValue((int64_t)((uint64_t)var->GetInt() + 1));
+			else var->SetValue(GetNumValue(*var) + 1);
 
 			push(*var);
 			break;
@@ -731,11 +1887,12 @@ void Interpreter::RunCommand() {
 		case OP_DEC_GLOBAL: {
 			Value* var = FindGlobal();
 
-			if (var->GetType() != Value::NUM_T) {
+			if (!var->IsNumber()) {
 				error(TYPE_ERROR, "Can't decrement a non-number value");
 			}
 
-			var->SetValue(GetNumValue(*var) - 1);
+			if (var->GetType() == Value::INT_T) var->SetValue((int64_t)((uint64_t)var->GetInt() - 1));
+			else var->SetValue(GetNumValue(*var) - 1);
 			push(*var);
 
 			break;
@@ -744,11 +1901,12 @@ void Interpreter::RunCommand() {
 		case OP_DEC_LOCAL: {
 			Value* var = FindLocal();
 
-			if (var->GetType() != Value::NUM_T) {
+			if (!var->IsNumber()) {
 				error(TYPE_ERROR, "Can't decrement a non-number value");
 			}
 
-			var->SetValue(GetNumValue(*var) - 1);
+			if (var->GetType() == Value::INT_T) var->SetValue((int64_t)((uint64_t)var->GetInt() - 1));
+			else var->SetValue(GetNumValue(*var) - 1);
 			push(*var);
 
 			break;
@@ -759,22 +1917,7 @@ void Interpreter::RunCommand() {
 				case Value::OBJECT_T: {
 					ObjectValue* o = peek(0).GetObjectValue();
 
-					if (o->IsString()) {
-						std::string ErrorMsg = "Can only perform this operation on two strings or two numbers";
-
-						Value v = peek(0);
-						StrValue* b = ExtractStrValue(&v, ErrorMsg);
-						StrValue* a = ExtractStrValue(FindGlobal(), ErrorMsg);
-
-						a->SetValue((std::string&)(*a + *b)); // no need to change references to a,
-						//the ObjectValue is the same
-						
-						
-						pop(); // delete reference to v
-						
-						Value v2 = NewObject(a);
-						push(v2);
-					}
+					if (o->IsString()) ConcatAssign(FindGlobal());
 					
 					break;
 				}
@@ -790,24 +1933,7 @@ void Interpreter::RunCommand() {
 		
 		case OP_ADD_ASSIGN_LOCAL: {
 			switch (peek(0).GetType()) {
-				case Value::OBJECT_T: {
-					Value v = peek(0); // don't want to remove reference yet
-
-					std::string msg = "Can only perform this operation on two numbers or two strings";
-					StrValue* b = ExtractStrValue(&v, msg);
-
-					Value* va = FindLocal();
-					StrValue* a = ExtractStrValue(va, msg);
-
-					a->SetValue((std::string&)(*a + *b)); // no need to change references to a,
-					//the ObjectValue is the same
-					
-					va->SetValue(a);
-
-					pop(); // remove reference to v
-					push(*va);
-					break;
-				}
+				case Value::OBJECT_T:	ConcatAssign(FindLocal());	break;
 
 				default: {
 					Value* a = FindLocal();
@@ -834,7 +1960,13 @@ void Interpreter::RunCommand() {
 
 		case OP_DIVIDE_ASSIGN_GLOBAL: {
 			Value* a = FindGlobal();
-			BINARY_ASSIGN_OP(a, /, false);
+			Value b = peek(0);
+			if (!a->IsNumber() || !b.IsNumber()) error(TYPE_ERROR, "Can only perform this operation on two numbers");
+
+			pop();
+			*a = Divide(*a, b);
+			Value v = *a;
+			push(v);
 			break;
 		}
 
@@ -853,7 +1985,13 @@ void Interpreter::RunCommand() {
 
 		case OP_DIVIDE_ASSIGN_LOCAL: {
 			Value* a = FindLocal();
-			BINARY_ASSIGN_OP(a, / , false);
+			Value b = peek(0);
+			if (!a->IsNumber() || !b.IsNumber()) error(TYPE_ERROR, "Can only perform this operation on two numbers");
+
+			pop();
+			*a = Divide(*a, b);
+			Value v = *a;
+			push(v);
 			break;
 		}
 
@@ -862,38 +2000,38 @@ void Interpreter::RunCommand() {
 
 		case OP_BIT_AND_ASSIGN_GLOBAL: {
 			Value* a = FindGlobal();
-			BINARY_BIT_ASSIGN_OP(a, &);
+			BINARY_BIT_ASSIGN_OP(a, n1 & n2);
 			break;
 		}
 
 		case OP_BIT_OR_ASSIGN_GLOBAL: {
 			Value* a = FindGlobal();
-			BINARY_BIT_ASSIGN_OP(a, |);
+			BINARY_BIT_ASSIGN_OP(a, n1 | n2);
 			break;
 		}
 
 		case OP_BIT_XOR_ASSIGN_GLOBAL: {
 			Value* a = FindGlobal();
-			BINARY_BIT_ASSIGN_OP(a, ^);
+			BINARY_BIT_ASSIGN_OP(a, n1 ^ n2);
 			break;
 		}
 
 
 		case OP_BIT_AND_ASSIGN_LOCAL: {
 			Value* a = FindLocal();
-			BINARY_BIT_ASSIGN_OP(a, &);
+			BINARY_BIT_ASSIGN_OP(a, n1 & n2);
 			break;
 		}
 
 		case OP_BIT_OR_ASSIGN_LOCAL: {
 			Value* a = FindLocal();
-			BINARY_BIT_ASSIGN_OP(a, | );
+			BINARY_BIT_ASSIGN_OP(a, n1 | n2);
 			break;
 		}
 
 		case OP_BIT_XOR_ASSIGN_LOCAL: {
 			Value* a = FindLocal();
-			BINARY_BIT_ASSIGN_OP(a, ^);
+			BINARY_BIT_ASSIGN_OP(a, n1 ^ n2);
 			break;
 		}
 
@@ -902,63 +2040,63 @@ void Interpreter::RunCommand() {
 
 		case OP_SHIFTL_ASSIGN_GLOBAL: {
 			Value* a = FindGlobal();
-			BINARY_BIT_ASSIGN_OP(a, <<);
+			BINARY_BIT_ASSIGN_OP(a, ShiftLeft(n1, n2));
 			break;
 		}
 
 		case OP_SHIFTR_ASSIGN_GLOBAL: {
 			Value* a = FindGlobal();
-			BINARY_BIT_ASSIGN_OP(a, >>);
+			BINARY_BIT_ASSIGN_OP(a, ShiftRight(n1, n2));
 			break;
 		}
 
 
 		case OP_SHIFTL_ASSIGN_LOCAL: {
 			Value* a = FindLocal();
-			BINARY_BIT_ASSIGN_OP(a, << );
+			BINARY_BIT_ASSIGN_OP(a, ShiftLeft(n1, n2));
 			break;
 		}
 
 		case OP_SHIFTR_ASSIGN_LOCAL: {
 			Value* a = FindLocal();
-			BINARY_BIT_ASSIGN_OP(a, >> );
+			BINARY_BIT_ASSIGN_OP(a, ShiftRight(n1, n2));
 			break;
 		}
 
 		case OP_JUMP_IF_TRUE: {
-			uint8_t JumpHighByte = this->CurrentChunk()->advance();
-			uint8_t JumpLowByte = this->CurrentChunk()->advance();
+			uint8_t JumpHighByte = ReadByte();
+			uint8_t JumpLowByte = ReadByte();
 
 			if (peek(0).IsTruthy()) {
 				short distance = (short)(JumpHighByte << 8) + (short)(JumpLowByte);
-				this->CurrentChunk()->MoveIp(distance);
+				CurrentFrame().ip += distance;
 			}
 			break;
 		}
 		case OP_JUMP_IF_FALSE: {
-			uint8_t JumpHighByte = this->CurrentChunk()->advance();
-			uint8_t JumpLowByte = this->CurrentChunk()->advance();
+			uint8_t JumpHighByte = ReadByte();
+			uint8_t JumpLowByte = ReadByte();
 
 			if (!(peek(0).IsTruthy())) {
 				short distance = (short)(JumpHighByte << 8) + (short)(JumpLowByte);
-				this->CurrentChunk()->MoveIp(distance);
+				CurrentFrame().ip += distance;
 			}
 			break;
 		}
 		case OP_JUMP: {
-			uint8_t JumpHighByte =	this->CurrentChunk()->advance();
-			uint8_t JumpLowByte =	this->CurrentChunk()->advance();
+			uint8_t JumpHighByte =	ReadByte();
+			uint8_t JumpLowByte =	ReadByte();
 
 			short distance = (short)(JumpHighByte << 8) + (short)(JumpLowByte);
-			this->CurrentChunk()->MoveIp(distance);
+			CurrentFrame().ip += distance;
 			break;
 		}
 		case OP_LOOP: {
-			uint8_t JumpHighByte =	this->CurrentChunk()->advance();
-			uint8_t JumpLowByte =	this->CurrentChunk()->advance();
+			uint8_t JumpHighByte =	ReadByte();
+			uint8_t JumpLowByte =	ReadByte();
 
 			short distance = (short)(JumpHighByte << 8) + (short)(JumpLowByte);
-			this->CurrentChunk()->MoveIp(-distance);
+			CurrentFrame().ip -= distance;
 			break;
 		}
 
@@ -966,9 +2104,7 @@ void Interpreter::RunCommand() {
 			Value v = peek(0);
 			if (!IsIntegerValue(v)) error(TYPE_ERROR, "Can only use positive integer values as the operand to 'repeat'");
 			
-			int n = GetNumValue(v);
-
-			if (n <= 0)  error(TYPE_ERROR, "Can only use positive integer values as the operand to 'repeat'");
+			if (GetIntValue(v) <= 0)  error(TYPE_ERROR, "Can only use positive integer values as the operand to 'repeat'");
 			break;
 		}
 
@@ -977,12 +2113,10 @@ void Interpreter::RunCommand() {
 			Value v = pop();
 			if (!IsIntegerValue(v)) error(INTERNAL_ERROR, "");
 
-			v.SetValue(v.GetNum() - 1);
-
-			int n = GetNumValue(v);
+			v.SetValue(GetIntValue(v) - 1);
 
-			if (n == 0) {
-				CurrentChunk()->MoveIp(4);  // skip over 'op_loop' instruction
+			if (v.GetInt() == 0) {
+				CurrentFrame().ip += 4;  // skip over 'op_loop' instruction
 			}
 			else {
 				push(v);
@@ -991,11 +2125,242 @@ void Interpreter::RunCommand() {
 			break;
 		}
 
+		case OP_BUILD_LIST: {
+			// Collect the elements on top of the stack into a new list
+			uint8_t count = ReadByte();
+
+			ListValue* list = new ListValue();
+			for (int i = count - 1; i >= 0; i--) {
+				Value v = peek(i);
+				if (v.IsObject()) v.GetObjectValue()->AddReference();  // held by the list
+				list->Push(v);
+			}
+
+			for (int i = 0; i < count; i++) pop();
+
+			Value t = NewObject(list);
+			push(t);
+			break;
+		}
+
+		case OP_BUILD_MAP: {
+			// Collect the key-value pairs on top of the stack into a new map
+			uint8_t count = ReadByte();
+
+			MapValue* map = new MapValue();
+			Value t = NewObject(map);
+			push(t);  // so the map is freed along with the stack if a key is rejected
+
+			for (int i = count - 1; i >= 0; i--) {
+				Value key = peek(2 * i + 2);
+				Value v = peek(2 * i + 1);
+				CheckKey(key);
+				MapStore(map, key, v);
+			}
+
+			map->AddReference();  // keep the map while the pairs below it are popped
+			pop();
+			for (int i = 0; i < 2 * count; i++) pop();
+			push(t);
+			map->DeleteReference();
+			break;
+		}
+
+		case OP_GET_INDEX: {
+			Value container = peek(1);
+			Value v;
+
+			if (container.IsObject() && container.GetObjectValue()->IsMap()) {
+				Value key = peek(0);
+				CheckKey(key);
+				if (!((MapValue*)container.GetObjectValue())->Get(key, v)) {
+					error(INDEX_ERROR, "Key '" + key.ToString() + "' is not in the map");
+				}
+			}
+			else {
+				ListValue* list = ExtractListValue(&container, "Can only index into a list or a map");
+				v = list->Get(ListIndex(list, peek(0)));
+			}
+
+			if (v.IsObject()) v.GetObjectValue()->AddReference();
+			// Keep the element alive in case popping the list frees it
+
+			pop(); // remove index
+			pop(); // remove reference to the list
+			push(v);
+
+			if (v.IsObject()) v.GetObjectValue()->DeleteReference();
+			break;
+		}
+
+		case OP_SET_INDEX: {
+			// The assigned value is left on the stack, as the assignment's result
+			Value v = peek(0);
+			Value container = peek(2);
+
+			if (v.IsObject()) v.GetObjectValue()->AddReference();  // keep it alive in case popping the container frees it
+
+			if (container.IsObject() && container.GetObjectValue()->IsMap()) {
+				Value key = peek(1);
+				CheckKey(key);
+				MapStore((MapValue*)container.GetObjectValue(), key, v);
+			}
+			else {
+				ListValue* list = ExtractListValue(&container, "Can only assign to an index of a list or a map");
+				size_t index = ListIndex(list, peek(1));
+
+				if (v.IsObject()) v.GetObjectValue()->AddReference();  // held by the list
+				Value old = list->Set(index, v);
+				Release(old);
+			}
+
+			pop(); // remove v
+			pop(); // remove index
+			pop(); // remove reference to the list
+			push(v);
+
+			if (v.IsObject()) v.GetObjectValue()->DeleteReference();
+			break;
+		}
+
+		case OP_GET_ITER: {
+			// Turn the value on top of the stack into an iterator, for a 'for' loop
+			Value v = peek(0);
+
+			if (v.IsObject() && (v.GetObjectValue()->IsList() || v.GetObjectValue()->IsMap())) {
+				ObjectValue* container = v.GetObjectValue();
+				container->AddReference();  // held by the iterator
+
+				Value iterator = NewObject(new IteratorValue(container));
+				pop();
+				push(iterator);
+				break;
+			}
+
+			if (v.IsObject() && v.GetObjectValue()->IsGenerator()) break;  // generators are their own iterators
+
+			bool iterable = v.IsObject() && v.GetObjectValue()->IsFile() && ((FileValue*)v.GetObjectValue())->IsOpen()
+				&& !((FileValue*)v.GetObjectValue())->IsWritable();
+
+			if (!iterable) error(TYPE_ERROR, "Can't iterate over " + v.ToString());
+			break;  // file handles are their own iterators
+		}
+
+		case OP_FOR_ITER_GLOBAL:
+		case OP_FOR_ITER_LOCAL: {
+			// Store the iterator's next value in the loop variable, or leave the loop if there are none left
+			uint8_t index = ReadByte();
+			uint8_t JumpHighByte = ReadByte();
+			uint8_t JumpLowByte = ReadByte();
+
+			Value* var = nullptr;  // stays null for a global that isn't defined yet
+			std::string identifier;
+			if (opcode == OP_FOR_ITER_LOCAL) var = &this->stack.stk[CurrentFrame().FrameStart + index + 1];
+			else {
+				identifier = GetConstantStr(index);
+				if (IsDefinedGlobal(identifier)) {
+					var = &globals[identifier];
+					if (var->IsObject() && (var->GetObjectValue()->IsRunnable() || var->GetObjectValue()->IsNative())) {
+						error(TYPE_ERROR, "Can't use the runnable '" + identifier + "' as a loop variable");
+					}
+				}
+			}
+
+			Value next;
+			if (!IteratorNext(peek(0), var, next)) {
+				short distance = (short)(JumpHighByte << 8) + (short)(JumpLowByte);
+				CurrentFrame().ip += distance;
+				break;
+			}
+
+			if (var == nullptr) {
+				AddGlobal(identifier, Value());
+				var = &globals[identifier];
+			}
+
+			if (!next.IsObject() || !var->IsObject() || next.GetObjectValue() != var->GetObjectValue()) {
+				StoreLoopVariable(var, next);
+			}
+			break;
+		}
+
+		case OP_RANGE_GLOBAL:
+		case OP_RANGE_LOCAL: {
+			// Enter a loop over range(start, end, step). The three stay on top of the stack, the start as the counter
+			uint8_t index = ReadByte();
+			uint8_t JumpHighByte = ReadByte();
+			uint8_t JumpLowByte = ReadByte();
+
+			Value& counter = peek(2);
+			Value& end = peek(1);
+			Value& step = peek(0);
+
+			if (!counter.IsNumber() || !end.IsNumber() || !step.IsNumber()) {
+				error(TYPE_ERROR, "Arguments to 'range' must be numbers");
+			}
+			if (step.GetNum() == 0) error(TYPE_ERROR, "The step of a range can't be 0");
+
+			if (!counter.IsInt() || !end.IsInt() || !step.IsInt()) {
+				// A double anywhere makes the whole range count in doubles, so stepping checks a single type
+				counter.SetValue(counter.GetNum());
+				end.SetValue(end.GetNum());
+				step.SetValue(step.GetNum());
+			}
+
+			bool empty = counter.IsInt() ? (step.GetInt() > 0 ? counter.GetInt() >= end.GetInt() : counter.GetInt() <= end.GetInt())
+				: (step.GetNum() > 0 ? counter.GetNum() >= end.GetNum() : counter.GetNum() <= end.GetNum());
+			if (empty) {
+				short distance = (short)(JumpHighByte << 8) + (short)(JumpLowByte);
+				CurrentFrame().ip += distance;
+				break;
+			}
+
+			Value* var = RangeVariable(opcode == OP_RANGE_LOCAL, index);
+			if (var->IsObject()) Release(*var);
+			if (counter.IsInt()) var->SetValue(counter.GetInt());
+			else var->SetValue(counter.GetNum());
+			break;
+		}
+
+		case OP_RANGE_STEP_GLOBAL:
+		case OP_RANGE_STEP_LOCAL: {
+			// Advance the counter, and jump back to the start of the body while it's within the range
+			uint8_t index = ReadByte();
+			uint8_t JumpHighByte = ReadByte();
+			uint8_t JumpLowByte = ReadByte();
+
+			Value* bounds = &this->stack.stk[this->stack.count - 3];	// counter, end, step, all integers or all doubles
+			Value* var = (opcode == OP_RANGE_STEP_LOCAL) ? &this->stack.stk[CurrentFrame().FrameStart + index + 1]
+				: RangeVariable(false, index);
+
+			if (bounds[0].IsInt()) {
+				int64_t step = bounds[2].GetInt();
+				int64_t n = (int64_t)((uint64_t)bounds[0].GetInt() + (uint64_t)step);
+				if (step > 0 ? n >= bounds[1].GetInt() : n <= bounds[1].GetInt()) break;  // done, the bounds are popped next
+
+				bounds[0].SetValue(n);
+				if (var->IsObject()) Release(*var);  // the body assigned something else to it
+				var->SetValue(n);
+			}
+			else {
+				double step = bounds[2].GetNum();
+				double n = bounds[0].GetNum() + step;
+				if (step > 0 ? n >= bounds[1].GetNum() : n <= bounds[1].GetNum()) break;
+
+				bounds[0].SetValue(n);
+				if (var->IsObject()) Release(*var);
+				var->SetValue(n);
+			}
+
+			short distance = (short)(JumpHighByte << 8) + (short)(JumpLowByte);
+			CurrentFrame().ip -= distance;
+			break;
+		}
+
 		case OP_DEFINE_RUNNABLE: {
-			uint8_t index = CurrentChunk()->advance();		// Index of runnable identifier in constants table
+			uint8_t index = ReadByte();		// Index of runnable identifier in constants table
 
-			uint8_t linesnum = CurrentChunk()->advance();   // Number of lines in the runnable
-			//linesnum can be discarded for now- meant to be used only when reporting errors
+			ReadByte();   // Number of lines in the runnable, only used when the compiler reports errors
 
 			Value v = CurrentChunk()->ReadConstant(index);
 			if (!v.IsObject()) error(INTERNAL_ERROR, "");
@@ -1005,7 +2370,7 @@ void Interpreter::RunCommand() {
 
 			RunnableValue* runnable = (RunnableValue *)o;
 
-			AddGlobal(runnable->GetName(), NewObject(runnable));
+			AddGlobal(runnable->GetName(), Value(runnable));  // owned by the chunk, not by the interpreter
 			break;
 		}
 
@@ -1014,17 +2379,7 @@ void Interpreter::RunCommand() {
 			Value* called = FindGlobal();
 
 			if (called->IsObject() && called->GetObjectValue()->IsRunnable()) {
-				RunnableValue* runnable = ((RunnableValue*)called->GetObjectValue());
-
-				uint8_t FrameIndex = this->stack.count - runnable->GetArity() - 1;
-				// current capacity, minus arguments and identifier
-
-
-				// Copy the runnable, don't invoke it directly. This way, recursion is allowed
-				Chunk* c = new Chunk(runnable->GetChunk());
-				RunnableValue* NewBody = new RunnableValue(runnable, c, this->body, FrameIndex);
-
-				SetBody(NewBody);
+				EnterRunnable((RunnableValue*)called->GetObjectValue());
 			}
 			else {
 				error(TYPE_ERROR, "Can't call an object that isn't a runnable");
@@ -1034,31 +2389,221 @@ void Interpreter::RunCommand() {
 
 		case OP_CALL_NATIVE: {
 			Value* called = FindGlobal();
-			uint8_t arity = CurrentChunk()->advance();
+			uint8_t arity = ReadByte();
 
 			if (called->IsObject() && called->GetObjectValue()->IsNative()) {
-				NativeValue* nv = (NativeValue *)called->GetObjectValue();
-				if (arity != nv->GetArity()) {
-					error(TYPE_ERROR, nv->ToString() + " called with " +
-						std::to_string(arity) + " arguments, but accepts " + std::to_string(nv->GetArity()));
-				}
-				NativeRunnable n = nv->GetRunnable();
-				(this->*n)(); // Call native runnable
+				CallNative((NativeValue*)called->GetObjectValue(), arity);
 			}
 			else {
 				error(TYPE_ERROR, "Can't call an object that isn't a runnable");
 			}
+			break;
+		}
 
-			if (peek(0).IsObject()) peek(0).GetObjectValue()->AddReference(); 
-			// so it doesn't get deleted when popping before call frame
-			
-			Value ReturnValue = pop();
+		case OP_AWAIT: {
+			Value v = peek(0);
+			if (!v.IsObject() || !v.GetObjectValue()->IsFuture()) break;  // awaiting anything else gives the value itself
+
+			FutureValue* future = (FutureValue*)v.GetObjectValue();
+			if (!future->IsAwaited()) {
+				// An async call stops here, and the event loop runs this command again once the future is done
+				GeneratorValue* coroutine = CurrentFrame().generator;
+				if (coroutine != nullptr && coroutine->GetFuture() != nullptr && !future->IsDone()) {
+					CurrentFrame().ip--;
+					SuspendFrame(future);
+					break;
+				}
 
-			pop(); // remove runnable from stack
-			
-			push(ReturnValue);
-			if (ReturnValue.IsObject()) peek(0).GetObjectValue()->DeleteReference();
+				// A task waiting for another one is parked
+				Task* waiter = future->IsSpawned() ? Waiter() : nullptr;
+				if (waiter != nullptr && !future->Ready(waiter)) {
+					this->suspended = true;
+					break;
+				}
+
+				RunLoop(future);  // async calls and I/O go on meanwhile. An async call's future is resolved by it
+			}
+
+			if (!future->IsAwaited()) {
+				// Completed on another thread, or about to be. File operations are short, so their futures block
+				std::string ErrorMsg;
+				Value result = future->Wait(ErrorMsg);
+				if (ErrorMsg != "") error(future->IsSpawned() ? TASK_ERROR : INTERNAL_ERROR, ErrorMsg);
+
+				future->SetResult(Adopt(result));
+			}
+
+			Value result = future->GetResult();
+			if (result.IsObject()) result.GetObjectValue()->AddReference();
+			// Keep the result alive while the future is popped, since freeing the future releases it
+
+			pop();
+			push(result);
+
+			if (result.IsObject()) result.GetObjectValue()->DeleteReference();
+			break;
+		}
+
+		case OP_SPAWN: {
+			Value* called = FindGlobal();
+
+			if (called->IsObject() && called->GetObjectValue()->IsRunnable()) {
+				Spawn((RunnableValue*)called->GetObjectValue());
+			}
+			else {
+				error(TYPE_ERROR, "Can only spawn a runnable");
+			}
+			break;
+		}
+
+		case OP_CLASS: {
+			Value c = NewObject(new ClassValue(GetConstantStr(ReadByte())));
+			push(c);
+			break;
+		}
+
+		case OP_METHOD: {
+			uint8_t index = ReadByte();
+			ReadByte();	// number of lines, only used when reporting errors
+
+			RunnableValue* method = (RunnableValue*)CurrentChunk()->ReadConstant(index).GetObjectValue();
+			((ClassValue*)peek(0).GetObjectValue())->AddMethod(method);
+			break;
+		}
+
+		case OP_CONSTRUCT: {
+			// The rat is replaced on the stack by a new instance, which its 'init' runnable gets as 'this'
+			uint8_t arity = ReadByte();
+
+			Value callee = peek(arity);
+			if (!callee.IsObject() || !callee.GetObjectValue()->IsClass()) error(TYPE_ERROR, "Can't construct " + callee.ToString());
+
+			ClassValue* klass = (ClassValue*)callee.GetObjectValue();
+			RunnableValue* init = klass->FindMethod("init");
+			uint8_t accepts = (init == nullptr) ? 0 : init->GetArity();
+			if (arity != accepts) {
+				error(TYPE_ERROR, klass->ToString() + " constructed with " + std::to_string(arity) +
+					" arguments, but accepts " + std::to_string(accepts));
+			}
+
+			klass->AddReference();  // held by the instance
+			Value instance = NewObject(new InstanceValue(klass));
+			instance.GetObjectValue()->AddReference();
+
+			this->stack.stk[this->stack.count - arity - 1] = instance;
+			Release(callee);
+
+			if (init != nullptr) EnterRunnable(init);
+			break;
+		}
+
+		case OP_GET_THIS: {
+			Value v = this->stack.stk[CurrentFrame().FrameStart];
+			push(v);
+			break;
+		}
+
+		case OP_GET_FIELD: {
+			uint8_t NameIndex = ReadByte();
+			FieldCache& cache = ReadCache();
+
+			Value v = peek(0);
+			InstanceValue* instance = ExtractInstanceValue(&v, "Only instances of rats have fields");
+			Shape* shape = instance->GetShape();
+
+			short slot = -1;
+			for (int i = 0; i < cache.count; i++) {
+				if (cache.entries[i].from == shape && cache.entries[i].to == shape) {
+					slot = cache.entries[i].slot;
+					break;
+				}
+			}
+
+			if (slot == -1) {
+				std::string& name = GetConstantStr(NameIndex);
+				slot = shape->Find(name);
+				if (slot == -1) error(UNDEFINED_RAT, instance->GetClass()->GetName() + " has no field '" + name + "'");
+
+				if (cache.count < CacheEntries) cache.entries[cache.count++] = { shape, shape, (uint16_t)slot };
+			}
+
+			Value field = instance->GetFields()[slot];
+			if (field.IsObject()) field.GetObjectValue()->AddReference();
+			// Keep the field alive in case popping the instance frees it
+
+			pop();
+			push(field);
+
+			if (field.IsObject()) field.GetObjectValue()->DeleteReference();
+			break;
+		}
+
+		case OP_SET_FIELD: {
+			// The assigned value is left on the stack, as the assignment's result
+			uint8_t NameIndex = ReadByte();
+			FieldCache& cache = ReadCache();
+
+			Value v = peek(0);
+			Value target = peek(1);
+			InstanceValue* instance = ExtractInstanceValue(&target, "Can only assign to a field of a rat's instance");
+			Shape* shape = instance->GetShape();
+
+			CacheEntry entry = { nullptr, nullptr, 0 };
+			for (int i = 0; i < cache.count; i++) {
+				if (cache.entries[i].from == shape) {
+					entry = cache.entries[i];
+					break;
+				}
+			}
+
+			if (entry.from == nullptr) {
+				std::string& name = GetConstantStr(NameIndex);
+				short slot = shape->Find(name);
+
+				if (slot != -1) entry = { shape, shape, (uint16_t)slot };
+				else {
+					Shape* next = instance->GetClass()->Transition(shape, name);
+					entry = { shape, next, (uint16_t)(next->names.size() - 1) };
+				}
+
+				if (cache.count < CacheEntries) cache.entries[cache.count++] = entry;
+			}
+
+			if (v.IsObject()) v.GetObjectValue()->AddReference();  // held by the instance
+
+			if (entry.to == shape) {
+				Value old = instance->GetFields()[entry.slot];
+				instance->GetFields()[entry.slot] = v;
+				Release(old);
+			}
+			else instance->AddField(entry.to, v);
+
+			if (v.IsObject()) v.GetObjectValue()->AddReference();  // keep it alive in case popping the instance frees it
+
+			pop(); // remove v
+			pop(); // remove reference to the instance
+			push(v);
+
+			if (v.IsObject()) v.GetObjectValue()->DeleteReference();
+			break;
+		}
+
+		case OP_INVOKE: {
+			std::string& name = GetConstantStr(ReadByte());
+			uint8_t arity = ReadByte();
+
+			Value receiver = peek(arity);
+			InstanceValue* instance = ExtractInstanceValue(&receiver, "Only instances of rats have runnables");
 
+			RunnableValue* method = instance->GetClass()->FindMethod(name);
+			if (method == nullptr) error(UNDEFINED_RAT, instance->GetClass()->GetName() + " has no runnable '" + name + "'");
+
+			if (arity != method->GetArity()) {
+				error(TYPE_ERROR, method->ToString() + " called with " + std::to_string(arity) +
+					" arguments, but accepts " + std::to_string(method->GetArity()));
+			}
+
+			EnterRunnable(method);  // the instance is in the callee's slot, where 'this' reads it
 			break;
 		}
 
@@ -1070,7 +2615,9 @@ void Interpreter::RunCommand() {
 			}
 			Value ReturnVal = pop();
 
-			for (int i = this->stack.count; i > this->body->GetFrameStart(); i--) {
+			if (frames.count == 1) error(RETURN_FROM_SCRIPT, "Can't return from the global script");
+
+			for (int i = this->stack.count; i > CurrentFrame().FrameStart; i--) {
 				pop();  // pop frame off the stack
 			}
 
@@ -1079,10 +2626,25 @@ void Interpreter::RunCommand() {
 			if (ReturnVal.IsObject()) ReturnVal.GetObjectValue()->DeleteReference();
 			// Delete reference that was added earlier
 
-			SetBody(this->body->GetEnclosing());
+			GeneratorValue* generator = CurrentFrame().generator;
+			if (generator != nullptr) {
+				generator->SetState(GeneratorValue::FINISHED);
+				if (generator->GetFuture() != nullptr) generator->GetFuture()->SetResult(ReturnVal);  // an async call
+			}
+			frames.count--;
+
+			break;
+		}
 
-			if (this->body == nullptr) error(RETURN_FROM_SCRIPT, "Can't return from the global script");
+		case OP_YIELD: {
+			Value v = peek(0);
+			if (v.IsObject()) v.GetObjectValue()->AddReference();  // kept alive while the frame is taken down
+			pop();
 
+			SuspendFrame(nullptr);
+
+			push(v);
+			if (v.IsObject()) v.GetObjectValue()->DeleteReference();
 			break;
 		}
 
@@ -1097,45 +2659,834 @@ void Interpreter::RunCommand() {
 }
 
 
-Chunk* Interpreter::CurrentChunk() {
-	return this->body->GetChunk();
-}
+void Interpreter::EnterRunnable(RunnableValue* runnable) {
+	// Start executing a runnable whose value and arguments are on top of the stack
 
-void Interpreter::SetBody(RunnableValue* body) {
-	this->body = body;
-}
+	if (!runnable->IsCompiled() && !compiler->CompileRunnable(runnable)) {
+		// A task, a pmap chunk or the host has no calling code to blame, so the error is reported in the runnable
+		if (frames.count == 1 && (CurrentFrame().ip == 0 || IsAtEnd())) {
+			frames.frm[frames.count++] = { runnable, 0, (uint8_t)(this->stack.count - runnable->GetArity() - 1), nullptr };
+		}
+		error(COMPILATION_ERROR, "Couldn't compile " + runnable->ToString());
+	}
 
+	uint8_t FrameIndex = this->stack.count - runnable->GetArity() - 1;
+	// current capacity, minus arguments and identifier
 
-Value& Interpreter::pop() {
-	// Pop value from the vm stack
-	if (this->stack.count <= 0) {
-		error(STACK_UNDERFLOW, "Popping from empty stack");
+	if (runnable->IsGenerator() || runnable->IsAsync()) {
+		MakeGenerator(runnable, FrameIndex);
+		return;
 	}
 
-	stack.count--;
+	if (frames.count == FramesMax) error(STACK_OVERFLOW, "Call stack limit exceeded");
 
-	Value i = stack.stk[stack.count];
+	frames.frm[frames.count++] = { runnable, 0, FrameIndex, nullptr };
+}
 
-	if (i.IsObject()) {
-		// Delete reference to object
-		bool deleted = i.GetObjectValue()->DeleteReference();
-		if (deleted) {
-			RemoveObject(i.GetObjectValue());
-			stack.stk[stack.count].SetValue(nullptr);
-		}
+void Interpreter::MakeGenerator(RunnableValue* runnable, uint8_t FrameIndex) {
+	// A call to a runnable that yields doesn't run it. The callee and its arguments move into a generator,
+	// which takes their place on the stack. A call to an async runnable is queued on the event loop instead,
+	// and its future takes their place
+
+	FutureValue* future = nullptr;
+	if (runnable->IsAsync()) {
+		future = new FutureValue(runnable->GetName());
+		NewObject(future);
+		future->AddReference();  // held by the call
 	}
 
-	return stack.stk[stack.count];
+	GeneratorValue* generator = new GeneratorValue(runnable, future);
+	Value v = NewObject(generator);
+	if (future != nullptr) {
+		generator->AddReference();  // held by the queue
+		this->ready.push_back(generator);
+		v = Value(future);
+	}
+
+	std::vector<Value>& slots = generator->GetSlots();
+	for (int i = FrameIndex; i < this->stack.count; i++) {
+		slots.push_back(this->stack.stk[i]);
+		if (slots.back().IsObject()) slots.back().GetObjectValue()->AddReference();
+	}
+
+	while (this->stack.count > FrameIndex) pop();
+	push(v);
 }
 
-void Interpreter::RemoveObject(ObjectValue* o) {
-	// Remove the object form the linked list and free it's memory
-	if (o == nullptr) return;
+bool Interpreter::Resume(GeneratorValue* generator) {
+	// Put the generator's frame back on top of the stack, and run it until it yields or returns
 
-	if (this->objects == o) {
-		this->objects = o->GetNext();
+	if (generator->GetState() == GeneratorValue::FINISHED) return false;
+	if (generator->GetState() == GeneratorValue::RUNNING) error(TYPE_ERROR, generator->ToString() + " is already running");
 
-#ifdef DEBUG_GC_INFO
+	if (frames.count == FramesMax) error(STACK_OVERFLOW, "Call stack limit exceeded");
+
+	std::vector<Value>& slots = generator->GetSlots();
+	if (this->stack.count + slots.size() > StackSize) error(STACK_OVERFLOW, "Stack limit exceeded");
+
+	uint8_t FrameIndex = this->stack.count;
+	for (size_t i = 0; i < slots.size(); i++) {
+		if (this->collector.phase == COLLECT_MARK) Shade(slots[i]);  // leaving the generator for the stack
+		this->stack.stk[this->stack.count++] = slots[i];  // with their references
+	}
+	slots.clear();
+
+	uint8_t CallerFrames = frames.count;
+	frames.frm[frames.count++] = { generator->GetRunnable(), generator->GetIp(), FrameIndex, generator };
+	generator->SetState(GeneratorValue::RUNNING);
+
+	// Like a callback of a native, the generator runs on this C++ frame, so a task can't be parked inside it
+	bool suspendable = this->suspendable;
+	this->suspendable = false;
+
+	try {
+		while (frames.count > CallerFrames) {
+			if (this->pure) CheckPure();
+			RunCommand();
+		}
+	}
+	catch (ExitCode e) {
+		generator->SetState(GeneratorValue::FINISHED);
+		this->suspendable = suspendable;
+		throw e;
+	}
+	this->suspendable = suspendable;
+
+	if (generator->GetState() == GeneratorValue::FINISHED) pop();  // the return value
+	return generator->GetState() == GeneratorValue::SUSPENDED;
+}
+
+void Interpreter::SuspendFrame(FutureValue* awaited) {
+	// Move the slots of the generator running in the current frame into it, and leave the frame.
+	// Only the frame's own slots are saved, and they're pushed back where the stack is when it's resumed
+
+	CallFrame& frame = CurrentFrame();
+	std::vector<Value>& slots = frame.generator->GetSlots();
+	slots.reserve(this->stack.count - frame.FrameStart);
+	for (int i = frame.FrameStart; i < this->stack.count; i++) {
+		slots.push_back(this->stack.stk[i]);
+		if (slots.back().IsObject()) slots.back().GetObjectValue()->AddReference();
+	}
+	while (this->stack.count > frame.FrameStart) pop();
+
+	frame.generator->Suspend(frame.ip, awaited);
+	frames.count--;
+}
+
+
+EventLoop* Interpreter::GetLoop() {
+	if (this->loop == nullptr) this->loop = new EventLoop();
+	return this->loop;
+}
+
+void Interpreter::RunLoop(FutureValue* until) {
+	// Run the async calls that can go on, and wait for I/O when none can. Calls whose awaited future is done
+	// go on in the order they started waiting
+
+	bool watched = false;
+	while (until == nullptr || !until->IsDone()) {
+		for (size_t i = 0; i < this->waiting.size(); i++) {
+			if (!this->waiting[i]->GetAwaited()->IsDone()) continue;
+			this->ready.push_back(this->waiting[i]);
+			this->waiting.erase(this->waiting.begin() + i--);
+		}
+
+		if (!this->ready.empty()) {
+			GeneratorValue* coroutine = this->ready.front();
+			this->ready.pop_front();
+			RunCoroutine(coroutine);
+			continue;
+		}
+
+		// Nothing left here can complete 'until'. A future of another thread is waited for by the caller
+		if (this->waiting.empty() && (this->loop == nullptr || this->loop->Idle())) return;
+
+		if (until != nullptr && !watched) {
+			watched = true;
+			if (GetLoop()->Watch(until)) continue;	// done in the meantime
+		}
+		GetLoop()->Poll();
+	}
+}
+
+void Interpreter::RunCoroutine(GeneratorValue* coroutine) {
+	// Run an async call up to its next 'await' on a future that isn't done, or until it returns
+	Value v = Value(coroutine);
+
+	try {
+		Resume(coroutine);
+	}
+	catch (ExitCode e) {
+		Release(v);  // the queue's reference
+		throw e;
+	}
+
+	if (coroutine->GetState() == GeneratorValue::WAITING) {
+		GetLoop()->Watch(coroutine->GetAwaited());
+		this->waiting.push_back(coroutine);
+		return;
+	}
+	Release(v);  // returned, and its future is resolved
+}
+
+
+void Interpreter::DefineRunnables() {
+	// Define every runnable declared in the script, without running the script
+
+	std::vector<Value>& constants = frames.frm[0].runnable->GetChunk()->GetConstants();
+	for (int i = 0; i < constants.size(); i++) {
+		if (constants[i].IsObject() && constants[i].GetObjectValue()->IsRunnable()) {
+			RunnableValue* runnable = (RunnableValue*)constants[i].GetObjectValue();
+			if (runnable->IsMethod()) continue;  // reached through their rat
+			AddGlobal(runnable->GetName(), constants[i]);  // unless the host already set a global of that name
+		}
+	}
+}
+
+int Interpreter::CallRunnable(const std::string& name, std::vector<Value>& args) {
+	// Call a user-defined runnable from the host, and run until it returns.
+	// The return value is kept alive in ReturnValue until the next call
+
+	if (ReturnValue.IsObject()) {
+		bool deleted = ReturnValue.GetObjectValue()->DeleteReference();
+		if (deleted) RemoveObject(ReturnValue.GetObjectValue());
+	}
+	ReturnValue.SetAsNone();
+
+	uint8_t CallerFrames = frames.count;
+	uint8_t base = this->stack.count;
+
+	try {
+		if (!IsDefinedGlobal(name)) error(UNDEFINED_RAT, "Undefined rat '" + name + "' ");
+
+		Value callee = globals[name];
+		if (!callee.IsObject() || !callee.GetObjectValue()->IsRunnable()) {
+			error(TYPE_ERROR, "Can't call an object that isn't a runnable");
+		}
+
+		RunnableValue* runnable = (RunnableValue*)callee.GetObjectValue();
+		if (args.size() != runnable->GetArity()) {
+			error(TYPE_ERROR, runnable->ToString() + " called with " + std::to_string(args.size()) +
+				" arguments, but accepts " + std::to_string(runnable->GetArity()));
+		}
+
+		push(callee);
+		for (int i = 0; i < args.size(); i++) push(args[i]);
+
+		EnterRunnable(runnable);
+		while (frames.count > CallerFrames) RunCommand();
+	}
+	catch (ExitCode e) {
+		while (this->stack.count > base) pop();
+		frames.count = CallerFrames;
+		return e;
+	}
+
+	ReturnValue = peek(0);
+	if (ReturnValue.IsObject()) ReturnValue.GetObjectValue()->AddReference();
+	pop();
+
+	return INTERPRET_OK;
+}
+
+bool Interpreter::StartTask(RunnableValue* runnable, std::vector<Value>& args, std::string& ErrorMsg) {
+	// Call a spawned runnable with its arguments, which this interpreter adopts. RunTask runs the call
+
+	Value callee = Value(runnable);
+	push(callee);
+	for (size_t i = 0; i < args.size(); i++) {
+		Value arg = Adopt(args[i]);
+		push(arg);
+	}
+	args.clear();
+
+	try {
+		EnterRunnable(runnable);
+	}
+	catch (ExitCode e) {
+		ErrorMsg = "Task " + runnable->ToString() + " failed";
+		return false;
+	}
+	return true;
+}
+
+Task::Status Interpreter::RunTask(int slice, Value& result, std::string& ErrorMsg) {
+	// Run a task's call for up to 'slice' commands. A command that has to wait is undone before the task stops,
+	// and runs again from the start once the task is woken. The return value is detached for the task's future
+
+	RunnableValue* runnable = frames.count > 1 ? frames.frm[1].runnable : nullptr;
+	Task::Status status = Task::PREEMPTED;
+	this->suspendable = true;
+
+	try {
+		for (int i = 0; i < slice; i++) {
+			if (frames.count == 1) {
+				result = Detach(peek(0));
+				pop();
+				status = Task::FINISHED;
+				break;
+			}
+
+			short ip = CurrentFrame().ip;
+			RunCommand();
+
+			if (this->suspended) {
+				this->suspended = false;
+				CurrentFrame().ip = ip;
+				status = Task::BLOCKED;
+				break;
+			}
+		}
+	}
+	catch (ExitCode e) {
+		ErrorMsg = "Task " + (runnable != nullptr ? runnable->ToString() : "") + " failed";
+		status = Task::FINISHED;
+	}
+
+	this->suspendable = false;
+	return status;
+}
+
+Task* Interpreter::Waiter() {
+	return this->suspendable ? this->task : nullptr;
+}
+
+void Interpreter::Spawn(RunnableValue* runnable) {
+	// Start a call to a runnable as a task. The runnable and its arguments on top of the stack are replaced
+	// by the task's future, which 'await' turns into its return value
+
+	uint8_t arity = runnable->GetArity();
+
+	std::vector<Value> args;
+	try {
+		for (int i = arity - 1; i >= 0; i--) args.push_back(Detach(peek(i)));
+	}
+	catch (ExitCode e) {
+		for (size_t i = 0; i < args.size(); i++) FreeDetached(args[i]);
+		throw e;
+	}
+
+	if (this->group == nullptr) this->group = std::make_shared<TaskGroup>();
+
+	FutureValue* future = new FutureValue("spawn " + runnable->GetName(), true);
+	Task* spawned = new Task(frames.frm[0].runnable, this->compiler, runnable, args, future->GetState(), this->group);
+
+	for (int i = 0; i <= arity; i++) pop();  // arguments and runnable
+
+	Value v = NewObject(future);
+	push(v);
+
+	FlushOutput();	// what was printed before the spawn comes before anything the task prints
+	Scheduler::Get()->Spawn(spawned);
+}
+
+Value Interpreter::Detach(Value& v) {
+	// Copy a value for another task. Strings, lists and maps are copied with the parts they share and any cycles,
+	// and the copies belong to no interpreter until the receiving one adopts them. Long strings share their
+	// bytes with the original instead of copying them, and a channel's copy is the same channel
+
+	std::unordered_map<ObjectValue*, ObjectValue*> copies;
+	std::string ErrorMsg;
+
+	Value copy = DetachCopy(v, copies, ErrorMsg);
+	if (ErrorMsg != "") {
+		for (auto& c : copies) delete c.second;
+		error(TYPE_ERROR, ErrorMsg);
+	}
+	return copy;
+}
+
+Value Interpreter::DetachCopy(Value& v, std::unordered_map<ObjectValue*, ObjectValue*>& copies, std::string& ErrorMsg) {
+	if (!v.IsObject()) return v;
+
+	ObjectValue* o = v.GetObjectValue();
+	auto found = copies.find(o);
+	if (found != copies.end()) return Value(found->second);
+
+	switch (o->GetType()) {
+		case ObjectValue::STRING_T: {
+			if (o->IsConstant()) return v;  // a chunk's, already shared between interpreters
+
+			StrValue* s = (StrValue*)o;
+			StrValue* copy = new StrValue(*s, 0, s->GetView().size());
+			copies[o] = copy;
+			return Value(copy);
+		}
+
+		case ObjectValue::RUNNABLE_T:
+			return v;  // owned by the chunk
+
+		case ObjectValue::CHANNEL_T: {
+			ChannelValue* copy = new ChannelValue(*(ChannelValue*)o);
+			copies[o] = copy;
+			return Value(copy);
+		}
+
+		case ObjectValue::LIST_T: {
+			ListValue* list = (ListValue*)o;
+			ListValue* copy;
+
+			if (list->HoldsIntegers()) {
+				std::vector<int64_t> integers = list->GetIntegers();
+				copy = new ListValue(integers);
+			}
+			else if (list->IsUnboxed()) {
+				std::vector<double> numbers = list->GetNumbers();
+				copy = new ListValue(numbers);
+			}
+			else {
+				copy = new ListValue();
+			}
+			copies[o] = copy;  // before the elements, which may lead back to the list
+
+			std::vector<Value>& items = list->GetItems();
+			for (size_t i = 0; i < items.size(); i++) {
+				Value item = DetachCopy(items[i], copies, ErrorMsg);
+				if (ErrorMsg != "") return Value();
+
+				if (item.IsObject()) item.GetObjectValue()->AddReference();  // held by the copy
+				copy->Push(item);
+			}
+			return Value(copy);
+		}
+
+		case ObjectValue::MAP_T: {
+			MapValue* copy = new MapValue();
+			copies[o] = copy;
+
+			std::vector<MapValue::Entry>& entries = ((MapValue*)o)->GetEntries();
+			for (size_t i = 0; i < entries.size(); i++) {
+				if (entries[i].distance == 0) continue;
+
+				Value key = DetachCopy(entries[i].key, copies, ErrorMsg);
+				if (ErrorMsg != "") return Value();
+				Value value = DetachCopy(entries[i].value, copies, ErrorMsg);
+				if (ErrorMsg != "") return Value();
+
+				if (key.IsObject()) key.GetObjectValue()->AddReference();  // held by the copy
+				if (value.IsObject()) value.GetObjectValue()->AddReference();
+
+				Value old;
+				copy->Set(key, value, old);
+			}
+			return Value(copy);
+		}
+
+		default:
+			ErrorMsg = "Can't pass " + o->ToString() + " to another task";
+			return Value();
+	}
+}
+
+Value Interpreter::Adopt(Value v) {
+	// Take in a value detached from another interpreter. Its objects become this interpreter's
+	std::vector<ObjectValue*> adopted;
+	DetachedObjects(v, adopted);
+
+	for (ObjectValue* o : adopted) {
+		o->SetNext(this->objects);
+		this->objects = o;
+		o->SetMark(this->collector.cycle);  // its mark was another interpreter's
+	}
+	this->collector.count += adopted.size();
+	this->collector.allocations += adopted.size();
+	return v;
+}
+
+
+struct ParallelJob {
+	// A call to pmap or preduce. The list is split into chunks, which the calling thread and helper tasks claim
+	// one at a time. Each of them runs its chunks in an interpreter of its own
+	RunnableValue* script;
+	Compiler* compiler;
+
+	RunnableValue* runnable;	// the runnable to apply, or nullptr for the native called NativeName
+	std::string NativeName;
+	bool reduce;
+
+	std::vector<Value> chunks;	// detached, until they're claimed
+	std::vector<Value> results;	// detached, one for each chunk
+	std::atomic<size_t> next;	// the next chunk to claim
+	std::atomic<bool> failed;	// the rest of the chunks are skipped
+
+	std::mutex lock;
+	std::condition_variable finished;
+	size_t done;
+	std::string error;
+
+	ParallelJob() {
+		this->next = 0;
+		this->failed = false;
+		this->done = 0;
+	}
+
+	~ParallelJob() {
+		for (size_t i = 0; i < this->chunks.size(); i++) FreeDetached(this->chunks[i]);
+		for (size_t i = 0; i < this->results.size(); i++) FreeDetached(this->results[i]);
+	}
+
+	void Work() {
+		Interpreter* interpreter = nullptr;
+
+		for (size_t i = this->next++; i < this->chunks.size(); i = this->next++) {
+			Value result;
+			std::string ErrorMsg;
+
+			if (!this->failed) {
+				if (interpreter == nullptr) {
+					interpreter = new Interpreter(this->script, this->compiler);
+					interpreter->DefineRunnables();
+				}
+				if (!interpreter->RunChunk(this->runnable, this->NativeName, this->chunks[i], this->reduce, result, ErrorMsg)) {
+					this->failed = true;
+				}
+			}
+
+			std::lock_guard<std::mutex> guard(this->lock);
+			this->results[i] = result;
+			if (ErrorMsg != "" && this->error == "") this->error = ErrorMsg;
+			this->done++;
+			this->finished.notify_all();
+		}
+
+		delete interpreter;  // flushes what its chunks printed
+	}
+
+	void Wait() {
+		std::unique_lock<std::mutex> guard(this->lock);
+		this->finished.wait(guard, [this] { return this->done == this->chunks.size(); });
+	}
+};
+
+void Interpreter::RunParallel(ListValue* list, Value& f, bool reduce, const std::string& native, std::vector<Value>& results) {
+	// Split the list into chunks and run them in parallel, on this thread and on helper tasks.
+	// There are a few chunks for each worker, so that a worker that finishes early can take more of them.
+	// The results are detached, one for each chunk, in order
+
+	std::shared_ptr<ParallelJob> job = std::make_shared<ParallelJob>();
+	job->script = frames.frm[0].runnable;
+	job->compiler = this->compiler;
+	job->runnable = nullptr;
+	job->reduce = reduce;
+
+	uint8_t arity = reduce ? 2 : 1;
+	ObjectValue* o = f.IsObject() ? f.GetObjectValue() : nullptr;
+	if (o != nullptr && o->IsRunnable() && ((RunnableValue*)o)->GetArity() == arity) {
+		job->runnable = (RunnableValue*)o;
+	}
+	else if (o != nullptr && o->IsNative() && ((NativeValue*)o)->GetArity() - ((NativeValue*)o)->GetOptional() <= arity
+		&& ((NativeValue*)o)->GetArity() >= arity) {
+		job->NativeName = ((NativeValue*)o)->GetName();  // every interpreter has its own natives, found by name
+	}
+	else {
+		error(TYPE_ERROR, "Second argument to '" + native + "' must be a runnable of " + std::to_string(arity) +
+			(arity == 1 ? " argument" : " arguments"));
+	}
+
+	size_t size = list->Size();
+	if (size == 0) return;
+
+	static const size_t ChunksPerWorker = 4;
+	size_t workers = Scheduler::Get()->Workers();
+	size_t count = std::min(size, workers * ChunksPerWorker);
+
+	for (size_t i = 0; i < count; i++) job->chunks.push_back(DetachSlice(list, size * i / count, size * (i + 1) / count));
+	job->results.resize(count);
+
+	if (this->group == nullptr) this->group = std::make_shared<TaskGroup>();
+
+	FlushOutput();	// what was printed before comes before anything the chunks print
+
+	size_t helpers = std::min(count - 1, workers);
+	for (size_t i = 0; i < helpers; i++) Scheduler::Get()->Spawn(new Task([job] { job->Work(); }, this->group));
+
+	job->Work();
+	job->Wait();
+
+	if (job->error != "") error(TASK_ERROR, job->error + " in '" + native + "'");
+	results.swap(job->results);
+}
+
+Value Interpreter::DetachSlice(ListValue* list, size_t start, size_t end) {
+	// Elements start to end of a list, as a detached list
+	if (list->HoldsIntegers()) {
+		std::vector<int64_t> integers(list->GetIntegers().begin() + start, list->GetIntegers().begin() + end);
+		return Value(new ListValue(integers));
+	}
+	if (list->IsUnboxed()) {
+		std::vector<double> numbers(list->GetNumbers().begin() + start, list->GetNumbers().begin() + end);
+		return Value(new ListValue(numbers));
+	}
+
+	ListValue* slice = new ListValue();
+	Value v = Value(slice);
+	for (size_t i = start; i < end; i++) {
+		Value item = list->GetItems()[i];
+		if (item.IsObject()) item.GetObjectValue()->AddReference();  // held by the slice, which is only copied
+		slice->Push(item);
+	}
+
+	// The slice holds this interpreter's objects only while it's copied
+	std::unordered_map<ObjectValue*, ObjectValue*> copies;
+	std::string ErrorMsg;
+	Value copy = DetachCopy(v, copies, ErrorMsg);
+
+	for (size_t i = 0; i < slice->GetItems().size(); i++) {
+		Value item = slice->GetItems()[i];
+		if (item.IsObject()) item.GetObjectValue()->DeleteReference();
+	}
+	delete slice;
+
+	if (ErrorMsg != "") {
+		for (auto& c : copies) delete c.second;
+		error(TYPE_ERROR, ErrorMsg);
+	}
+	return copy;
+}
+
+void Interpreter::CheckPure() {
+	// Every chunk of a pmap or preduce runs in an interpreter of its own, so an assignment to a global
+	// would be lost, and the result would depend on how the list was split
+	uint8_t* code = CurrentChunk()->GetCode().data() + CurrentFrame().ip;
+
+	switch (code[0]) {
+		case OP_DEFINE_GLOBAL:
+		case OP_SET_GLOBAL:
+		case OP_INC_GLOBAL:
+		case OP_DEC_GLOBAL:
+		case OP_ADD_ASSIGN_GLOBAL:
+		case OP_SUB_ASSIGN_GLOBAL:
+		case OP_MULTIPLY_ASSIGN_GLOBAL:
+		case OP_DIVIDE_ASSIGN_GLOBAL:
+		case OP_BIT_AND_ASSIGN_GLOBAL:
+		case OP_BIT_OR_ASSIGN_GLOBAL:
+		case OP_BIT_XOR_ASSIGN_GLOBAL:
+		case OP_SHIFTL_ASSIGN_GLOBAL:
+		case OP_SHIFTR_ASSIGN_GLOBAL:
+		case OP_FOR_ITER_GLOBAL:
+		case OP_RANGE_GLOBAL:
+		case OP_RANGE_STEP_GLOBAL:
+			error(IMPURE_RUNNABLE, "A runnable run in parallel can't assign to the global '" + GetConstantStr(code[1]) + "'");
+
+		default: break;
+	}
+}
+
+bool Interpreter::RunChunk(RunnableValue* runnable, const std::string& NativeName, Value& chunk, bool reduce,
+	Value& result, std::string& ErrorMsg) {
+	// Apply a pmap or preduce runnable to a chunk of the list, detached from the calling interpreter.
+	// A map gives the list of results, and a reduce folds the chunk from its first element
+
+	Value items = Adopt(chunk);
+	chunk.SetAsNone();
+	push(items);  // keeps the chunk alive
+
+	ListValue* list = (ListValue*)items.GetObjectValue();
+	this->pure = true;
+
+	try {
+		Value f = Value(runnable);
+		if (runnable == nullptr) GetGlobal(NativeName, f);
+
+		if (!reduce) {
+			Value mapped = NewObject(new ListValue());
+			push(mapped);
+
+			for (size_t i = 0; i < list->Size(); i++) {
+				Value item = list->Get(i);
+				CallWithArguments(f, &item, 1);
+
+				Value v = peek(0);
+				if (v.IsObject()) v.GetObjectValue()->AddReference();  // held by the list
+				((ListValue*)mapped.GetObjectValue())->Push(v);
+				pop();
+			}
+		}
+		else {
+			Value first = list->Get(0);
+			push(first);	// the accumulator stays on top of the stack
+
+			for (size_t i = 1; i < list->Size(); i++) {
+				Value args[2] = { peek(0), list->Get(i) };
+				CallWithArguments(f, args, 2);
+
+				Value acc = peek(0);
+				if (acc.IsObject()) acc.GetObjectValue()->AddReference();  // keep it alive while the old one is popped
+				pop();
+				pop();
+				push(acc);
+				if (acc.IsObject()) acc.GetObjectValue()->DeleteReference();
+			}
+		}
+
+		result = Detach(peek(0));
+	}
+	catch (ExitCode e) {
+		ErrorMsg = (runnable != nullptr ? runnable->ToString() : "'" + NativeName + "'") + " failed";
+		frames.count = 1;
+	}
+
+	while (this->stack.count > 0) pop();
+	this->pure = false;
+	return ErrorMsg == "";
+}
+
+
+Value Interpreter::GetReturnValue() {
+	return this->ReturnValue;
+}
+
+Value Interpreter::NewString(const std::string& s) {
+	return NewObject(s);
+}
+
+void Interpreter::SetGlobal(const std::string& name, Value value) {
+	// Define or overwrite a global from the host
+
+	if (IsDefinedGlobal(name)) {
+		Value& old = globals[name];
+		if (old.IsObject() && old.GetObjectValue()->DeleteReference()) RemoveObject(old.GetObjectValue());
+
+		globals[name] = value;
+		if (value.IsObject()) value.GetObjectValue()->AddReference();
+	}
+	else {
+		AddGlobal(name, value);
+	}
+}
+
+bool Interpreter::GetGlobal(const std::string& name, Value& value) {
+	if (!IsDefinedGlobal(name)) return false;
+
+	value = globals[name];
+	return true;
+}
+
+
+Interpreter::CallFrame& Interpreter::CurrentFrame() {
+	return frames.frm[frames.count - 1];
+}
+
+Chunk* Interpreter::CurrentChunk() {
+	return CurrentFrame().runnable->GetChunk();
+}
+
+Interpreter::FieldCache& Interpreter::ReadCache() {
+	// Read a field access's two-byte cache slot, and return the cache. Slots are handed out as runnables are compiled,
+	// so the caches grow as new ones show up
+	uint16_t slot = ReadByte() << 8;
+	slot |= ReadByte();
+
+	if (slot >= this->caches.size()) this->caches.resize(slot + 1, FieldCache());
+	return this->caches[slot];
+}
+
+uint8_t Interpreter::ReadByte() {
+	CallFrame& frame = CurrentFrame();
+	return frame.runnable->GetChunk()->GetCode()[frame.ip++];
+}
+
+bool Interpreter::IsAtEnd() {
+	return CurrentFrame().ip >= CurrentChunk()->GetSize();
+}
+
+
+Value& Interpreter::pop() {
+	// Pop value from the vm stack
+	if (this->stack.count <= 0) {
+		error(STACK_UNDERFLOW, "Popping from empty stack");
+	}
+
+	stack.count--;
+
+	Value i = stack.stk[stack.count];
+
+	if (i.IsObject()) {
+		// Delete reference to object
+		bool deleted = i.GetObjectValue()->DeleteReference();
+		if (deleted) {
+			RemoveObject(i.GetObjectValue());
+			stack.stk[stack.count].SetValue(nullptr);
+		}
+	}
+
+	return stack.stk[stack.count];
+}
+
+template <typename F>
+static void ForEachChild(ObjectValue* o, F visit) {
+	// Call visit on every value that o holds a reference to
+	switch (o->GetType()) {
+		case ObjectValue::FUTURE_T: {
+			// An awaited future keeps its result alive
+			Value result = ((FutureValue*)o)->GetResult();
+			visit(result);
+			break;
+		}
+
+		case ObjectValue::LIST_T: {
+			std::vector<Value>& items = ((ListValue*)o)->GetItems();
+			for (size_t i = 0; i < items.size(); i++) visit(items[i]);
+			break;
+		}
+
+		case ObjectValue::MAP_T: {
+			std::vector<MapValue::Entry>& entries = ((MapValue*)o)->GetEntries();
+			for (size_t i = 0; i < entries.size(); i++) {
+				if (entries[i].distance == 0) continue;
+				visit(entries[i].key);
+				visit(entries[i].value);
+			}
+			break;
+		}
+
+		case ObjectValue::ITERATOR_T: {
+			Value container = Value(((IteratorValue*)o)->GetContainer());
+			visit(container);
+			break;
+		}
+
+		case ObjectValue::INSTANCE_T: {
+			std::vector<Value>& fields = ((InstanceValue*)o)->GetFields();
+			for (size_t i = 0; i < fields.size(); i++) visit(fields[i]);
+
+			Value klass = Value(((InstanceValue*)o)->GetClass());
+			visit(klass);
+			break;
+		}
+
+		case ObjectValue::GENERATOR_T: {
+			std::vector<Value>& slots = ((GeneratorValue*)o)->GetSlots();
+			for (size_t i = 0; i < slots.size(); i++) visit(slots[i]);
+
+			if (((GeneratorValue*)o)->GetFuture() != nullptr) {
+				Value future = Value(((GeneratorValue*)o)->GetFuture());
+				visit(future);
+			}
+			break;
+		}
+
+		default: break;
+	}
+}
+
+void Interpreter::RemoveObject(ObjectValue* o) {
+	// Remove the object form the linked list and free it's memory
+	if (o == nullptr) return;
+
+	ForEachChild(o, [this](Value& v) { Release(v); });
+
+	if (o->IsClass()) {
+		// The rat's shapes are freed with it, and a new shape could be allocated where one of them was
+		this->caches.clear();
+	}
+
+	this->collector.count--;
+
+	if (this->objects == o) {
+		this->objects = o->GetNext();
+
+#ifdef DEBUG_GC_INFO
 		std::cout << "[Garbage collector] Deallocated '" + o->ToString() + "'\n";
 #endif
 		delete o;
@@ -1150,6 +3501,7 @@ void Interpreter::RemoveObject(ObjectValue* o) {
 	if (curr != nullptr) {
 		curr->SetNext(curr->GetNext()->GetNext());
 	}
+	if (this->collector.SweepPrev == o) this->collector.SweepPrev = curr;  // the sweep goes on from its predecessor
 	
 #ifdef DEBUG_GC_INFO
 	std::cout << "[Garbage collector] Deallocated '" + o->ToString() + "'\n";
@@ -1158,6 +3510,183 @@ void Interpreter::RemoveObject(ObjectValue* o) {
 	delete o;
 }
 
+void Interpreter::Shade(Value& v) {
+	// Mark an object reachable by the current cycle. One that holds references is left for a step to scan,
+	// and the reference it holds until then keeps it from being freed in the meantime
+	if (!v.IsObject()) return;
+
+	ObjectValue* o = v.GetObjectValue();
+	if (o->IsConstant() || o->GetMark() == this->collector.cycle) return;
+	o->SetMark(this->collector.cycle);
+
+	switch (o->GetType()) {
+		case ObjectValue::FUTURE_T:
+		case ObjectValue::LIST_T:
+		case ObjectValue::MAP_T:
+		case ObjectValue::ITERATOR_T:
+		case ObjectValue::INSTANCE_T:
+		case ObjectValue::GENERATOR_T:
+			o->AddReference();
+			this->collector.gray.push_back(o);
+			break;
+
+		default: break;
+	}
+}
+
+void Interpreter::ScanRoots() {
+	// Shade everything the script can reach directly: the stack, the globals, the generators of running frames
+	// and the async calls waiting to run
+	for (int i = 0; i < this->stack.count; i++) Shade(this->stack.stk[i]);
+	for (auto& global : this->globals) Shade(global.second);
+	Shade(this->ReturnValue);
+
+	for (int i = 0; i < this->frames.count; i++) {
+		if (this->frames.frm[i].generator == nullptr) continue;
+		Value generator = Value(this->frames.frm[i].generator);
+		Shade(generator);
+	}
+
+	for (GeneratorValue* coroutine : this->ready) {
+		Value v = Value(coroutine);
+		Shade(v);
+	}
+	for (GeneratorValue* coroutine : this->waiting) {
+		Value v = Value(coroutine);
+		Shade(v);
+	}
+}
+
+void Interpreter::CollectStep() {
+	// Do a bounded amount of the collector's work, and time it as a pause of the script
+	auto start = std::chrono::steady_clock::now();
+	this->collector.StepAt = this->collector.allocations + CollectPace;
+
+	switch (this->collector.phase) {
+		case COLLECT_IDLE: {
+			if (this->collector.count < this->collector.threshold) return;  // not a pause, nothing was done
+
+			// Start a cycle. Bumping the mark leaves every object unmarked, without visiting them
+			this->collector.cycle++;
+			this->collector.phase = COLLECT_MARK;
+			ScanRoots();
+			break;
+		}
+
+		case COLLECT_MARK: {
+			for (size_t work = 0; work < CollectWork && !this->collector.gray.empty(); work++) {
+				ObjectValue* o = this->collector.gray.back();
+				this->collector.gray.pop_back();
+				ForEachChild(o, [this](Value& v) { Shade(v); });
+
+				// The script may have dropped every other reference while it was waiting to be scanned
+				if (o->DeleteReference()) RemoveObject(o);
+			}
+
+			// Stores shade what they drop, so once nothing is left to scan, whatever is unmarked was unreachable
+			// when the cycle started, and nothing made since could have reached it
+			if (this->collector.gray.empty()) {
+				this->collector.phase = COLLECT_SWEEP;
+				this->collector.SweepPrev = nullptr;
+			}
+			break;
+		}
+
+		case COLLECT_SWEEP: {
+			// Unlink the unmarked objects, and drop the references they hold to marked ones. Those they hold
+			// to each other are never dropped, since they're all freed together
+			for (size_t work = 0; work < CollectWork; work++) {
+				ObjectValue* prev = this->collector.SweepPrev;
+				ObjectValue* o = (prev == nullptr) ? this->objects : prev->GetNext();
+				if (o == nullptr) {
+					this->collector.phase = COLLECT_FREE;
+					break;
+				}
+
+				if (o->IsConstant() || o->GetMark() == this->collector.cycle) {
+					this->collector.SweepPrev = o;
+					continue;
+				}
+
+				if (prev == nullptr) this->objects = o->GetNext();
+				else prev->SetNext(o->GetNext());
+				this->collector.count--;
+				this->collector.dead.push_back(o);
+
+				unsigned cycle = this->collector.cycle;
+				ForEachChild(o, [this, cycle](Value& v) {
+					if (v.IsObject() && v.GetObjectValue()->GetMark() == cycle) Release(v);
+				});
+			}
+			break;
+		}
+
+		case COLLECT_FREE: {
+			std::vector<ObjectValue*>& dead = this->collector.dead;
+			size_t start = dead.size() > CollectWork ? dead.size() - CollectWork : 0;
+			for (size_t i = start; i < dead.size(); i++) {
+				if (dead[i]->IsClass()) this->caches.clear();
+
+#ifdef DEBUG_GC_INFO
+				std::cout << "[Garbage collector] Collected '" + dead[i]->ToString() + "'\n";
+#endif
+				delete dead[i];
+			}
+			this->collector.collected += dead.size() - start;
+			dead.resize(start);
+
+			if (dead.empty()) {
+				this->collector.phase = COLLECT_IDLE;
+				this->collector.cycles++;
+				this->collector.threshold = 2 * this->collector.count;  // the next cycle waits for the heap to double
+				if (this->collector.threshold < MinCollectHeap) this->collector.threshold = MinCollectHeap;
+			}
+			break;
+		}
+	}
+
+	std::chrono::duration<double, std::milli> pause = std::chrono::steady_clock::now() - start;
+	this->collector.pauses.push_back(pause.count());
+}
+
+
+
+void Interpreter::ConcatAssign(Value* va) {
+	// The string case of '+=': appends the string on top of the stack to the variable va
+	std::string ErrorMsg = "Can only perform this operation on two numbers or two strings";
+
+	Value v = peek(0);  // don't want to remove reference yet
+	StrValue* b = ExtractStrValue(&v, ErrorMsg);
+	StrValue* a = ExtractStrValue(va, ErrorMsg);
+
+	if (!a->IsShared()) {
+		// Only the variable holds a, so it can grow in place. The string's capacity grows geometrically,
+		// so building a string piece by piece in a loop costs amortized O(1) per piece
+		a->Append(b->GetView());
+
+		pop(); // remove reference to v
+		push(*va);
+		return;
+	}
+
+	// a may be held by other variables or containers, or be a constant of a chunk used by
+	// several contexts, so build a new string rather than mutating it
+	Value res = NewObject(*a + *b);
+
+	pop(); // remove reference to v
+	if (a->DeleteReference()) RemoveObject(a);
+
+	*va = res;
+	res.GetObjectValue()->AddReference();
+	push(res);
+}
+
+void Interpreter::Release(Value& v) {
+	// Drop a reference that something other than the stack held, freeing the object if it was the last one.
+	// While marking, the value may have been reachable only through that reference, so it's shaded first
+	if (this->collector.phase == COLLECT_MARK) Shade(v);
+	if (v.IsObject() && v.GetObjectValue()->DeleteReference()) RemoveObject(v.GetObjectValue());
+}
 
 
 void Interpreter::push(Value& value) {
@@ -1189,9 +3718,349 @@ StrValue* Interpreter::ExtractStrValue(Value* v, const std::string& ErrorMsg) {
 	return (StrValue*)o;
 }
 
+void Interpreter::SortList(ListValue* list) {
+	// Sort the elements themselves. An unboxed list is sorted in its own buffer
+
+	if (list->IsUnboxed()) {
+		if (list->HoldsIntegers()) Sort::Numbers(list->GetIntegers());
+		else Sort::Numbers(list->GetNumbers());
+		return;
+	}
+
+	std::vector<Value>& items = list->GetItems();
+
+	bool numbers = true, strings = true;
+	for (size_t i = 0; i < items.size(); i++) {
+		numbers = numbers && items[i].IsNumber();
+		strings = strings && items[i].IsObject() && items[i].GetObjectValue()->IsString();
+	}
+
+	if (numbers) {
+		// Integers mixed with doubles, or the list would be unboxed. Each element keeps its type
+		std::vector<Sort::NumberKey> keys(items.size());
+		for (size_t i = 0; i < items.size(); i++) keys[i] = Sort::NumberKey(items[i].GetNum(), i);
+
+		Sort::Numbers(keys);
+
+		std::vector<Value> sorted;
+		sorted.reserve(items.size());
+		for (size_t i = 0; i < keys.size(); i++) sorted.push_back(items[keys[i].index]);
+		items.swap(sorted);
+	}
+	else if (strings) {
+		std::vector<Sort::StringKey> keys;
+		keys.reserve(items.size());
+		for (size_t i = 0; i < items.size(); i++) keys.emplace_back(((StrValue*)items[i].GetObjectValue())->GetView(), i);
+
+		Sort::Strings(keys);
+
+		// Only the order changes, so the list keeps the same references
+		std::vector<Value> sorted;
+		sorted.reserve(items.size());
+		for (size_t i = 0; i < keys.size(); i++) sorted.push_back(items[keys[i].index]);
+		items.swap(sorted);
+	}
+	else error(TYPE_ERROR, "Can only sort a list of numbers or a list of strings");
+}
+
+void Interpreter::SortListByKey(ListValue* list, Value& key) {
+	// Call the key runnable once for each element, then sort the elements by their keys.
+	// The elements and keys are held while the runnable runs, since it may change the list
+
+	size_t size = list->Size();
+	std::vector<Value> elements(size), keys(size);
+
+	for (size_t i = 0; i < size; i++) {
+		elements[i] = list->Get(i);
+		if (elements[i].IsObject()) elements[i].GetObjectValue()->AddReference();
+	}
+
+	for (size_t i = 0; i < size; i++) {
+		CallWithArguments(key, &elements[i], 1);
+		keys[i] = peek(0);
+		if (keys[i].IsObject()) keys[i].GetObjectValue()->AddReference();
+		pop();
+	}
+
+	bool numbers = true, integers = true, strings = true;
+	for (size_t i = 0; i < size; i++) {
+		numbers = numbers && keys[i].IsNumber();
+		integers = integers && keys[i].IsInt();
+		strings = strings && keys[i].IsObject() && keys[i].GetObjectValue()->IsString();
+	}
+
+	std::vector<uint32_t> order(size);
+	if (numbers) {
+		std::vector<Sort::NumberKey> sorted(size);
+		for (size_t i = 0; i < size; i++) {
+			if (integers) sorted[i] = Sort::NumberKey(keys[i].GetInt(), i);
+			else sorted[i] = Sort::NumberKey(keys[i].GetNum(), i);
+		}
+
+		Sort::Numbers(sorted);
+		for (size_t i = 0; i < size; i++) order[i] = sorted[i].index;
+	}
+	else if (strings) {
+		std::vector<Sort::StringKey> sorted;
+		sorted.reserve(size);
+		for (size_t i = 0; i < size; i++) sorted.emplace_back(((StrValue*)keys[i].GetObjectValue())->GetView(), i);
+
+		Sort::Strings(sorted);
+		for (size_t i = 0; i < size; i++) order[i] = sorted[i].index;
+	}
+
+	bool resized = list->Size() != size;
+	if (!resized && (numbers || strings)) {
+		for (size_t i = 0; i < size; i++) {
+			Value v = elements[order[i]];
+			if (v.IsObject()) v.GetObjectValue()->AddReference();  // held by the list
+
+			Value old = list->Set(i, v);
+			Release(old);
+		}
+	}
+
+	for (size_t i = 0; i < size; i++) {
+		Release(elements[i]);
+		Release(keys[i]);
+	}
+
+	if (resized) error(INDEX_ERROR, "The list changed size while its keys were computed");
+	if (!numbers && !strings) error(TYPE_ERROR, "Keys to sort by must all be numbers or all be strings");
+}
+
+const double* Interpreter::NumericList::Doubles() {
+	if (this->whole) {
+		this->scratch.assign(this->integers, this->integers + this->size);
+		this->numbers = this->scratch.data();
+	}
+	return this->numbers;
+}
+
+void Interpreter::NumericData(Value& v, const std::string& native, NumericList& out) {
+	// The numbers of a list passed to a vector native. An unboxed list is read in place,
+	// a boxed one is copied into scratch if it holds nothing but numbers
+	ListValue* list = ExtractListValue(&v, "Arguments to '" + native + "' must be lists of numbers");
+	out.size = list->Size();
+	out.integers = nullptr;
+	out.numbers = nullptr;
+	out.whole = list->HoldsIntegers();
+
+	if (list->IsUnboxed()) {
+		if (out.whole) out.integers = list->GetIntegers().data();
+		else out.numbers = list->GetNumbers().data();
+		return;
+	}
+
+	std::vector<Value>& items = list->GetItems();
+	bool integers = true;
+	for (size_t i = 0; i < items.size(); i++) {
+		if (!items[i].IsNumber()) error(TYPE_ERROR, "Arguments to '" + native + "' must be lists of numbers");
+		integers = integers && items[i].IsInt();
+	}
+
+	out.whole = integers;
+	if (integers) {
+		out.IntScratch.resize(items.size());
+		for (size_t i = 0; i < items.size(); i++) out.IntScratch[i] = items[i].GetInt();
+		out.integers = out.IntScratch.data();
+	}
+	else {
+		out.scratch.resize(items.size());
+		for (size_t i = 0; i < items.size(); i++) out.scratch[i] = items[i].GetNum();
+		out.numbers = out.scratch.data();
+	}
+}
+
+void Interpreter::VectorBinary(const std::string& native, void (*op)(const double*, const double*, double*, size_t),
+	void (*IntOp)(const int64_t*, const int64_t*, int64_t*, size_t)) {
+	// Shared by the element-wise natives on two lists of numbers, which return a new list.
+	// Two lists of integers give a list of integers, a double anywhere gives a list of doubles
+
+	Value b = peek(0);
+	Value a = peek(1);
+
+	NumericList x, y;
+	NumericData(a, native, x);
+	NumericData(b, native, y);
+	if (x.size != y.size) error(INDEX_ERROR, "Lists passed to '" + native + "' must have the same size");
+
+	Value t;
+	if (x.whole && y.whole) {
+		std::vector<int64_t> result(x.size);
+		IntOp(x.integers, y.integers, result.data(), x.size);
+		t = NewObject(new ListValue(result));
+	}
+	else {
+		std::vector<double> result(x.size);
+		op(x.Doubles(), y.Doubles(), result.data(), x.size);
+		t = NewObject(new ListValue(result));
+	}
+
+	pop();
+	pop();
+	push(t);
+}
+
+bool Interpreter::IteratorNext(Value& iterator, Value* var, Value& next) {
+	// Advance an iterator made by OP_GET_ITER. Returns false once it's exhausted.
+	// When nothing else holds the loop variable's previous line, it's overwritten instead of making a new string
 
-std::string Interpreter::GetConstantStr(uint8_t index) {
-	// Get the string at index 'index' in the chunks constants table
+	if (!iterator.IsObject()) error(INTERNAL_ERROR, "Can't iterate over " + iterator.ToString() + ", expected an iterator");
+
+	if (iterator.GetObjectValue()->GetType() == ObjectValue::ITERATOR_T) {
+		return ((IteratorValue*)iterator.GetObjectValue())->Next(next);
+	}
+
+	if (iterator.GetObjectValue()->IsGenerator()) {
+		if (!Resume((GeneratorValue*)iterator.GetObjectValue())) return false;
+
+		next = peek(0);
+		if (next.IsObject()) next.GetObjectValue()->AddReference();
+		pop();
+		if (next.IsObject()) next.GetObjectValue()->DeleteReference();  // the loop variable takes it next
+		return true;
+	}
+
+	if (!iterator.GetObjectValue()->IsFile()) {
+		error(INTERNAL_ERROR, "Can't iterate over " + iterator.ToString() + ", expected an iterator");
+	}
+	FileValue* file = (FileValue*)iterator.GetObjectValue();
+
+	bool eof;
+	if (!file->ReadLine(this->NextLine, eof)) error(INTERNAL_ERROR, "Error reading from " + file->ToString());
+	if (eof) return false;  // the loop variable keeps the last line
+
+	if (var != nullptr && var->IsObject() && var->GetObjectValue()->IsString() && !var->GetObjectValue()->IsShared()) {
+		((StrValue*)var->GetObjectValue())->Swap(this->NextLine);
+		next = *var;
+		return true;
+	}
+
+	StrValue* line = new StrValue("");
+	line->Swap(this->NextLine);
+	next = NewObject(line);
+	return true;
+}
+
+void Interpreter::StoreLoopVariable(Value* var, Value& next) {
+	// Replace a loop variable's value, releasing the previous one
+	if (var->IsObject()) {
+		ObjectValue* o = var->GetObjectValue();
+		if (o->DeleteReference()) RemoveObject(o);
+	}
+
+	*var = next;
+	if (next.IsObject()) next.GetObjectValue()->AddReference();
+}
+
+Value* Interpreter::RangeVariable(bool local, uint8_t index) {
+	// The variable of a loop over a range. A global is defined when the loop starts, if it wasn't already
+	if (local) return &this->stack.stk[CurrentFrame().FrameStart + index + 1];
+
+	std::string& identifier = GetConstantStr(index);
+	auto global = this->globals.find(identifier);
+	if (global == this->globals.end()) {
+		AddGlobal(identifier, Value());
+		return &this->globals[identifier];
+	}
+
+	Value* var = &global->second;
+	if (var->IsObject() && (var->GetObjectValue()->IsRunnable() || var->GetObjectValue()->IsNative())) {
+		error(TYPE_ERROR, "Can't use the runnable '" + identifier + "' as a loop variable");
+	}
+	return var;
+}
+
+FileValue* Interpreter::ExtractFileValue(Value* v, const std::string& ErrorMsg) {
+	// Return the FileValue that v holds, if it's still open.
+	// Otherwise, raise an error
+
+	if (v->GetType() != Value::OBJECT_T) error(TYPE_ERROR, ErrorMsg);
+
+	ObjectValue* o = v->GetObjectValue();
+
+	if (o->GetType() != ObjectValue::FILE_T || !((FileValue*)o)->IsOpen()) error(TYPE_ERROR, ErrorMsg);
+	return (FileValue*)o;
+}
+
+ListValue* Interpreter::ExtractListValue(Value* v, const std::string& ErrorMsg) {
+	// Return the ListValue that v holds, if it does.
+	// If v is not a ListValue, raise an error
+
+	if (v->GetType() != Value::OBJECT_T) error(TYPE_ERROR, ErrorMsg);
+
+	ObjectValue* o = v->GetObjectValue();
+
+	if (o->GetType() != ObjectValue::LIST_T) error(TYPE_ERROR, ErrorMsg);
+	return (ListValue*)o;
+}
+
+ChannelValue* Interpreter::ExtractChannelValue(Value* v, const std::string& ErrorMsg) {
+	// Return the ChannelValue that v holds, if it does.
+	// If v is not a ChannelValue, raise an error
+
+	if (v->GetType() != Value::OBJECT_T) error(TYPE_ERROR, ErrorMsg);
+
+	ObjectValue* o = v->GetObjectValue();
+
+	if (o->GetType() != ObjectValue::CHANNEL_T) error(TYPE_ERROR, ErrorMsg);
+	return (ChannelValue*)o;
+}
+
+size_t Interpreter::ListIndex(ListValue* list, Value& index) {
+	// Check that index is a whole number within the list's bounds, and return it
+	if (!IsIntegerValue(index)) error(TYPE_ERROR, "List index must be a whole number");
+
+	int64_t i = GetIntValue(index);
+	if (i < 0 || (size_t)i >= list->Size()) {
+		error(INDEX_ERROR, "List index " + index.ToString() + " is out of range for a list of size " +
+			std::to_string(list->Size()));
+	}
+	return (size_t)i;
+}
+
+MapValue* Interpreter::ExtractMapValue(Value* v, const std::string& ErrorMsg) {
+	// Return the MapValue that v holds, if it does.
+	// If v is not a MapValue, raise an error
+
+	if (v->GetType() != Value::OBJECT_T) error(TYPE_ERROR, ErrorMsg);
+
+	ObjectValue* o = v->GetObjectValue();
+
+	if (o->GetType() != ObjectValue::MAP_T) error(TYPE_ERROR, ErrorMsg);
+	return (MapValue*)o;
+}
+
+InstanceValue* Interpreter::ExtractInstanceValue(Value* v, const std::string& ErrorMsg) {
+	// Return the InstanceValue that v holds, if it does.
+	// If v is not an InstanceValue, raise an error
+
+	if (v->GetType() != Value::OBJECT_T) error(TYPE_ERROR, ErrorMsg);
+
+	ObjectValue* o = v->GetObjectValue();
+
+	if (o->GetType() != ObjectValue::INSTANCE_T) error(TYPE_ERROR, ErrorMsg);
+	return (InstanceValue*)o;
+}
+
+void Interpreter::CheckKey(Value& key) {
+	if (!MapValue::IsHashable(key)) error(TYPE_ERROR, "Map keys must be numbers, booleans or strings");
+}
+
+void Interpreter::MapStore(MapValue* map, Value& key, Value& value) {
+	// Set a key in a map, moving references: the map holds the key and the new value, and lets go of the old value
+	if (value.IsObject()) value.GetObjectValue()->AddReference();
+
+	Value old;
+	if (map->Set(key, value, old)) Release(old);
+	else if (key.IsObject()) key.GetObjectValue()->AddReference();
+}
+
+
+std::string& Interpreter::GetConstantStr(uint8_t index) {
+	// Get the string at index 'index' in the chunks constants table.
+	// Constants live as long as their chunk, so this refers to the constant itself rather than copying it
 
 	Value v = CurrentChunk()->ReadConstant(index);
 	StrValue* s = (StrValue *)v.GetObjectValue();
@@ -1204,7 +4073,7 @@ bool Interpreter::GetConstantBool(uint8_t index) {
 	return v.GetBool();
 }
 
-float Interpreter::GetConstantNum(uint8_t index) {
+double Interpreter::GetConstantNum(uint8_t index) {
 	// Get the number at index 'index' in the chunks constants table
 	Value v = CurrentChunk()->ReadConstant(index);
 	return v.GetNum();
@@ -1212,21 +4081,33 @@ float Interpreter::GetConstantNum(uint8_t index) {
 
 
 Value *Interpreter::FindLocal() {
-	uint8_t FrameSlot = CurrentChunk()->advance();
-	return &(this->stack.stk[this->body->GetFrameStart() + FrameSlot + 1]);
+	uint8_t FrameSlot = ReadByte();
+	return &(this->stack.stk[CurrentFrame().FrameStart + FrameSlot + 1]);
 }
 
 Value *Interpreter::FindGlobal() {
-	uint8_t IdIndex = CurrentChunk()->advance();
-	std::string identifier = GetConstantStr(IdIndex);
+	uint8_t IdIndex = ReadByte();
+	std::string& identifier = GetConstantStr(IdIndex);
 
-	if (IsDefinedGlobal(identifier)) return &(this->globals[identifier]);
+	auto global = this->globals.find(identifier);
+	if (global != this->globals.end()) return &global->second;
 
 	error(UNDEFINED_RAT, "Undefined rat '" + identifier + "' ");
 }
 
 void Interpreter::AddGlobal(const std::string& name, Value value) {
-	this->globals.insert({ name, value });
+	// A global the script defines shadows a native of the same name, so adding natives never breaks a script.
+	// Any other global that already exists keeps its value
+	auto existing = this->globals.find(name);
+	if (existing != this->globals.end()) {
+		Value& old = existing->second;
+		if (!old.IsObject() || !old.GetObjectValue()->IsNative()) return;
+
+		Release(old);
+		old = value;
+	}
+	else this->globals.insert({ name, value });
+
 	if (value.IsObject()) {
 		value.GetObjectValue()->AddReference();
 	}
@@ -1249,15 +4130,22 @@ std::string Interpreter::TraceStack(int CodeOffset) {
 }
 
 void Interpreter::error(ExitCode e, const std::string& msg) {
-	int line = CurrentChunk()->CountLines(false);
+	RunnableValue* body = CurrentFrame().runnable;
+	int line = CurrentChunk()->CountLines(CurrentFrame().ip);
 	std::string bodyname = "<Script>";
 
-	if (body->GetEnclosing()) { // in a runnable
-		RunnableValue* script = body->GetEnclosing();
+	if (frames.count > 1) { // in a runnable
+		RunnableValue* script = frames.frm[0].runnable;
 		line += script->GetChunk()->CountLines(body->ToString());
 		bodyname = body->ToString();
 	}
 
-	std::cerr << "[Runtime error in " + bodyname + " in line " << line << "]: " << msg << "\n";
+	FlushOutput();  // keep the error after everything the script printed
+
+	static std::mutex ErrorLock;	// chunks of pmap and preduce, and tasks, can fail at the same time
+	{
+		std::lock_guard<std::mutex> guard(ErrorLock);
+		std::cerr << "[Runtime error in " + bodyname + " in line " << line << "]: " << msg << "\n";
+	}
 	throw e;
 }
\ No newline at end of file
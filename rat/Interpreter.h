@@ -3,9 +3,14 @@
 #include <iomanip>
 #include <unordered_map>
 #include <stack>
+#include <deque>
 
 #include "Chunk.h"
 #include "Value.h"
+#include "Scheduler.h"
+#include "EventLoop.h"
+
+class Compiler;
 
 //#define DEBUG_TRACE_STACK
 //#define DEBUG_GC_INFO
@@ -26,16 +31,113 @@ private:
 	Value& pop();
 	Value& peek(int depth);
 
-	RunnableValue* body;
+	// Execution state of a runnable call. Chunks are shared between interpreters and never change
+	// while running, so everything that moves during execution lives here
+	typedef struct {
+		RunnableValue* runnable;
+		short ip;
+		uint8_t FrameStart;	// stack slot of the called runnable, followed by its arguments and locals
+		GeneratorValue* generator;	// the generator running in this frame, nullptr for a plain call
+	} CallFrame;
+
+	static const short FramesMax = 255;
+
+	typedef struct {
+		CallFrame frm[FramesMax];
+		uint8_t count;
+	} FrameStack;
+
+	FrameStack frames;
+
+	CallFrame& CurrentFrame();
 	Chunk* CurrentChunk();
-	void SetBody(RunnableValue* body);
+	uint8_t ReadByte();
+	bool IsAtEnd();
+
+	Compiler* compiler;  // compiles runnable bodies on their first call
+
+	// Inline caches of field accesses, at the slot the compiler gave each access. They live here rather than
+	// in the chunk, since chunks are shared between interpreters and every interpreter has its own rats.
+	// An entry maps the shape an instance had before the access to the field's slot, and to the shape it has
+	// after it, which only differs for an assignment that added the field
+	typedef struct {
+		Shape* from;
+		Shape* to;
+		uint16_t slot;
+	} CacheEntry;
+
+	static const int CacheEntries = 4;	// an access that sees more shapes than this does the full lookup every time
+
+	typedef struct {
+		CacheEntry entries[CacheEntries];
+		uint8_t count;
+	} FieldCache;
+
+	std::vector<FieldCache> caches;
+	FieldCache& ReadCache();
 
 	void RunCommand();
+	void EnterRunnable(RunnableValue* runnable);
+
+	void MakeGenerator(RunnableValue* runnable, uint8_t FrameIndex);
+	bool Resume(GeneratorValue* generator);	// true if it yielded, and the yielded value is left on top
+	void SuspendFrame(FutureValue* awaited);
+
+	// Async runnables, run on this thread by the event loop
+	EventLoop* loop;	// made on first use
+	std::deque<GeneratorValue*> ready;	// async calls that can run, each holding a reference
+	std::vector<GeneratorValue*> waiting;	// async calls stopped at an 'await', each holding a reference
+
+	EventLoop* GetLoop();
+	void RunLoop(FutureValue* until);	// until 'until' is done, or until every async call finished if it's nullptr
+	void RunCoroutine(GeneratorValue* coroutine);
+
+	Value ReturnValue;  // value returned by the last call from the host
 
 	ObjectValue* objects;
 	void RemoveObject(ObjectValue* o);
+	void Release(Value& v);
+	void ConcatAssign(Value* va);
+
+	// Reference counting frees everything but cycles, which a tracing collector finds now and then. It runs in
+	// short steps between commands, paced by allocation: the roots are scanned at once, and marking and sweeping
+	// go on a bounded amount per step while the script runs. During marking, a store that drops a reference held
+	// by an object shades the old value, so whatever was reachable when the cycle started is found
+	enum CollectorPhase { COLLECT_IDLE, COLLECT_MARK, COLLECT_SWEEP, COLLECT_FREE };
+
+	static const size_t MinCollectHeap = 1 << 14;	// objects before the first cycle
+	static const size_t CollectPace = 256;	// allocations between steps
+	static const size_t CollectWork = 1024;	// objects marked, swept or freed by a step
+
+	struct Collector {
+		CollectorPhase phase;
+		unsigned cycle;	// the mark of objects found reachable by the current cycle, and of those made during it
+		std::vector<ObjectValue*> gray;	// reachable objects whose references aren't scanned yet, each holding a reference
+		ObjectValue* SweepPrev;	// the last object the sweep kept, nullptr while it's at the head of the list
+		std::vector<ObjectValue*> dead;	// unlinked by the sweep, and freed in steps once it's done
+
+		size_t count;	// objects in the list
+		size_t threshold;	// a cycle starts once there are this many
+		size_t allocations;
+		size_t StepAt;	// allocations before the next step
+
+		size_t cycles;
+		size_t collected;
+		std::vector<double> pauses;	// of every step, in milliseconds
+	} collector;
+
+	int NativeDepth;	// natives running, whose C++ frames may hold objects that no root reaches
+
+	void Shade(Value& v);
+	void ScanRoots();
+	void CollectStep();
+
+	FileValue* out;		// buffer for print, written to stdout when full, on flush() and before input()
+	FileValue* in;		// buffered stdin, shared by input(), the other input natives and every other interpreter
+	std::string NextLine;	// read into by for loops over lines, swapped with the loop variable's string
+	bool LineBuffered;	// stdout is a terminal, so every print is flushed
 
-	static enum ExitCode {
+	enum ExitCode {
 		INTERPRET_OK = 0,
 		UNRECOGNIZED_OPCODE = 201,
 		STACK_UNDERFLOW,
@@ -44,12 +146,16 @@ private:
 		REDECLARED_RAT,
 		UNDEFINED_RAT,
 		RETURN_FROM_SCRIPT,  // 'return' statement outside a runnable
+		COMPILATION_ERROR,	// a runnable's body failed to compile on its first call
+		INDEX_ERROR,		// list index out of range, or a key missing from a map
 
 		INTERNAL_ERROR,
+		TASK_ERROR,			// an awaited task failed
+		IMPURE_RUNNABLE,	// a runnable run by pmap or preduce assigned to a global
 	};
 
-	std::string GetConstantStr(uint8_t index);
-	float GetConstantNum(uint8_t index);
+	std::string& GetConstantStr(uint8_t index);
+	double GetConstantNum(uint8_t index);
 	bool GetConstantBool(uint8_t index);
 
 	std::string TraceStack(int CodeOffset);
@@ -63,27 +169,149 @@ private:
 	Value *FindLocal();
 
 	Value NewObject(ObjectValue* obj);
-	Value NewObject(std::string& str);
+	Value NewObject(const std::string& str);
 
 	StrValue* ExtractStrValue(Value* v, const std::string&);
+	FileValue* ExtractFileValue(Value* v, const std::string&);
+	ListValue* ExtractListValue(Value* v, const std::string&);
+	size_t ListIndex(ListValue* list, Value& index);
+	MapValue* ExtractMapValue(Value* v, const std::string&);
+	InstanceValue* ExtractInstanceValue(Value* v, const std::string&);
+	void CheckKey(Value& key);
+	void MapStore(MapValue* map, Value& key, Value& value);
 
-	void DefineNative(const std::string& name, uint8_t arity, NativeRunnable run);
+	struct NumericList {
+		// A list passed to a vector native. An unboxed list is read in place, a boxed one is copied
+		size_t size;
+		bool whole;	// every element is an integer, and they're read from 'integers'
+		const int64_t* integers;
+		const double* numbers;
+		std::vector<int64_t> IntScratch;
+		std::vector<double> scratch;
+
+		const double* Doubles();	// the elements as doubles, converting integers into scratch
+	};
+
+	ChannelValue* ExtractChannelValue(Value* v, const std::string&);
+
+	// Tasks
+	Task* task;	// the task this interpreter runs, nullptr for a script's own interpreter
+	std::shared_ptr<TaskGroup> group;	// tasks spawned by the script and by its tasks, made on the first spawn
+	bool suspendable;	// running a task's own commands, so a command that has to wait can park the task
+	bool suspended;		// the last command has to wait, and runs again from the start once the task is woken
+
+	Task* Waiter();	// the task to park, or nullptr if waiting has to block the thread
+	void Spawn(RunnableValue* runnable);
+
+	Value Detach(Value& v);
+	Value DetachCopy(Value& v, std::unordered_map<ObjectValue*, ObjectValue*>& copies, std::string& ErrorMsg);
+	Value Adopt(Value v);
+
+	bool pure;	// running chunks for pmap or preduce, whose runnable can't assign to globals
+	void CheckPure();
+	Value DetachSlice(ListValue* list, size_t start, size_t end);
+	void RunParallel(ListValue* list, Value& f, bool reduce, const std::string& native, std::vector<Value>& results);
+
+	void NumericData(Value& v, const std::string& native, NumericList& out);
+	void VectorBinary(const std::string& native, void (*op)(const double*, const double*, double*, size_t),
+		void (*IntOp)(const int64_t*, const int64_t*, int64_t*, size_t));
+
+	bool IteratorNext(Value& iterator, Value* var, Value& next);
+	void StoreLoopVariable(Value* var, Value& next);
+	Value* RangeVariable(bool local, uint8_t index);
+
+	void DefineNative(const std::string& name, uint8_t arity, NativeRunnable run, uint8_t optional = 0);
+	void CallNative(NativeValue* native, uint8_t arity);
+	void CallWithArguments(Value& callee, Value* args, uint8_t count);
+
+	void SortList(ListValue* list);
+	void SortListByKey(ListValue* list, Value& key);
 
 	void NativeInput();
 	void NativePrint();
+	void NativeFlushOutput();
+
+	void NativeReadAllInput();
+	void NativeReadInputChunk();
+	void NativeInputLines();
 	
 	void NativeReadFromFile();
 	void NativeWriteToFile();
 	void NativeEmptyFile();
 
+	void NativeReadFromFileAsync();
+	void NativeWriteToFileAsync();
+	void NativeEmptyFileAsync();
+
+	void NativeOpen();
+	void NativeWrite();
+	void NativeReadLine();
+	void NativeFlush();
+	void NativeClose();
+	void NativeLines();
+
 	void NativeConvertToNum();
 	void NativeConvertToBool();
 	void NativeConvertToStr();
 	void NativeTypeOf();
 
+	void NativeSubstring();
+	void NativeSplit();
+
+	void NativeLen();
+	void NativePush();
+	void NativePop();
+
+	void NativeHas();
+	void NativeGet();
+	void NativeRemove();
+
+	void NativeSum();
+	void NativeMin();
+	void NativeMax();
+	void NativeDot();
+	void NativeAdd();
+	void NativeMul();
+	void NativeScale();
+	void NativeWhere();
+
+	void NativeSort();
+
+	void NativeChannel();
+	void NativeSend();
+	void NativeReceive();
+
+	void NativeParallelMap();
+	void NativeParallelReduce();
+
+	void NativeResume();
+
+	void NativeSleepAsync();
+	void NativeExecAsync();
+
+	void NativeCollectorStats();
+
 public:
-	Interpreter(RunnableValue *);
+	Interpreter(RunnableValue *, Compiler *, Task* task = nullptr);
 	~Interpreter();
 
 	int interpret();
+	void FlushOutput();
+
+	// Embedding interface, used by Context
+	void DefineRunnables();
+	int CallRunnable(const std::string& name, std::vector<Value>& args);
+	Value GetReturnValue();
+
+	Value NewString(const std::string& s);
+	void SetGlobal(const std::string& name, Value value);
+	bool GetGlobal(const std::string& name, Value& value);
+
+	// Spawned tasks, used by Task
+	bool StartTask(RunnableValue* runnable, std::vector<Value>& args, std::string& ErrorMsg);
+	Task::Status RunTask(int slice, Value& result, std::string& ErrorMsg);
+
+	// Chunks of pmap and preduce, each run in an interpreter of its own
+	bool RunChunk(RunnableValue* runnable, const std::string& NativeName, Value& chunk, bool reduce,
+		Value& result, std::string& ErrorMsg);
 };
\ No newline at end of file
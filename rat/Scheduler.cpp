@@ -0,0 +1,243 @@
+#include "Scheduler.h"
+#include "Interpreter.h"
+
+#include <algorithm>
+
+
+TaskGroup::TaskGroup() {
+	this->running = 0;
+}
+
+void TaskGroup::Started() {
+	std::lock_guard<std::mutex> guard(this->lock);
+	this->running++;
+}
+
+void TaskGroup::Finished() {
+	{
+		std::lock_guard<std::mutex> guard(this->lock);
+		this->running--;
+	}
+	this->changed.notify_all();
+}
+
+void TaskGroup::Join() {
+	std::vector<Task*> abandoned;
+	{
+		std::unique_lock<std::mutex> guard(this->lock);
+		this->changed.wait(guard, [this] { return this->running == (int)this->parked.size(); });
+
+		// Whatever is still parked waits on channels or tasks that nothing left running can change
+		abandoned.swap(this->parked);
+		this->running = 0;
+	}
+
+	for (Task* task : abandoned) delete task;
+}
+
+
+Task::Task(RunnableValue* script, Compiler* compiler, RunnableValue* runnable, std::vector<Value>& args,
+	std::shared_ptr<FutureValue::State> result, std::shared_ptr<TaskGroup> group) {
+	this->script = script;
+	this->compiler = compiler;
+	this->interpreter = nullptr;
+
+	this->runnable = runnable;
+	this->args.swap(args);
+
+	this->result = result;
+	this->group = group;
+
+	this->parked = false;
+	this->woken = false;
+}
+
+Task::Task(std::function<void()> job, std::shared_ptr<TaskGroup> group) {
+	this->script = nullptr;
+	this->compiler = nullptr;
+	this->interpreter = nullptr;
+	this->runnable = nullptr;
+
+	this->group = group;
+	this->job = std::move(job);
+
+	this->parked = false;
+	this->woken = false;
+}
+
+Task::~Task() {
+	delete this->interpreter;
+	for (size_t i = 0; i < this->args.size(); i++) FreeDetached(this->args[i]);  // never started
+}
+
+Task::Status Task::Run() {
+	if (this->job) {
+		this->job();
+		return FINISHED;
+	}
+
+	Value ReturnValue;
+	std::string ErrorMsg;
+
+	if (this->interpreter == nullptr) {
+		this->interpreter = new Interpreter(this->script, this->compiler, this);
+		this->interpreter->DefineRunnables();
+
+		if (!this->interpreter->StartTask(this->runnable, this->args, ErrorMsg)) {
+			this->result->Complete(ReturnValue, ErrorMsg);
+			return FINISHED;
+		}
+	}
+
+	Status status = this->interpreter->RunTask(Slice, ReturnValue, ErrorMsg);
+	if (status == FINISHED) {
+		this->interpreter->FlushOutput();  // before anything that awaited the task goes on
+		this->result->Complete(ReturnValue, ErrorMsg);
+	}
+
+	return status;
+}
+
+TaskGroup* Task::GetGroup() {
+	return this->group.get();
+}
+
+std::shared_ptr<TaskGroup>& Task::GetSharedGroup() {
+	return this->group;
+}
+
+
+thread_local int Scheduler::current = -1;
+
+Scheduler::Scheduler(int threads) {
+	this->queued = 0;
+	this->next = 0;
+	this->stopping = false;
+
+	for (int i = 0; i < threads; i++) this->workers.push_back(new Worker());
+	for (int i = 0; i < threads; i++) this->threads.emplace_back(&Scheduler::WorkerLoop, this, i);
+}
+
+Scheduler::~Scheduler() {
+	// Tasks are done by now, unless a host never freed its contexts. Those are left where they are
+	{
+		std::lock_guard<std::mutex> guard(this->lock);
+		this->stopping = true;
+	}
+	this->available.notify_all();
+
+	for (int i = 0; i < this->threads.size(); i++) this->threads[i].join();
+	for (int i = 0; i < this->workers.size(); i++) delete this->workers[i];
+}
+
+Scheduler* Scheduler::Get() {
+	static Scheduler scheduler(std::max(1, (int)std::thread::hardware_concurrency()));
+	return &scheduler;
+}
+
+int Scheduler::Workers() {
+	return (int)this->workers.size();
+}
+
+void Scheduler::Spawn(Task* task) {
+	task->GetGroup()->Started();
+	Push(task, false);
+}
+
+void Scheduler::Wake(Task* task) {
+	TaskGroup* group = task->GetGroup();
+	{
+		std::lock_guard<std::mutex> guard(group->lock);
+		if (!task->parked) {
+			task->woken = true;	// its worker requeues it when it stops
+			return;
+		}
+
+		task->parked = false;
+		group->parked.erase(std::find(group->parked.begin(), group->parked.end(), task));
+	}
+	Push(task, false);
+}
+
+void Scheduler::Push(Task* task, bool front) {
+	int index = (current != -1) ? current : (int)(this->next++ % this->workers.size());
+	Worker* worker = this->workers[index];
+	{
+		std::lock_guard<std::mutex> guard(worker->lock);
+		if (front) worker->tasks.push_front(task);
+		else worker->tasks.push_back(task);
+	}
+	this->queued++;
+
+	// Taking the lock orders this with a worker that checked 'queued' and is about to sleep
+	{ std::lock_guard<std::mutex> guard(this->lock); }
+	this->available.notify_one();
+}
+
+Task* Scheduler::Take(int index) {
+	// The newest task on this worker, or else the oldest one on another
+	for (int i = 0; i < this->workers.size(); i++) {
+		Worker* worker = this->workers[(index + i) % this->workers.size()];
+		std::lock_guard<std::mutex> guard(worker->lock);
+		if (worker->tasks.empty()) continue;
+
+		Task* task;
+		if (i == 0) {
+			task = worker->tasks.back();
+			worker->tasks.pop_back();
+		}
+		else {
+			task = worker->tasks.front();
+			worker->tasks.pop_front();
+		}
+
+		this->queued--;
+		return task;
+	}
+	return nullptr;
+}
+
+void Scheduler::WorkerLoop(int index) {
+	current = index;
+
+	while (true) {
+		Task* task = Take(index);
+		if (task == nullptr) {
+			std::unique_lock<std::mutex> guard(this->lock);
+			this->available.wait(guard, [this] { return this->stopping || this->queued > 0; });
+
+			if (this->stopping) return;
+			continue;
+		}
+
+		switch (task->Run()) {
+			case Task::FINISHED: {
+				std::shared_ptr<TaskGroup> group = task->GetSharedGroup();
+				delete task;
+				group->Finished();  // only now, since the group's script waits for it before its program is freed
+				break;
+			}
+
+			case Task::BLOCKED: {
+				TaskGroup* group = task->GetGroup();
+				std::unique_lock<std::mutex> guard(group->lock);
+				if (task->woken) {
+					task->woken = false;
+					guard.unlock();
+					Push(task, false);
+					break;
+				}
+
+				// Notified under the lock: once the last task is parked, the group may be freed as soon as it's released
+				task->parked = true;
+				group->parked.push_back(task);
+				group->changed.notify_all();
+				break;
+			}
+
+			case Task::PREEMPTED:
+				Push(task, true);	// behind the other tasks of this worker, and first in line for a thief
+				break;
+		}
+	}
+}
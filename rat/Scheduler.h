@@ -0,0 +1,113 @@
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <functional>
+
+#include "Value.h"
+
+class Interpreter;
+class Compiler;
+class Task;
+
+
+struct TaskGroup {
+	// The tasks spawned by a script, and by its tasks. The script's interpreter waits for all of them before it's freed.
+	// The lock also guards the parked state of each task in the group
+	std::mutex lock;
+	std::condition_variable changed;
+
+	int running;	// spawned and not finished yet, parked ones included
+	std::vector<Task*> parked;
+
+	TaskGroup();
+
+	void Started();
+	void Finished();
+	void Join();	// waits until every task finished, or the rest wait on each other for good. Those are freed
+};
+
+
+class Task {
+	// A runnable started by 'spawn'. It runs in an interpreter of its own, with its own stack, frames and objects,
+	// made on its first run. A task that has to wait for a channel or for another task is parked, and whichever
+	// worker picks it up after it's woken runs the waiting command again
+public:
+	enum Status {
+		FINISHED,
+		BLOCKED,	// parked, unless it was woken in the meantime
+		PREEMPTED,	// ran for a whole slice, and makes way for the tasks queued behind it
+	};
+
+	static const int Slice = 1 << 14;	// commands run before a task gives its worker to the next one
+
+	bool parked;	// guarded by the group's lock
+	bool woken;		// woken while it was still running, so it isn't parked when it stops
+
+	Task(RunnableValue* script, Compiler* compiler, RunnableValue* runnable, std::vector<Value>& args,
+		std::shared_ptr<FutureValue::State> result, std::shared_ptr<TaskGroup> group);
+	Task(std::function<void()> job, std::shared_ptr<TaskGroup> group);	// runs job to the end, instead of a runnable
+	~Task();
+
+	Status Run();
+	TaskGroup* GetGroup();
+	std::shared_ptr<TaskGroup>& GetSharedGroup();
+
+private:
+	RunnableValue* script;
+	Compiler* compiler;
+	Interpreter* interpreter;
+
+	RunnableValue* runnable;
+	std::vector<Value> args;	// detached, until the interpreter is made
+
+	std::shared_ptr<FutureValue::State> result;
+	std::shared_ptr<TaskGroup> group;
+
+	std::function<void()> job;
+};
+
+
+class Scheduler
+{
+	// Worker threads that run spawned tasks M:N, one per core. Every worker has a deque of tasks: it takes the newest
+	// one from the back of its own, and a worker that runs out steals the oldest one from the front of another's.
+	// A task spawned or woken by a task goes on that task's worker, so related work tends to stay on one core
+private:
+	struct Worker {
+		std::mutex lock;
+		std::deque<Task*> tasks;
+	};
+
+	std::vector<Worker*> workers;
+	std::vector<std::thread> threads;
+
+	std::atomic<int> queued;	// tasks in all the deques
+	std::atomic<unsigned> next;	// worker for tasks pushed from other threads, taken in turn
+
+	std::mutex lock;	// only for sleeping on 'available'
+	std::condition_variable available;
+	bool stopping;
+
+	static thread_local int current;	// index of the worker on this thread, -1 on other threads
+
+	Scheduler(int threads);
+	void WorkerLoop(int index);
+
+	void Push(Task* task, bool front);
+	Task* Take(int index);
+
+public:
+	~Scheduler();
+
+	static Scheduler* Get();  // started on first use
+	int Workers();
+
+	void Spawn(Task* task);
+	void Wake(Task* task);	// a task that was parked, or is about to be
+};
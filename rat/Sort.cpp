@@ -0,0 +1,142 @@
+#include "Sort.h"
+
+#include <algorithm>
+#include <cstring>
+#include <thread>
+
+static const size_t RadixThreshold = 256;	// below this, a comparison sort is faster than the counting passes
+static const size_t ParallelThreshold = 1 << 16;	// the least a thread is given to sort
+
+
+static uint64_t RadixKey(double f) {
+	// Bits of f as an unsigned number that orders the same way as f: flip every bit of a negative number,
+	// and only the sign bit of a positive one
+	uint64_t bits;
+	std::memcpy(&bits, &f, sizeof(bits));
+	return (bits & 0x8000000000000000) ? ~bits : (bits | 0x8000000000000000);
+}
+
+static uint64_t RadixKey(int64_t i) {
+	// Flipping the sign bit moves the negative numbers below the positive ones
+	return (uint64_t)i ^ 0x8000000000000000;
+}
+
+template <typename T, typename Key>
+static void RadixSort(T* begin, T* end, Key key) {
+	// Least significant digit first, a byte per pass. Each pass is stable, so the sort is.
+	// Passes where every key has the same byte are skipped, so small integers take only a few
+	size_t n = end - begin;
+	if (n < RadixThreshold) {
+		std::stable_sort(begin, end, [&](const T& a, const T& b) { return key(a) < key(b); });
+		return;
+	}
+
+	std::vector<T> buffer(n);
+	T* from = begin;
+	T* to = buffer.data();
+
+	for (int shift = 0; shift < 64; shift += 8) {
+		size_t counts[257] = { 0 };
+		for (size_t i = 0; i < n; i++) counts[((key(from[i]) >> shift) & 0xFF) + 1]++;
+		if (counts[((key(from[0]) >> shift) & 0xFF) + 1] == n) continue;	// every element has the same digit
+
+		for (int d = 0; d < 256; d++) counts[d + 1] += counts[d];
+		for (size_t i = 0; i < n; i++) to[counts[(key(from[i]) >> shift) & 0xFF]++] = from[i];
+
+		std::swap(from, to);
+	}
+
+	if (from != begin) std::copy(from, from + n, begin);
+}
+
+template <typename T, typename Less, typename ChunkSort>
+static void ParallelSort(std::vector<T>& v, Less less, ChunkSort sort) {
+	// Sort chunks of v on separate threads, then merge neighbouring runs in rounds, each round's merges in parallel.
+	// Merging takes from the left run on ties, so a stable chunk sort makes the whole sort stable
+	size_t n = v.size();
+	size_t workers = std::max(1u, std::thread::hardware_concurrency());
+
+	size_t chunks = 1;
+	while (chunks * 2 <= workers && n / (chunks * 2) >= ParallelThreshold) chunks *= 2;
+
+	if (chunks == 1) {
+		sort(v.data(), v.data() + n);
+		return;
+	}
+
+	std::vector<size_t> bounds(chunks + 1);
+	for (size_t i = 0; i <= chunks; i++) bounds[i] = n * i / chunks;
+
+	std::vector<std::thread> threads;
+	for (size_t i = 0; i < chunks; i++) {
+		threads.emplace_back([&, i]() { sort(v.data() + bounds[i], v.data() + bounds[i + 1]); });
+	}
+	for (std::thread& t : threads) t.join();
+
+	std::vector<T> buffer(n);
+	T* from = v.data();
+	T* to = buffer.data();
+
+	for (size_t width = 1; width < chunks; width *= 2) {
+		threads.clear();
+		for (size_t i = 0; i < chunks; i += 2 * width) {
+			size_t lo = bounds[i];
+			size_t mid = bounds[std::min(i + width, chunks)];
+			size_t hi = bounds[std::min(i + 2 * width, chunks)];
+			threads.emplace_back([=]() { std::merge(from + lo, from + mid, from + mid, from + hi, to + lo, less); });
+		}
+		for (std::thread& t : threads) t.join();
+
+		std::swap(from, to);
+	}
+
+	if (from != v.data()) std::copy(from, from + n, v.data());
+}
+
+
+Sort::StringKey::StringKey(std::string_view view, uint32_t index) {
+	this->view = view;
+	this->index = index;
+
+	this->prefix = 0;
+	for (size_t i = 0; i < 8; i++) {
+		this->prefix <<= 8;
+		if (i < view.size()) this->prefix |= (unsigned char)view[i];
+	}
+}
+
+Sort::NumberKey::NumberKey(double key, uint32_t index) {
+	this->bits = RadixKey(key);
+	this->index = index;
+}
+
+Sort::NumberKey::NumberKey(int64_t key, uint32_t index) {
+	this->bits = RadixKey(key);
+	this->index = index;
+}
+
+void Sort::Numbers(std::vector<double>& numbers) {
+	auto key = [](double f) { return RadixKey(f); };
+	ParallelSort(numbers, [](double a, double b) { return RadixKey(a) < RadixKey(b); },
+		[&](double* begin, double* end) { RadixSort(begin, end, key); });
+}
+
+void Sort::Numbers(std::vector<int64_t>& numbers) {
+	auto key = [](int64_t i) { return RadixKey(i); };
+	ParallelSort(numbers, [](int64_t a, int64_t b) { return a < b; },
+		[&](int64_t* begin, int64_t* end) { RadixSort(begin, end, key); });
+}
+
+void Sort::Numbers(std::vector<NumberKey>& keys) {
+	auto key = [](const NumberKey& k) { return k.bits; };
+	ParallelSort(keys, [&](const NumberKey& a, const NumberKey& b) { return key(a) < key(b); },
+		[&](NumberKey* begin, NumberKey* end) { RadixSort(begin, end, key); });
+}
+
+void Sort::Strings(std::vector<StringKey>& keys) {
+	auto less = [](const StringKey& a, const StringKey& b) {
+		if (a.prefix != b.prefix) return a.prefix < b.prefix;
+		return a.view < b.view;
+	};
+	ParallelSort(keys, less, [&](StringKey* begin, StringKey* end) { std::stable_sort(begin, end, less); });
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+class Sort
+{
+	// Sorting for the 'sort' native. Numbers are radix sorted on their bits, strings are sorted by a key
+	// that holds their first bytes, so most comparisons don't leave the key array. Large inputs are split
+	// between threads, and the sorted runs are merged in parallel rounds. Every sort here is stable
+public:
+	struct NumberKey {
+		uint64_t bits;	// the key, mapped to an unsigned number that orders the same way
+		uint32_t index;	// position of the element before sorting
+
+		NumberKey() = default;
+		NumberKey(double key, uint32_t index);
+		NumberKey(int64_t key, uint32_t index);	// keys of one sort must be all integers or all doubles
+	};
+
+	struct StringKey {
+		uint64_t prefix;	// first 8 bytes, big endian, so prefixes compare like the strings do
+		std::string_view view;
+		uint32_t index;
+
+		StringKey() = default;
+		StringKey(std::string_view view, uint32_t index);
+	};
+
+	static void Numbers(std::vector<double>& numbers);
+	static void Numbers(std::vector<int64_t>& numbers);
+	static void Numbers(std::vector<NumberKey>& keys);
+	static void Strings(std::vector<StringKey>& keys);
+};
@@ -2,7 +2,6 @@
 
 #include <iostream>
 #include <string>
-#include <format>
 #include <unordered_map>
 
 enum TokenType {
@@ -52,6 +51,7 @@ enum TokenType {
 
 	// runnables - functions
 	RUNNABLE, RETURN, ENDRUNNABLE,
+	AWAIT, SPAWN, YIELD, ASYNC,
 
 	// rats - classes
 	RAT, THIS, ENDRAT,
@@ -1,20 +1,32 @@
 #include "Value.h"
+#include "Chunk.h"  // RunnableValue owns its chunk, and must see its destructor to free it
+#include "Scheduler.h"
+#include "EventLoop.h"
+
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <unordered_set>
 
 Value::Value() {
 	// 'none' value
 
 	this->type = NONE_T; // temporary value, will be set by the actual type's initializer
-	this->StrRep = "None";
 }
 
-Value::Value(float f) {
+Value::Value(double f) {
 	// Number value
 	this->val.n = f;
 	this->type = NUM_T;
+}
 
-	std::stringstream s;
-	s << f;
-	this->StrRep = s.str();
+Value::Value(int64_t i) {
+	// Integer value
+	this->val.i = i;
+	this->type = INT_T;
 }
 
 
@@ -22,17 +34,12 @@ Value::Value(bool b) {
 	// Boolean value
 	this->val.b = b;
 	this->type = BOOL_T;
-
-	if (b) this->StrRep = "true";
-	else this->StrRep = "false";
 }
 
 Value::Value(ObjectValue* o) {
 	// ObjectValue Value
 	this->val.o = o;
 	this->type = OBJECT_T;
-
-	this->StrRep = o->ToString();
 }
 
 Value::~Value() {
@@ -43,47 +50,41 @@ Value::datatype Value::GetType() {
 }
 
 
-void Value::SetValue(float n) {
+void Value::SetValue(double n) {
 	this->type = NUM_T;
 	this->val.n = n;
+}
 
-	std::stringstream s;
-	s << n;
-	this->StrRep = s.str();
+void Value::SetValue(int64_t i) {
+	this->type = INT_T;
+	this->val.i = i;
 }
 
 void Value::SetValue(bool b) {
 	this->type = BOOL_T;
 	this->val.b = b;
-
-	if (b) this->StrRep = "true";
-	else this->StrRep = "false";
 }
 
 void Value::SetValue(ObjectValue* o) {
 	this->type = OBJECT_T;
 	this->val.o = o;
-
-	if (o != nullptr) {
-		this->StrRep = o->ToString();
-	}
-	else {
-		this->StrRep = "None";
-	}
 }
 
 void Value::SetAsNone() {
 	this->type = NONE_T;
-
-	this->StrRep = "None";
 }
 
 
 
-float Value::GetNum() {
+double Value::GetNum() {
+	if (this->type == INT_T) return (double)this->val.i;
 	return this->val.n;
 }
 
+int64_t Value::GetInt() {
+	return this->val.i;
+}
+
 bool Value::GetBool() {
 	return this->val.b;
 }
@@ -100,9 +101,37 @@ bool Value::IsObject() {
 	return this->type == OBJECT_T;
 }
 
+bool Value::IsNumber() {
+	return this->type == NUM_T || this->type == INT_T;
+}
+
+bool Value::IsInt() {
+	return this->type == INT_T;
+}
+
+
+
+std::string& Value::ToString() {
+	// The string is only built when it's asked for, so that arithmetic never formats numbers.
+	// Objects are asked directly, so that copying a value never copies a string
+	switch (this->type) {
+		case NUM_T: {
+			std::stringstream s;
+			s << this->val.n;
+			this->StrRep = s.str();
+			break;
+		}
+
+		case INT_T:		this->StrRep = std::to_string(this->val.i);	break;
+
+		case BOOL_T:	this->StrRep = this->val.b ? "true" : "false";	break;
 
+		case OBJECT_T:
+			if (this->val.o != nullptr) return this->val.o->ToString();
+			// fall through
 
-std::string& Value::ToString() {	
+		default:	this->StrRep = "None";	break;
+	}
 	return this->StrRep;
 }
 
@@ -112,14 +141,27 @@ bool Value::IsTruthy() {
 	switch (this->type)
 	{
 		case NUM_T:			return  this->GetNum() != 0;		break;
+		case INT_T:			return	this->val.i != 0;			break;
 		case BOOL_T:		return	this->GetBool();			break;
 		case OBJECT_T: {
 			ObjectValue* o = this->val.o;
 			switch (o->GetType())
 			{
-				case ObjectValue::STRING_T:		return o->ToString() != "" && o->ToString() != "false";		break;
+				case ObjectValue::STRING_T: {
+					std::string_view s = ((StrValue*)o)->GetView();
+					return s != "" && s != "false";
+				}
 				case ObjectValue::RUNNABLE_T:	return true;
 				case ObjectValue::NATIVE_T:		return true;
+				case ObjectValue::FILE_T:		return true;
+				case ObjectValue::FUTURE_T:		return true;
+				case ObjectValue::LIST_T:		return ((ListValue*)o)->Size() != 0;
+				case ObjectValue::MAP_T:		return ((MapValue*)o)->Size() != 0;
+				case ObjectValue::ITERATOR_T:	return true;
+				case ObjectValue::CLASS_T:		return true;
+				case ObjectValue::INSTANCE_T:	return true;
+				case ObjectValue::CHANNEL_T:	return true;
+				case ObjectValue::GENERATOR_T:	return true;
 				default:
 					break;
 			}
@@ -129,13 +171,19 @@ bool Value::IsTruthy() {
 
 		default:	return false;
 	}
+	return true;	// any other object
 }
 
 ObjectValue::ObjectValue() {
 	this->references = 0;
+	this->constant = false;
+	this->mark = 0;
 	this->next = nullptr;
 }
 
+ObjectValue::~ObjectValue() {
+}
+
 ObjectValue::ObjectType ObjectValue::GetType() {
 	return this->type;
 }
@@ -160,15 +208,54 @@ bool ObjectValue::IsNative() {
 	return this->type == NATIVE_T;
 }
 
+bool ObjectValue::IsFile() {
+	return this->type == FILE_T;
+}
+
+bool ObjectValue::IsFuture() {
+	return this->type == FUTURE_T;
+}
+
+bool ObjectValue::IsList() {
+	return this->type == LIST_T;
+}
+
+bool ObjectValue::IsMap() {
+	return this->type == MAP_T;
+}
+
+bool ObjectValue::IsClass() {
+	return this->type == CLASS_T;
+}
+
+bool ObjectValue::IsInstance() {
+	return this->type == INSTANCE_T;
+}
+
+bool ObjectValue::IsChannel() {
+	return this->type == CHANNEL_T;
+}
+
+bool ObjectValue::IsGenerator() {
+	return this->type == GENERATOR_T;
+}
+
 std::string& ObjectValue::ToString() {
 	return this->StrRep;
 }
 
 void ObjectValue::AddReference() {
+	if (this->constant) return;
 	this->references++;
 }
 
+bool ObjectValue::IsShared() {
+	return this->constant || this->references > 1;
+}
+
 bool ObjectValue::DeleteReference() {
+	if (this->constant) return false;
+
 	this->references--;
 	if (this->references <= 0) {
 		return true;
@@ -176,22 +263,150 @@ bool ObjectValue::DeleteReference() {
 	return false;
 }
 
+void ObjectValue::MakeConstant() {
+	this->constant = true;
+}
+
+bool ObjectValue::IsConstant() {
+	return this->constant;
+}
+
+unsigned ObjectValue::GetMark() {
+	return this->mark;
+}
+
+void ObjectValue::SetMark(unsigned cycle) {
+	this->mark = cycle;
+}
+
+
+SharedBytes::SharedBytes(std::string& s) {
+	this->owned.swap(s);
+	this->mapping = nullptr;
+	this->MapSize = 0;
+}
+
+SharedBytes::SharedBytes(const char* mapping, size_t size) {
+	this->mapping = mapping;
+	this->MapSize = size;
+}
+
+SharedBytes::~SharedBytes() {
+	if (this->mapping != nullptr) munmap((void*)this->mapping, this->MapSize);
+}
+
 
 StrValue::StrValue(const std::string& value) {
 	this->type = STRING_T;
 	this->StrRep = value;
+
+	this->view = nullptr;
+	this->ViewSize = 0;
+	this->hashed = false;
+}
+
+StrValue::StrValue(const char* mapping, size_t size) {
+	this->type = STRING_T;
+
+	this->shared = std::make_shared<SharedBytes>(mapping, size);
+	this->view = mapping;
+	this->ViewSize = size;
+	this->hashed = false;
+}
+
+StrValue::StrValue(StrValue& parent, size_t start, size_t length) {
+	// start and length must be within the parent
+	this->type = STRING_T;
+	this->view = nullptr;
+	this->ViewSize = 0;
+	this->hashed = false;
+
+	std::string_view text = parent.GetView().substr(start, length);
+
+	// Constants are shared between interpreters on other threads, so their text is never moved
+	if (length <= InlineSize || parent.IsConstant()) {
+		this->StrRep.assign(text);
+		return;
+	}
+
+	if (parent.shared == nullptr) {
+		// Move the parent's text into shared bytes, which it goes on viewing. Nothing is copied
+		size_t size = parent.StrRep.size();
+
+		parent.shared = std::make_shared<SharedBytes>(parent.StrRep);
+		parent.view = parent.shared->owned.data();
+		parent.ViewSize = size;
+
+		text = std::string_view(parent.view, size).substr(start, length);
+	}
+
+	this->shared = parent.shared;
+	this->view = text.data();
+	this->ViewSize = length;
+}
+
+StrValue::~StrValue() {
+}
+
+void StrValue::Unshare() {
+	this->shared = nullptr;
+	this->view = nullptr;
+	this->ViewSize = 0;
 }
 
 std::string& StrValue::GetValue() {
+	// Callers that need an std::string get a private copy of the shared bytes, made once
+	if (this->shared != nullptr) {
+		this->StrRep.assign(this->view, this->ViewSize);
+		Unshare();
+	}
+	return this->StrRep;
+}
+
+std::string_view StrValue::GetView() {
+	if (this->shared != nullptr) return std::string_view(this->view, this->ViewSize);
 	return this->StrRep;
 }
 
 void StrValue::SetValue(const std::string& s) {
+	Unshare();
 	this->StrRep = s;
+	this->hashed = false;
+}
+
+void StrValue::Swap(std::string& s) {
+	Unshare();
+	this->StrRep.swap(s);
+	this->hashed = false;
+}
+
+void StrValue::Append(std::string_view s) {
+	GetValue().append(s);
+	this->hashed = false;
+}
+
+size_t StrValue::Hash() {
+	if (!this->hashed) {
+		size_t h = std::hash<std::string_view>()(GetView());
+		if (IsConstant()) return h;  // read by other threads, so only hashed before it's made constant
+		this->hash = h;
+		this->hashed = true;
+	}
+	return this->hash;
 }
 
-std::string StrValue::operator+(StrValue next) {
-	return this->StrRep + next.GetValue();
+std::string& StrValue::ToString() {
+	return GetValue();
+}
+
+std::string StrValue::operator+(StrValue& next) {
+	std::string_view a = GetView(), b = next.GetView();
+
+	std::string res;
+	res.reserve(a.size() + b.size());
+	res.append(a);
+	res.append(b);
+	return res;
 }
 
 
@@ -200,6 +415,14 @@ RunnableValue::RunnableValue(struct Chunk *ByteCode) {
 	this->StrRep = "<Script>";
 	this->arity = 0;
 
+	this->enclosing = nullptr;
+	this->BodyStart = -1;
+	this->compiled = true;
+	this->CompileFailed = false;
+	this->method = false;
+	this->generator = false;
+	this->async = false;
+
 	this->type = RUNNABLE_T;
 }
 
@@ -217,31 +440,16 @@ RunnableValue::RunnableValue(RunnableValue *enclosing, struct Chunk *ByteCode, s
 
 	for (int i = 0; i < args.size(); i++) this->locals.push_back(args[i]);
 	
-	this->FrameStart = 0; // temp value
 	this->type = RUNNABLE_T;
-}
-
-RunnableValue::RunnableValue(RunnableValue* ToCopy, Chunk *chunk, RunnableValue *enclosing, uint8_t FrameStart) {
-	// Constructor for use during runtime.
-	// The Value returned is a copy of the original RunnableValue.
-	// This allows for recursion
-	// The start slot of the callframe is also known at runtime.
 
-	this->ByteCode = chunk;
-
-	this->name = ToCopy->name;
-	this->StrRep = "<Runnable '" + name + "'>";
-	
-	this->arity = ToCopy->arity;
-	this->type = RUNNABLE_T;
-	this->locals = ToCopy->locals;
-
-	this->FrameStart = FrameStart;
-
-	this->enclosing = enclosing;
+	this->BodyStart = -1;  // set once the declaration has been scanned
+	this->compiled = false;
+	this->CompileFailed = false;
+	this->method = false;
+	this->generator = false;
+	this->async = false;
 }
 
-
 RunnableValue::~RunnableValue() {
 	delete this->ByteCode;
 	this->ByteCode = nullptr;
@@ -259,10 +467,6 @@ uint8_t RunnableValue::GetArity() {
 	return this->arity;
 }
 
-uint8_t RunnableValue::GetFrameStart() {
-	return this->FrameStart;
-}
-
 std::vector<std::string>& RunnableValue::GetLocals() {
 	return this->locals;
 }
@@ -271,6 +475,56 @@ RunnableValue* RunnableValue::GetEnclosing() {
 	return this->enclosing;
 }
 
+int RunnableValue::GetBodyStart() {
+	return this->BodyStart;
+}
+
+void RunnableValue::SetBodyStart(int offset) {
+	this->BodyStart = offset;
+}
+
+bool RunnableValue::IsCompiled() {
+	return this->compiled.load(std::memory_order_acquire);
+}
+
+void RunnableValue::SetCompiled() {
+	this->compiled.store(true, std::memory_order_release);
+}
+
+bool RunnableValue::HasCompileFailed() {
+	return this->CompileFailed;
+}
+
+void RunnableValue::SetCompileFailed() {
+	this->CompileFailed = true;
+}
+
+bool RunnableValue::IsMethod() {
+	return this->method;
+}
+
+void RunnableValue::MakeMethod(const std::string& ClassName) {
+	// Methods keep their short name for lookup, but are shown with their rat's name
+	this->method = true;
+	this->StrRep = "<Runnable '" + ClassName + "." + this->name + "'>";
+}
+
+bool RunnableValue::IsGenerator() {
+	return this->generator;
+}
+
+void RunnableValue::MakeGenerator() {
+	this->generator = true;
+}
+
+bool RunnableValue::IsAsync() {
+	return this->async;
+}
+
+void RunnableValue::MakeAsync() {
+	this->async = true;
+}
+
 uint8_t RunnableValue::AddLocal(std::string Identifier) {
 	// Add a new local variable
 
@@ -290,9 +544,11 @@ short RunnableValue::ResolveLocal(std::string Identifier) {
 }
 
 
-NativeValue::NativeValue(const std::string& name, uint8_t arity, NativeRunnable runnable) {
+NativeValue::NativeValue(const std::string& name, uint8_t arity, NativeRunnable runnable, uint8_t optional) {
 	this->type = NATIVE_T;
+	this->name = name;
 	this->arity = arity;
+	this->optional = optional;
 	this->runnable = runnable;
 
 	this->StrRep = "<Native runnable '" + name + "'>";
@@ -310,6 +566,934 @@ uint8_t NativeValue::GetArity() {
 	return this->arity;
 }
 
+uint8_t NativeValue::GetOptional() {
+	return this->optional;
+}
+
 std::string& NativeValue::GetName() {
 	return this->name;
+}
+
+
+FileValue::FileValue(const std::string& path, const std::string& mode) {
+	// Mode is 'r' to read, 'w' to truncate and write or 'a' to append.
+	// Check IsOpen() afterwards, the file may not have been opened
+	this->type = FILE_T;
+	this->StrRep = "<File '" + path + "'>";
+
+	int flags = O_RDONLY;
+	if (mode == "w") flags = O_WRONLY | O_CREAT | O_TRUNC;
+	else if (mode == "a") flags = O_WRONLY | O_CREAT | O_APPEND;
+
+	this->writable = (flags != O_RDONLY);
+	this->owned = true;
+	this->lock = nullptr;
+	this->fd = open(path.c_str(), flags | O_CLOEXEC, 0644);
+
+	this->buffer = (this->fd == -1) ? nullptr : new char[BufferSize];
+	this->start = 0;
+	this->end = 0;
+}
+
+static std::mutex StandardLocks[3];	// stdin, stdout and stderr
+
+FileValue::FileValue(int fd, const std::string& name, bool writable) {
+	this->type = FILE_T;
+	this->StrRep = "<File '" + name + "'>";
+
+	this->fd = fd;
+	this->writable = writable;
+	this->owned = false;
+	this->lock = (fd >= 0 && fd <= STDERR_FILENO) ? &StandardLocks[fd] : nullptr;
+
+	this->buffer = new char[BufferSize];
+	this->start = 0;
+	this->end = 0;
+}
+
+FileValue::~FileValue() {
+	Close();  // errors can't be reported from here
+}
+
+FileValue* FileValue::Stdin() {
+	static FileValue* input = [] {
+		FileValue* f = new FileValue(STDIN_FILENO, "<stdin>", false);
+		f->MakeConstant();  // handed to scripts by InputLines(), but never freed by them
+		return f;
+	}();
+	return input;
+}
+
+std::unique_lock<std::mutex> FileValue::Guard() {
+	if (this->lock == nullptr) return std::unique_lock<std::mutex>();
+	return std::unique_lock<std::mutex>(*this->lock);
+}
+
+bool FileValue::IsOpen() {
+	return this->fd != -1;
+}
+
+bool FileValue::IsWritable() {
+	return this->writable;
+}
+
+bool FileValue::WriteAll(const char* data, size_t size) {
+	std::unique_lock<std::mutex> guard = Guard();
+	while (size > 0) {
+		ssize_t n = write(this->fd, data, size);
+		if (n == -1) {
+			if (errno == EINTR) continue;
+			return false;
+		}
+		data += n;
+		size -= n;
+	}
+	return true;
+}
+
+bool FileValue::Write(std::string_view s) {
+	// Collect writes in the buffer, so that a script writing line by line makes few system calls
+	if (this->end + s.size() > BufferSize) {
+		if (!Flush()) return false;
+
+		// too large to be worth buffering
+		if (s.size() >= BufferSize) return WriteAll(s.data(), s.size());
+	}
+
+	memcpy(this->buffer + this->end, s.data(), s.size());
+	this->end += s.size();
+	return true;
+}
+
+bool FileValue::WriteLine(std::string_view s) {
+	// Flushing only ahead of a whole line keeps it in one block, so lines printed by other threads can't split it
+	if (this->end + s.size() + 1 > BufferSize) {
+		if (!Flush()) return false;
+
+		if (s.size() + 1 >= BufferSize) {
+			std::string line(s);
+			line += '\n';
+			return WriteAll(line.data(), line.size());
+		}
+	}
+
+	memcpy(this->buffer + this->end, s.data(), s.size());
+	this->end += s.size();
+	this->buffer[this->end++] = '\n';
+	return true;
+}
+
+bool FileValue::ReadLine(std::string& line, bool& eof) {
+	// Read up to the next newline, which is dropped. Sets eof if the file ended before any character was read
+	std::unique_lock<std::mutex> guard = Guard();
+	line.clear();
+	eof = false;
+
+	while (true) {
+		if (this->start == this->end) {
+			ssize_t n = read(this->fd, this->buffer, BufferSize);
+			if (n == -1) {
+				if (errno == EINTR) continue;
+				return false;
+			}
+			if (n == 0) {
+				eof = line.empty();
+				return true;
+			}
+
+			this->start = 0;
+			this->end = n;
+		}
+
+		char* from = this->buffer + this->start;
+		char* newline = (char*)memchr(from, '\n', this->end - this->start);
+		if (newline != nullptr) {
+			line.append(from, newline - from);
+			this->start = newline - this->buffer + 1;
+			return true;
+		}
+
+		line.append(from, this->end - this->start);
+		this->start = this->end;
+	}
+}
+
+bool FileValue::ReadChunk(std::string& chunk, size_t size) {
+	// Read size bytes, or fewer if the file ends first. chunk is left empty at end of file
+	std::unique_lock<std::mutex> guard = Guard();
+	chunk.resize(size);
+	size_t used = 0;
+
+	while (used < size) {
+		if (this->start < this->end) {
+			size_t available = std::min(size - used, (size_t)(this->end - this->start));
+			memcpy(&chunk[used], this->buffer + this->start, available);
+			this->start += available;
+			used += available;
+			continue;
+		}
+
+		// Large reads go straight into the string, the buffer would only add a copy
+		bool direct = (size - used >= BufferSize);
+		ssize_t n = direct ? read(this->fd, &chunk[used], size - used) : read(this->fd, this->buffer, BufferSize);
+		if (n == -1) {
+			if (errno == EINTR) continue;
+			chunk.resize(used);
+			return false;
+		}
+		if (n == 0) break;
+
+		if (direct) used += n;
+		else {
+			this->start = 0;
+			this->end = n;
+		}
+	}
+
+	chunk.resize(used);
+	return true;
+}
+
+bool FileValue::ReadRest(std::string& rest) {
+	// Read everything up to the end of the file, in blocks that grow with the input
+	std::unique_lock<std::mutex> guard = Guard();
+	rest.assign(this->buffer + this->start, this->end - this->start);
+	this->start = this->end = 0;
+
+	size_t used = rest.size();
+	rest.resize(std::max(used * 2, (size_t)BufferSize));
+	while (true) {
+		if (used == rest.size()) rest.resize(rest.size() * 2);
+
+		ssize_t n = read(this->fd, &rest[used], rest.size() - used);
+		if (n > 0) used += n;
+		else if (n == 0) break;
+		else if (errno != EINTR) {
+			rest.resize(used);
+			return false;
+		}
+	}
+
+	rest.resize(used);
+	return true;
+}
+
+bool FileValue::Flush() {
+	if (!this->writable || this->end == 0) return true;
+
+	bool success = WriteAll(this->buffer, this->end);
+	this->end = 0;
+	return success;
+}
+
+bool FileValue::Close() {
+	if (this->fd == -1) return true;
+
+	bool success = Flush();
+	if (this->owned && close(this->fd) == -1) success = false;
+
+	this->fd = -1;
+	delete[] this->buffer;
+	this->buffer = nullptr;
+	return success;
+}
+
+
+FutureValue::State::State() {
+	this->done = false;
+}
+
+FutureValue::State::~State() {
+	FreeDetached(this->result);  // never awaited
+}
+
+void FutureValue::State::Complete(Value result, const std::string& error) {
+	std::vector<Task*> parked;
+	std::vector<std::shared_ptr<Wakeup>> loops;
+	{
+		std::lock_guard<std::mutex> guard(this->lock);
+		this->result = result;
+		this->error = error;
+		this->done = true;
+		parked.swap(this->waiters);
+		loops.swap(this->wakeups);
+	}
+	this->ready.notify_all();
+
+	for (Task* task : parked) Scheduler::Get()->Wake(task);
+	for (std::shared_ptr<Wakeup>& loop : loops) loop->Signal();
+}
+
+
+FutureValue::FutureValue(const std::string& operation, bool spawned) {
+	this->type = FUTURE_T;
+	this->StrRep = "<Future '" + operation + "'>";
+
+	this->state = std::make_shared<State>();
+	this->awaited = false;
+	this->spawned = spawned;
+}
+
+std::shared_ptr<FutureValue::State> FutureValue::GetState() {
+	return this->state;
+}
+
+bool FutureValue::IsSpawned() {
+	return this->spawned;
+}
+
+bool FutureValue::Ready(Task* waiter) {
+	std::lock_guard<std::mutex> guard(this->state->lock);
+	if (this->state->done) return true;
+
+	this->state->waiters.push_back(waiter);
+	return false;
+}
+
+bool FutureValue::Notify(std::shared_ptr<Wakeup> wakeup) {
+	std::lock_guard<std::mutex> guard(this->state->lock);
+	if (this->state->done) return true;
+
+	this->state->wakeups.push_back(wakeup);
+	return false;
+}
+
+bool FutureValue::IsDone() {
+	if (this->awaited) return true;
+
+	std::lock_guard<std::mutex> guard(this->state->lock);
+	return this->state->done;
+}
+
+Value FutureValue::Wait(std::string& error) {
+	std::unique_lock<std::mutex> guard(this->state->lock);
+	this->state->ready.wait(guard, [this] { return this->state->done; });
+
+	error = this->state->error;
+
+	Value result = this->state->result;
+	this->state->result.SetAsNone();
+	return result;
+}
+
+bool FutureValue::IsAwaited() {
+	return this->awaited;
+}
+
+void FutureValue::SetResult(Value v) {
+	this->value = v;
+	this->awaited = true;
+	if (v.IsObject()) v.GetObjectValue()->AddReference();
+}
+
+Value FutureValue::GetResult() {
+	return this->value;
+}
+
+
+ChannelValue::State::State(size_t capacity) {
+	this->capacity = capacity;
+}
+
+ChannelValue::State::~State() {
+	for (size_t i = 0; i < this->items.size(); i++) FreeDetached(this->items[i]);  // never received
+}
+
+void ChannelValue::State::Changed(std::unique_lock<std::mutex>& guard) {
+	// Everything waiting tries again, since a value that was sent or received may let either side go on
+	std::vector<Task*> parked;
+	parked.swap(this->waiters);
+	guard.unlock();
+
+	this->changed.notify_all();
+	for (Task* task : parked) Scheduler::Get()->Wake(task);
+}
+
+
+ChannelValue::ChannelValue(size_t capacity) {
+	this->type = CHANNEL_T;
+	this->StrRep = "<Channel of " + std::to_string(capacity) + ">";
+
+	this->state = std::make_shared<State>(capacity);
+}
+
+ChannelValue::ChannelValue(ChannelValue& other) {
+	this->type = CHANNEL_T;
+	this->StrRep = other.StrRep;
+
+	this->state = other.state;
+}
+
+bool ChannelValue::Send(Value v, Task* waiter) {
+	std::unique_lock<std::mutex> guard(this->state->lock);
+	while (this->state->items.size() >= this->state->capacity) {
+		if (waiter != nullptr) {
+			this->state->waiters.push_back(waiter);
+			return false;
+		}
+		this->state->changed.wait(guard);
+	}
+
+	this->state->items.push_back(v);
+	this->state->Changed(guard);
+	return true;
+}
+
+bool ChannelValue::Receive(Value& v, Task* waiter) {
+	std::unique_lock<std::mutex> guard(this->state->lock);
+	while (this->state->items.empty()) {
+		if (waiter != nullptr) {
+			this->state->waiters.push_back(waiter);
+			return false;
+		}
+		this->state->changed.wait(guard);
+	}
+
+	v = this->state->items.front();
+	this->state->items.pop_front();
+	this->state->Changed(guard);
+	return true;
+}
+
+
+void DetachedObjects(Value& v, std::vector<ObjectValue*>& objects) {
+	// Detached values are made of strings, lists, maps and channels. Constants belong to a chunk, and are left out
+	std::unordered_set<ObjectValue*> seen;
+	std::vector<Value> pending = { v };
+
+	while (!pending.empty()) {
+		Value next = pending.back();
+		pending.pop_back();
+		if (!next.IsObject() || next.GetObjectValue()->IsConstant()) continue;
+
+		ObjectValue* o = next.GetObjectValue();
+		if (!seen.insert(o).second) continue;  // shared, or part of a cycle
+		objects.push_back(o);
+
+		if (o->IsList()) {
+			std::vector<Value>& items = ((ListValue*)o)->GetItems();
+			pending.insert(pending.end(), items.begin(), items.end());
+		}
+		else if (o->IsMap()) {
+			std::vector<MapValue::Entry>& entries = ((MapValue*)o)->GetEntries();
+			for (size_t i = 0; i < entries.size(); i++) {
+				if (entries[i].distance == 0) continue;
+				pending.push_back(entries[i].key);
+				pending.push_back(entries[i].value);
+			}
+		}
+	}
+}
+
+void FreeDetached(Value& v) {
+	std::vector<ObjectValue*> objects;
+	DetachedObjects(v, objects);
+	for (ObjectValue* o : objects) delete o;
+
+	v.SetAsNone();
+}
+
+
+ListValue::ListValue() {
+	this->type = LIST_T;
+	this->storage = INTEGERS;	// an empty list takes whichever kind of number comes first
+	this->printing = false;
+}
+
+ListValue::ListValue(std::vector<double>& numbers) {
+	this->type = LIST_T;
+	this->storage = NUMBERS;
+	this->printing = false;
+
+	this->numbers.swap(numbers);
+}
+
+ListValue::ListValue(std::vector<int64_t>& integers) {
+	this->type = LIST_T;
+	this->storage = INTEGERS;
+	this->printing = false;
+
+	this->integers.swap(integers);
+}
+
+void ListValue::Box() {
+	if (this->storage == INTEGERS) {
+		this->items.reserve(this->integers.capacity());
+		for (int64_t i : this->integers) this->items.push_back(Value(i));
+	}
+	else {
+		this->items.reserve(this->numbers.capacity());
+		for (double n : this->numbers) this->items.push_back(Value(n));
+	}
+
+	this->integers = std::vector<int64_t>();
+	this->numbers = std::vector<double>();
+	this->storage = BOXED;
+}
+
+bool ListValue::Unboxes(Value& v) {
+	// Whether v can be stored without boxing the list. An empty list switches to v's kind of number
+	if (this->storage == BOXED) return false;
+
+	Storage kind;
+	if (v.GetType() == Value::INT_T) kind = INTEGERS;
+	else if (v.GetType() == Value::NUM_T) kind = NUMBERS;
+	else return false;
+
+	if (kind != this->storage && Size() == 0) this->storage = kind;
+	return kind == this->storage;
+}
+
+size_t ListValue::Size() {
+	switch (this->storage) {
+		case INTEGERS:	return this->integers.size();
+		case NUMBERS:	return this->numbers.size();
+		default:		return this->items.size();
+	}
+}
+
+bool ListValue::IsUnboxed() {
+	return this->storage != BOXED;
+}
+
+bool ListValue::HoldsIntegers() {
+	return this->storage == INTEGERS;
+}
+
+Value ListValue::Get(size_t index) {
+	switch (this->storage) {
+		case INTEGERS:	return Value(this->integers[index]);
+		case NUMBERS:	return Value(this->numbers[index]);
+		default:		return this->items[index];
+	}
+}
+
+Value ListValue::Set(size_t index, Value v) {
+	Value old = Get(index);
+	if (Unboxes(v)) {
+		if (this->storage == INTEGERS) this->integers[index] = v.GetInt();
+		else this->numbers[index] = v.GetNum();
+		return old;
+	}
+
+	if (this->storage != BOXED) Box();
+	this->items[index] = v;
+	return old;
+}
+
+void ListValue::Push(Value v) {
+	if (Unboxes(v)) {
+		if (this->storage == INTEGERS) this->integers.push_back(v.GetInt());
+		else this->numbers.push_back(v.GetNum());
+		return;
+	}
+
+	if (this->storage != BOXED) Box();
+	this->items.push_back(v);
+}
+
+Value ListValue::Pop() {
+	Value v = Get(Size() - 1);
+	switch (this->storage) {
+		case INTEGERS:	this->integers.pop_back();	break;
+		case NUMBERS:	this->numbers.pop_back();	break;
+		default:		this->items.pop_back();		break;
+	}
+	return v;
+}
+
+std::vector<Value>& ListValue::GetItems() {
+	return this->items;
+}
+
+std::vector<double>& ListValue::GetNumbers() {
+	return this->numbers;
+}
+
+std::vector<int64_t>& ListValue::GetIntegers() {
+	return this->integers;
+}
+
+std::string& ListValue::ToString() {
+	if (this->printing) {
+		this->StrRep = "[...]";
+		return this->StrRep;
+	}
+	this->printing = true;
+
+	std::string s = "[";
+	size_t size = Size();
+	for (size_t i = 0; i < size; i++) {
+		if (i > 0) s += ", ";
+
+		Value v = Get(i);
+		if (v.IsObject() && v.GetObjectValue()->IsString()) s += "\"" + v.ToString() + "\"";
+		else s += v.ToString();
+	}
+	s += "]";
+
+	this->printing = false;
+	this->StrRep = s;
+	return this->StrRep;
+}
+
+
+MapValue::MapValue() {
+	this->type = MAP_T;
+	this->entries.resize(8);
+	this->count = 0;
+	this->printing = false;
+}
+
+bool MapValue::IsHashable(Value& key) {
+	switch (key.GetType()) {
+		case Value::NUM_T:
+		case Value::INT_T:
+		case Value::BOOL_T:		return true;
+		case Value::OBJECT_T:	return key.GetObjectValue()->IsString();
+		default:				return false;
+	}
+}
+
+size_t MapValue::Hash(Value& key) {
+	switch (key.GetType()) {
+		case Value::INT_T:	return std::hash<int64_t>()(key.GetInt());
+		case Value::NUM_T: {
+			// A whole double hashes like the integer it equals, since they're the same key
+			double n = key.GetNum();
+			if (n == (double)(int64_t)n && n >= -9.2e18 && n <= 9.2e18) return std::hash<int64_t>()((int64_t)n);
+			return std::hash<double>()(n);  // 0 and -0 hash the same
+		}
+		case Value::BOOL_T:	return key.GetBool() ? 0x9e3779b97f4a7c15 : 0x7f4a7c159e3779b9;
+		default:			return ((StrValue*)key.GetObjectValue())->Hash();
+	}
+}
+
+bool MapValue::KeysEqual(Value& a, Value& b) {
+	if (a.IsNumber() && b.IsNumber()) {
+		if (a.IsInt() && b.IsInt()) return a.GetInt() == b.GetInt();
+		return a.GetNum() == b.GetNum();
+	}
+	if (a.GetType() != b.GetType()) return false;
+
+	switch (a.GetType()) {
+		case Value::BOOL_T:	return a.GetBool() == b.GetBool();
+		default: {
+			ObjectValue* o1 = a.GetObjectValue();
+			ObjectValue* o2 = b.GetObjectValue();
+			return o1 == o2 || (o2->IsString() && ((StrValue*)o1)->GetView() == ((StrValue*)o2)->GetView());
+		}
+	}
+}
+
+size_t MapValue::Size() {
+	return this->count;
+}
+
+size_t MapValue::Find(Value& key, size_t hash) {
+	size_t mask = this->entries.size() - 1;
+	size_t slot = hash & mask;
+
+	// Entries are ordered by distance along a probe sequence, so the key isn't there
+	// once a slot holds an entry that is closer to home than the key would be
+	for (uint32_t distance = 1; this->entries[slot].distance >= distance; distance++) {
+		Entry& e = this->entries[slot];
+		if (e.hash == hash && KeysEqual(e.key, key)) return slot;
+		slot = (slot + 1) & mask;
+	}
+	return NotFound;
+}
+
+void MapValue::Insert(Entry& entry) {
+	// Place an entry whose key isn't in the table yet
+	size_t mask = this->entries.size() - 1;
+	size_t slot = entry.hash & mask;
+	entry.distance = 1;
+
+	while (this->entries[slot].distance != 0) {
+		if (this->entries[slot].distance < entry.distance) std::swap(this->entries[slot], entry);
+		slot = (slot + 1) & mask;
+		entry.distance++;
+	}
+	this->entries[slot] = entry;
+}
+
+void MapValue::Grow() {
+	std::vector<Entry> old = std::move(this->entries);
+	this->entries = std::vector<Entry>(old.size() * 2);
+
+	for (size_t i = 0; i < old.size(); i++) {
+		if (old[i].distance != 0) Insert(old[i]);
+	}
+}
+
+bool MapValue::Get(Value& key, Value& value) {
+	size_t slot = Find(key, Hash(key));
+	if (slot == NotFound) return false;
+
+	value = this->entries[slot].value;
+	return true;
+}
+
+bool MapValue::Set(Value& key, Value& value, Value& old) {
+	size_t hash = Hash(key);
+	size_t slot = Find(key, hash);
+	if (slot != NotFound) {
+		old = this->entries[slot].value;
+		this->entries[slot].value = value;
+		return true;
+	}
+
+	if ((this->count + 1) * 8 > this->entries.size() * 7) Grow();  // keep the load under 7/8
+
+	Entry entry = { key, value, hash, 0 };
+	Insert(entry);
+	this->count++;
+	return false;
+}
+
+bool MapValue::Remove(Value& key, Value& OldKey, Value& OldValue) {
+	size_t slot = Find(key, Hash(key));
+	if (slot == NotFound) return false;
+
+	OldKey = this->entries[slot].key;
+	OldValue = this->entries[slot].value;
+
+	// Shift the rest of the probe sequence back by one, instead of leaving a tombstone
+	size_t mask = this->entries.size() - 1;
+	size_t next = (slot + 1) & mask;
+	while (this->entries[next].distance > 1) {
+		this->entries[slot] = this->entries[next];
+		this->entries[slot].distance--;
+		slot = next;
+		next = (next + 1) & mask;
+	}
+	this->entries[slot] = Entry{ Value(), Value(), 0, 0 };
+
+	this->count--;
+	return true;
+}
+
+bool MapValue::NextKey(size_t& position, Value& key) {
+	while (position < this->entries.size()) {
+		Entry& e = this->entries[position++];
+		if (e.distance != 0) {
+			key = e.key;
+			return true;
+		}
+	}
+	return false;
+}
+
+std::vector<MapValue::Entry>& MapValue::GetEntries() {
+	return this->entries;
+}
+
+std::string& MapValue::ToString() {
+	if (this->printing) {
+		this->StrRep = "{...}";
+		return this->StrRep;
+	}
+	this->printing = true;
+
+	std::string s = "{";
+	bool first = true;
+	for (size_t i = 0; i < this->entries.size(); i++) {
+		Entry& e = this->entries[i];
+		if (e.distance == 0) continue;
+
+		if (!first) s += ", ";
+		first = false;
+
+		Value* parts[2] = { &e.key, &e.value };
+		for (int j = 0; j < 2; j++) {
+			Value& v = *parts[j];
+			if (v.IsObject() && v.GetObjectValue()->IsString()) s += "\"" + v.ToString() + "\"";
+			else s += v.ToString();
+
+			if (j == 0) s += ": ";
+		}
+	}
+	s += "}";
+
+	this->printing = false;
+	this->StrRep = s;
+	return this->StrRep;
+}
+
+
+IteratorValue::IteratorValue(ObjectValue* container) {
+	this->type = ITERATOR_T;
+	this->StrRep = "<Iterator>";
+
+	this->container = container;
+	this->position = 0;
+}
+
+ObjectValue* IteratorValue::GetContainer() {
+	return this->container;
+}
+
+bool IteratorValue::Next(Value& next) {
+	// The container may change while it's iterated, so its size is checked on every step
+	if (this->container->IsMap()) return ((MapValue*)this->container)->NextKey(this->position, next);
+
+	ListValue* list = (ListValue*)this->container;
+	if (this->position >= list->Size()) return false;
+
+	next = list->Get(this->position++);
+	return true;
+}
+
+
+GeneratorValue::GeneratorValue(RunnableValue* runnable, FutureValue* future) {
+	this->type = GENERATOR_T;
+	this->StrRep = "<Generator '" + runnable->GetName() + "'>";
+
+	this->runnable = runnable;
+	this->ip = 0;
+	this->state = SUSPENDED;
+
+	this->future = future;
+	this->awaited = nullptr;
+}
+
+RunnableValue* GeneratorValue::GetRunnable() {
+	return this->runnable;
+}
+
+std::vector<Value>& GeneratorValue::GetSlots() {
+	return this->slots;
+}
+
+short GeneratorValue::GetIp() {
+	return this->ip;
+}
+
+GeneratorValue::State GeneratorValue::GetState() {
+	return this->state;
+}
+
+FutureValue* GeneratorValue::GetFuture() {
+	return this->future;
+}
+
+FutureValue* GeneratorValue::GetAwaited() {
+	return this->awaited;
+}
+
+void GeneratorValue::Suspend(short ip, FutureValue* awaited) {
+	this->ip = ip;
+	this->awaited = awaited;
+	this->state = (awaited != nullptr) ? WAITING : SUSPENDED;
+}
+
+void GeneratorValue::SetState(State state) {
+	this->state = state;
+}
+
+
+
+short Shape::Find(const std::string& field) {
+	auto slot = this->slots.find(field);
+	if (slot == this->slots.end()) return -1;
+	return slot->second;
+}
+
+
+ClassValue::ClassValue(const std::string& name) {
+	this->type = CLASS_T;
+	this->name = name;
+	this->StrRep = "<Rat '" + name + "'>";
+
+	this->root = new Shape();
+	this->shapes.push_back(this->root);
+}
+
+ClassValue::~ClassValue() {
+	for (Shape* s : this->shapes) delete s;
+}
+
+std::string& ClassValue::GetName() {
+	return this->name;
+}
+
+void ClassValue::AddMethod(RunnableValue* method) {
+	this->methods[method->GetName()] = method;
+}
+
+RunnableValue* ClassValue::FindMethod(const std::string& name) {
+	auto method = this->methods.find(name);
+	if (method == this->methods.end()) return nullptr;
+	return method->second;
+}
+
+Shape* ClassValue::GetRoot() {
+	return this->root;
+}
+
+Shape* ClassValue::Transition(Shape* from, const std::string& field) {
+	// The shape of an instance with from's fields, after 'field' is assigned to it for the first time.
+	// Made on the first such assignment, and shared by every instance that follows the same path
+	auto next = from->transitions.find(field);
+	if (next != from->transitions.end()) return next->second;
+
+	Shape* to = new Shape();
+	to->names = from->names;
+	to->slots = from->slots;
+
+	to->slots[field] = (uint16_t)to->names.size();
+	to->names.push_back(field);
+
+	from->transitions[field] = to;
+	this->shapes.push_back(to);
+	return to;
+}
+
+
+InstanceValue::InstanceValue(ClassValue* klass) {
+	this->type = INSTANCE_T;
+	this->klass = klass;
+	this->shape = klass->GetRoot();
+	this->printing = false;
+}
+
+ClassValue* InstanceValue::GetClass() {
+	return this->klass;
+}
+
+Shape* InstanceValue::GetShape() {
+	return this->shape;
+}
+
+std::vector<Value>& InstanceValue::GetFields() {
+	return this->fields;
+}
+
+void InstanceValue::AddField(Shape* next, Value v) {
+	this->shape = next;
+	this->fields.push_back(v);
+}
+
+std::string& InstanceValue::ToString() {
+	if (this->printing) {
+		this->StrRep = this->klass->GetName() + "(...)";
+		return this->StrRep;
+	}
+	this->printing = true;
+
+	std::string s = this->klass->GetName() + "(";
+	for (size_t i = 0; i < this->fields.size(); i++) {
+		if (i > 0) s += ", ";
+		s += this->shape->names[i] + ": ";
+
+		Value& v = this->fields[i];
+		if (v.IsObject() && v.GetObjectValue()->IsString()) s += "\"" + v.ToString() + "\"";
+		else s += v.ToString();
+	}
+	s += ")";
+
+	this->printing = false;
+	this->StrRep = s;
+	return this->StrRep;
 }
\ No newline at end of file
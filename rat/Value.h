@@ -1,15 +1,29 @@
 #pragma once
 #include <string>
+#include <cstdint>
+#include <string_view>
 #include <sstream>
 #include <vector>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <unordered_map>
+#include <deque>
+
+// Marks the classes of the embedding API, the only symbols the shared library exports
+#define HOTRAT_API __attribute__((visibility("default")))
 
 class ObjectValue;
+class Task;
+struct Wakeup;
 
-class Value {
+class HOTRAT_API Value {
 public:
 	typedef enum datatype{
 		NONE_T,
-		NUM_T,
+		NUM_T,	// double
+		INT_T,	// 64-bit integer
 		BOOL_T,
 		OBJECT_T,
 	} datatype;
@@ -19,7 +33,8 @@ protected:
 	std::string StrRep;
 	
 	typedef union data {
-		float n;
+		double n;
+		int64_t i;
 		bool b;
 		ObjectValue* o;
 	};
@@ -28,23 +43,28 @@ protected:
 
 public:
 	Value();
-	Value(float f);
+	Value(double f);
+	Value(int64_t i);
 	Value(bool b);
 	Value(ObjectValue *o);
 
 	~Value();
 
-	void SetValue(float n);
+	void SetValue(double n);
+	void SetValue(int64_t i);
 	void SetValue(bool b);
 	void SetValue(ObjectValue* o);
 	void SetAsNone();
 
-	float GetNum();
+	double GetNum();	// an integer is converted
+	int64_t GetInt();
 	bool GetBool();
 	ObjectValue* GetObjectValue();
 	bool IsNone();
 
 	bool IsObject();
+	bool IsNumber();	// a double or an integer
+	bool IsInt();
 
 	datatype GetType();
 
@@ -58,7 +78,16 @@ public:
 	typedef enum ObjectType{
 		STRING_T,
 		RUNNABLE_T,
-		NATIVE_T
+		NATIVE_T,
+		FILE_T,
+		FUTURE_T,
+		LIST_T,
+		MAP_T,
+		ITERATOR_T,
+		CLASS_T,
+		INSTANCE_T,
+		CHANNEL_T,
+		GENERATOR_T
 	} ObjectType;
 
 protected:
@@ -67,32 +96,87 @@ protected:
 
 	ObjectType type;
 	int references;
+	bool constant;	// owned by a chunk and shared between interpreters, never reference counted
+	unsigned mark;	// the last collection cycle that found it reachable
 
 public:
 	ObjectValue();
+	virtual ~ObjectValue();
 
 	ObjectType GetType();
-	std::string& ToString();
+	virtual std::string& ToString();
 	
 	bool IsString();
 	bool IsRunnable();
 	bool IsNative();
+	bool IsFile();
+	bool IsFuture();
+	bool IsList();
+	bool IsMap();
+	bool IsClass();
+	bool IsInstance();
+	bool IsChannel();
+	bool IsGenerator();
 
 	void SetNext(ObjectValue* obj);
 	ObjectValue *GetNext();
 
 	void AddReference();
 	bool DeleteReference();
+	bool IsShared();	// something other than the current holder may see changes to it
+
+	void MakeConstant();
+	bool IsConstant();
+
+	unsigned GetMark();
+	void SetMark(unsigned cycle);
+};
+
+// Immutable bytes shared by a string and the slices taken from it: a file mapped by ReadFromFile,
+// or the former contents of a string that was sliced
+struct SharedBytes {
+	std::string owned;
+	const char* mapping;
+	size_t MapSize;
+
+	SharedBytes(std::string& s);	// takes s's contents, leaving it empty
+	SharedBytes(const char* mapping, size_t size);	// takes ownership of an mmap'ed region
+	~SharedBytes();
 };
 
 class StrValue : public ObjectValue {
+	// A string either owns its text in StrRep, where std::string keeps short strings inline in the object,
+	// or views a range of shared bytes. A viewed string gets a private copy the first time it's modified
+	// or asked for an std::string, and the bytes are freed with the last string viewing them
+protected:
+	std::shared_ptr<SharedBytes> shared;
+	const char* view;
+	size_t ViewSize;
+
+	size_t hash;	// cached for map lookups, reset whenever the contents change
+	bool hashed;
+
+	void Unshare();
+
 public:
+	static const size_t InlineSize = 15;	// slices this short are copied, they fit inside the object
+
 	StrValue(const std::string& value);
+	StrValue(const char* mapping, size_t size);	// takes ownership of an mmap'ed region
+	StrValue(StrValue& parent, size_t start, size_t length);	// slice, sharing the parent's bytes
+	~StrValue();
 
 	std::string& GetValue();
+	std::string_view GetView();
 	void SetValue(const std::string& s);
+	void Swap(std::string& s);	// exchange contents with s, without copying either
+	void Append(std::string_view s);
 
-	std::string operator+(StrValue next);
+	size_t Hash();
+
+	std::string& ToString();
+
+	std::string operator+(StrValue& next);
 };
 
 
@@ -106,21 +190,42 @@ protected:
 	RunnableValue* enclosing;
 	
 	std::vector<std::string> locals;
-	uint8_t FrameStart; // index at which the frame starts
+
+	int BodyStart;	// offset of the body's first token, compiled on the first call
+	std::atomic<bool> compiled;  // set once by whichever interpreter compiles the body first
+	bool CompileFailed;	// its body had a compilation error, which was reported once. Guarded by the compiler's LazyLock
+
+	bool method;	// declared inside a rat, called on an instance that it sees as 'this'
+	bool generator;	// its body yields, so a call makes a generator instead of running it. Set when it's compiled
+	bool async;		// declared 'async', so a call starts it on the event loop and gives a future
 
 public:
 	RunnableValue(struct Chunk *ByteCode); // for initializing the script
 	RunnableValue(RunnableValue* enclosing, struct Chunk *ByteCode, std::vector<std::string>& args, const std::string& name);	// for use during compile time
-	RunnableValue(RunnableValue* ToCopy, Chunk *chunk, RunnableValue *enclosing, uint8_t FrameStart);	// for use during the runtime
 	~RunnableValue();
 
 	Chunk* GetChunk();
 	std::string& GetName();
 	uint8_t GetArity();
 	RunnableValue* GetEnclosing();
-	uint8_t GetFrameStart();
 	std::vector<std::string>& GetLocals();
 
+	int GetBodyStart();
+	void SetBodyStart(int offset);
+	bool IsCompiled();
+	void SetCompiled();
+	bool HasCompileFailed();
+	void SetCompileFailed();
+
+	bool IsMethod();
+	void MakeMethod(const std::string& ClassName);
+
+	bool IsGenerator();
+	void MakeGenerator();
+
+	bool IsAsync();
+	void MakeAsync();
+
 	uint8_t AddLocal(std::string Identifier);
 	short ResolveLocal(std::string Identifier);
 };
@@ -133,13 +238,327 @@ class NativeValue : public ObjectValue {
 private:
 	std::string name;
 	uint8_t arity;
+	uint8_t optional;	// how many of the last parameters may be left out. They're passed as none
 	NativeRunnable runnable;
 
 public:
-	NativeValue(const std::string& name, uint8_t arity, NativeRunnable value);
+	NativeValue(const std::string& name, uint8_t arity, NativeRunnable value, uint8_t optional = 0);
 	~NativeValue();
 
 	NativeRunnable GetRunnable();
 	uint8_t GetArity();
+	uint8_t GetOptional();
 	std::string& GetName();
+};
+
+
+class FileValue : public ObjectValue {
+public:
+	static const int BufferSize = 1 << 17;
+
+protected:
+	int fd;
+	bool writable;	// opened with mode 'w' or 'a', otherwise for reading
+	bool owned;		// false for descriptors that were already open, like stdout. Those are never closed
+
+	char* buffer;
+	int start, end;	// buffered bytes not yet handed to the script (reading) or to the OS (writing)
+
+	// For the standard descriptors, which every interpreter uses: held while reading into or from stdin's
+	// shared buffer, and while writing a block to stdout, so blocks of whole lines from different threads don't mix
+	std::mutex* lock;
+	std::unique_lock<std::mutex> Guard();
+
+	bool WriteAll(const char* data, size_t size);
+
+public:
+	FileValue(const std::string& path, const std::string& mode);
+	FileValue(int fd, const std::string& name, bool writable);	// buffers an already open descriptor
+	~FileValue();
+
+	static FileValue* Stdin();	// the one handle on stdin, so no interpreter's buffer reads ahead of the others
+
+	bool IsOpen();
+	bool IsWritable();
+
+	bool Write(std::string_view s);
+	bool WriteLine(std::string_view s);	// s and a newline, never flushed apart
+	bool ReadLine(std::string& line, bool& eof);
+	bool ReadChunk(std::string& chunk, size_t size);
+	bool ReadRest(std::string& rest);
+	bool Flush();
+	bool Close();
+};
+
+
+class FutureValue : public ObjectValue {
+public:
+	// Shared with the worker thread that produces the result, so either side can let go of it first
+	struct State {
+		std::mutex lock;
+		std::condition_variable ready;
+		bool done;
+
+		Value result;	// detached, owned by no interpreter until it's awaited
+		std::string error;
+
+		std::vector<Task*> waiters;	// tasks parked until it's done
+		std::vector<std::shared_ptr<Wakeup>> wakeups;	// event loops waiting for it
+
+		State();
+		~State();
+
+		void Complete(Value result, const std::string& error);
+	};
+
+protected:
+	std::shared_ptr<State> state;
+
+	Value value;	// the result once it was awaited. The future holds a reference to it
+	bool awaited;
+	bool spawned;	// the future of a task, which a waiting task parks on instead of blocking its worker
+
+public:
+	FutureValue(const std::string& operation, bool spawned = false);
+
+	std::shared_ptr<State> GetState();
+	bool IsSpawned();
+
+	bool Ready(Task* waiter);	// done, or else waiter is woken once it is
+	bool Notify(std::shared_ptr<Wakeup> wakeup);	// done, or else wakeup is signaled once it is
+	bool IsDone();	// completed, or given its result directly
+	Value Wait(std::string& error);	// blocks until the worker is done, and hands over its result
+	bool IsAwaited();
+	void SetResult(Value v);
+	Value GetResult();
+};
+
+
+class ListValue : public ObjectValue {
+	// Elements are stored contiguously. While every element is an integer, or every element is a double,
+	// they are kept unboxed in a plain array of that type. The list switches to Values for good the first
+	// time it would have to mix them, or anything else is stored.
+	// The list holds a reference to each of its objects, which the interpreter releases
+protected:
+	std::vector<int64_t> integers;
+	std::vector<double> numbers;
+	std::vector<Value> items;
+
+	enum Storage { INTEGERS, NUMBERS, BOXED } storage;
+
+	bool printing;	// guards ToString against a list that contains itself
+
+	void Box();
+	bool Unboxes(Value& v);	// v can be stored unboxed. An empty list may switch to v's kind of number for it
+
+public:
+	ListValue();
+	ListValue(std::vector<double>& numbers);	// unboxed, takes the contents of numbers
+	ListValue(std::vector<int64_t>& integers);
+
+	size_t Size();
+	bool IsUnboxed();
+	bool HoldsIntegers();	// unboxed, and every element is an integer
+
+	Value Get(size_t index);
+	Value Set(size_t index, Value v);	// returns the value that was replaced
+	void Push(Value v);
+	Value Pop();
+
+	std::vector<Value>& GetItems();	// the boxed elements, empty while the list is unboxed
+	std::vector<double>& GetNumbers();	// the unboxed doubles, empty unless the list holds them
+	std::vector<int64_t>& GetIntegers();	// the unboxed integers, empty unless the list holds them
+
+	std::string& ToString();
+};
+
+
+class MapValue : public ObjectValue {
+	// Hash table with open addressing and Robin Hood probing: an entry that is further from its ideal slot
+	// takes the place of one that is closer, so probe sequences stay short even when the table is nearly full.
+	// Keys are numbers, booleans or strings, compared by value. The map holds a reference to each of its
+	// keys and values, which the interpreter releases
+public:
+	struct Entry {
+		Value key;
+		Value value;
+		size_t hash;
+		uint32_t distance;	// 1 + distance from the entry's ideal slot. 0 marks an empty slot
+	};
+
+protected:
+	std::vector<Entry> entries;	// size is always a power of two
+	size_t count;
+
+	bool printing;	// guards ToString against a map that contains itself
+
+	size_t Find(Value& key, size_t hash);
+	void Insert(Entry& entry);
+	void Grow();
+
+public:
+	static const size_t NotFound = (size_t)-1;
+
+	MapValue();
+
+	static bool IsHashable(Value& key);
+	static size_t Hash(Value& key);
+	static bool KeysEqual(Value& a, Value& b);
+
+	size_t Size();
+
+	bool Get(Value& key, Value& value);
+	bool Set(Value& key, Value& value, Value& old);	// returns false if the key is new, otherwise sets old
+	bool Remove(Value& key, Value& OldKey, Value& OldValue);
+
+	bool NextKey(size_t& position, Value& key);	// for iteration, position starts at 0
+	std::vector<Entry>& GetEntries();
+
+	std::string& ToString();
+};
+
+
+class ChannelValue : public ObjectValue {
+	// Bounded queue of values between tasks. Every interpreter that holds the channel has its own ChannelValue,
+	// and they share one State. Values are detached from the sender's objects when they're sent
+public:
+	struct State {
+		std::mutex lock;
+		std::condition_variable changed;	// for interpreters that wait by blocking, rather than as parked tasks
+
+		std::deque<Value> items;	// detached, owned by no interpreter until they're received
+		size_t capacity;
+
+		std::vector<Task*> waiters;	// tasks parked on the channel while it was full or empty
+
+		State(size_t capacity);
+		~State();
+
+		void Changed(std::unique_lock<std::mutex>& guard);	// wakes everything waiting, and releases the lock
+	};
+
+protected:
+	std::shared_ptr<State> state;
+
+public:
+	ChannelValue(size_t capacity);
+	ChannelValue(ChannelValue& other);	// the same channel, for another interpreter
+
+	// Without a waiter these block until they can go on. With one, they return false instead of blocking,
+	// and the waiter is woken once the channel changes
+	bool Send(Value v, Task* waiter);
+	bool Receive(Value& v, Task* waiter);
+};
+
+// Objects of a value detached from its interpreter, each listed once, for handing them to another one or freeing them
+void DetachedObjects(Value& v, std::vector<ObjectValue*>& objects);
+void FreeDetached(Value& v);
+
+
+class IteratorValue : public ObjectValue {
+	// Position of a 'for' loop in a list or a map. Holds a reference to the container
+protected:
+	ObjectValue* container;
+	size_t position;
+
+public:
+	IteratorValue(ObjectValue* container);
+
+	ObjectValue* GetContainer();
+	bool Next(Value& next);	// list elements, or map keys
+};
+
+
+class GeneratorValue : public ObjectValue {
+	// A call to a runnable that yields, run a step at a time. While it's suspended it holds the stack slots
+	// of its frame, from the callee's slot to the top, and the ip to go on from. Nothing below the frame is saved.
+	// A call to an async runnable is one too, run by the event loop, which resolves its future once it returns
+public:
+	enum State {
+		SUSPENDED,	// not started yet, or stopped at a 'yield'
+		RUNNING,
+		WAITING,	// an async call stopped at an 'await', which runs again once the awaited future is done
+		FINISHED,	// returned, or failed
+	};
+
+protected:
+	RunnableValue* runnable;
+	std::vector<Value> slots;	// each holds a reference while it's here
+	short ip;
+	State state;
+
+	FutureValue* future;	// the async call's future, which it holds a reference to. nullptr for a generator
+	FutureValue* awaited;	// while it's waiting. Its reference is in the slots
+
+public:
+	GeneratorValue(RunnableValue* runnable, FutureValue* future = nullptr);
+
+	RunnableValue* GetRunnable();
+	std::vector<Value>& GetSlots();
+	short GetIp();
+	State GetState();
+	FutureValue* GetFuture();
+	FutureValue* GetAwaited();
+
+	void Suspend(short ip, FutureValue* awaited = nullptr);
+	void SetState(State state);
+};
+
+
+struct Shape {
+	// Hidden class: the fields of an instance, in the order they were first assigned, each with its slot.
+	// Instances that got the same fields in the same order share a shape, so a slot found for one of them
+	// is valid for all of them
+	std::vector<std::string> names;	// field names by slot
+	std::unordered_map<std::string, uint16_t> slots;
+	std::unordered_map<std::string, Shape*> transitions;	// shapes reached by assigning one more field
+
+	short Find(const std::string& field);	// -1 if the shape has no such field
+};
+
+
+class ClassValue : public ObjectValue {
+	// A rat declared with 'rat Name: ... endrat'. Owns the tree of shapes its instances go through,
+	// starting from the empty shape of a newly constructed instance
+protected:
+	std::string name;
+	std::unordered_map<std::string, RunnableValue*> methods;	// owned by the script's chunk
+
+	Shape* root;
+	std::vector<Shape*> shapes;
+
+public:
+	ClassValue(const std::string& name);
+	~ClassValue();
+
+	std::string& GetName();
+
+	void AddMethod(RunnableValue* method);
+	RunnableValue* FindMethod(const std::string& name);	// nullptr if there's no such method
+
+	Shape* GetRoot();
+	Shape* Transition(Shape* from, const std::string& field);
+};
+
+
+class InstanceValue : public ObjectValue {
+	// Fields are kept in a flat array, at the slots given by the instance's shape.
+	// Holds a reference to its class and to each of its objects, which the interpreter releases
+protected:
+	ClassValue* klass;
+	Shape* shape;
+	std::vector<Value> fields;
+
+	bool printing;	// guards ToString against an instance that contains itself
+
+public:
+	InstanceValue(ClassValue* klass);
+
+	ClassValue* GetClass();
+	Shape* GetShape();
+	std::vector<Value>& GetFields();
+
+	void AddField(Shape* next, Value v);	// next is the shape reached from the current one by this field
+
+	std::string& ToString();
 };
\ No newline at end of file
@@ -0,0 +1,325 @@
+#include "VectorOps.h"
+
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define VECTOR_X86
+#include <immintrin.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#define AVX_TARGET	// MSVC allows AVX intrinsics in any function
+#else
+#define AVX_TARGET __attribute__((target("avx")))
+#endif
+#endif
+
+
+bool VectorOps::HasAVX() {
+	// Checked once. The OS also has to save the wider registers on context switches
+#ifdef VECTOR_X86
+	static const bool avx = []() {
+#ifdef _MSC_VER
+		int info[4];
+		__cpuid(info, 1);
+		bool supported = (info[2] & (1 << 27)) && (info[2] & (1 << 28));
+		return supported && (_xgetbv(0) & 6) == 6;
+#else
+		return (bool)__builtin_cpu_supports("avx");
+#endif
+	}();
+	return avx;
+#else
+	return false;
+#endif
+}
+
+
+#ifdef VECTOR_X86
+
+// Horizontal reductions of a register's lanes
+
+static double SumLanes(__m128d v) {
+	return _mm_cvtsd_f64(_mm_add_sd(v, _mm_unpackhi_pd(v, v)));
+}
+
+static double MinLanes(__m128d v) {
+	return _mm_cvtsd_f64(_mm_min_sd(v, _mm_unpackhi_pd(v, v)));
+}
+
+static double MaxLanes(__m128d v) {
+	return _mm_cvtsd_f64(_mm_max_sd(v, _mm_unpackhi_pd(v, v)));
+}
+
+
+// AVX kernels, 4 numbers at a time. They return how many numbers they handled, the caller finishes the rest
+
+AVX_TARGET static size_t SumAVX(const double* a, size_t n, double& result) {
+	__m256d acc1 = _mm256_setzero_pd();
+	__m256d acc2 = _mm256_setzero_pd();
+
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		acc1 = _mm256_add_pd(acc1, _mm256_loadu_pd(a + i));
+		acc2 = _mm256_add_pd(acc2, _mm256_loadu_pd(a + i + 4));
+	}
+	for (; i + 4 <= n; i += 4) acc1 = _mm256_add_pd(acc1, _mm256_loadu_pd(a + i));
+
+	__m256d acc = _mm256_add_pd(acc1, acc2);
+	result = SumLanes(_mm_add_pd(_mm256_castpd256_pd128(acc), _mm256_extractf128_pd(acc, 1)));
+	return i;
+}
+
+AVX_TARGET static size_t MinMaxAVX(const double* a, size_t n, bool min, double& result) {
+	if (n < 4) return 0;
+
+	__m256d acc = _mm256_loadu_pd(a);
+	size_t i = 4;
+	for (; i + 4 <= n; i += 4) {
+		__m256d v = _mm256_loadu_pd(a + i);
+		acc = min ? _mm256_min_pd(acc, v) : _mm256_max_pd(acc, v);
+	}
+
+	__m128d low = _mm256_castpd256_pd128(acc);
+	__m128d high = _mm256_extractf128_pd(acc, 1);
+	result = min ? MinLanes(_mm_min_pd(low, high)) : MaxLanes(_mm_max_pd(low, high));
+	return i;
+}
+
+AVX_TARGET static size_t DotAVX(const double* a, const double* b, size_t n, double& result) {
+	__m256d acc = _mm256_setzero_pd();
+
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		acc = _mm256_add_pd(acc, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+	}
+
+	result = SumLanes(_mm_add_pd(_mm256_castpd256_pd128(acc), _mm256_extractf128_pd(acc, 1)));
+	return i;
+}
+
+AVX_TARGET static size_t AddAVX(const double* a, const double* b, double* out, size_t n) {
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) _mm256_storeu_pd(out + i, _mm256_add_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+	return i;
+}
+
+AVX_TARGET static size_t MulAVX(const double* a, const double* b, double* out, size_t n) {
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) _mm256_storeu_pd(out + i, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+	return i;
+}
+
+AVX_TARGET static size_t ScaleAVX(const double* a, double k, double* out, size_t n) {
+	__m256d factor = _mm256_set1_pd(k);
+
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) _mm256_storeu_pd(out + i, _mm256_mul_pd(_mm256_loadu_pd(a + i), factor));
+	return i;
+}
+
+AVX_TARGET static size_t WhereAVX(const double* mask, const double* a, const double* b, double* out, size_t n) {
+	__m256d zero = _mm256_setzero_pd();
+
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m256d chosen = _mm256_cmp_pd(_mm256_loadu_pd(mask + i), zero, _CMP_NEQ_UQ);
+		_mm256_storeu_pd(out + i, _mm256_blendv_pd(_mm256_loadu_pd(b + i), _mm256_loadu_pd(a + i), chosen));
+	}
+	return i;
+}
+
+
+// SSE kernels, 2 numbers at a time. SSE2 is part of every x86-64 processor
+
+static size_t SumSSE(const double* a, size_t n, double& result) {
+	__m128d acc1 = _mm_setzero_pd();
+	__m128d acc2 = _mm_setzero_pd();
+
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		acc1 = _mm_add_pd(acc1, _mm_loadu_pd(a + i));
+		acc2 = _mm_add_pd(acc2, _mm_loadu_pd(a + i + 2));
+	}
+	for (; i + 2 <= n; i += 2) acc1 = _mm_add_pd(acc1, _mm_loadu_pd(a + i));
+
+	result = SumLanes(_mm_add_pd(acc1, acc2));
+	return i;
+}
+
+static size_t MinMaxSSE(const double* a, size_t n, bool min, double& result) {
+	if (n < 2) return 0;
+
+	__m128d acc = _mm_loadu_pd(a);
+	size_t i = 2;
+	for (; i + 2 <= n; i += 2) {
+		__m128d v = _mm_loadu_pd(a + i);
+		acc = min ? _mm_min_pd(acc, v) : _mm_max_pd(acc, v);
+	}
+
+	result = min ? MinLanes(acc) : MaxLanes(acc);
+	return i;
+}
+
+static size_t DotSSE(const double* a, const double* b, size_t n, double& result) {
+	__m128d acc = _mm_setzero_pd();
+
+	size_t i = 0;
+	for (; i + 2 <= n; i += 2) acc = _mm_add_pd(acc, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+
+	result = SumLanes(acc);
+	return i;
+}
+
+static size_t AddSSE(const double* a, const double* b, double* out, size_t n) {
+	size_t i = 0;
+	for (; i + 2 <= n; i += 2) _mm_storeu_pd(out + i, _mm_add_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+	return i;
+}
+
+static size_t MulSSE(const double* a, const double* b, double* out, size_t n) {
+	size_t i = 0;
+	for (; i + 2 <= n; i += 2) _mm_storeu_pd(out + i, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+	return i;
+}
+
+static size_t ScaleSSE(const double* a, double k, double* out, size_t n) {
+	__m128d factor = _mm_set1_pd(k);
+
+	size_t i = 0;
+	for (; i + 2 <= n; i += 2) _mm_storeu_pd(out + i, _mm_mul_pd(_mm_loadu_pd(a + i), factor));
+	return i;
+}
+
+static size_t WhereSSE(const double* mask, const double* a, const double* b, double* out, size_t n) {
+	__m128d zero = _mm_setzero_pd();
+
+	size_t i = 0;
+	for (; i + 2 <= n; i += 2) {
+		__m128d chosen = _mm_cmpneq_pd(_mm_loadu_pd(mask + i), zero);
+		__m128d v = _mm_or_pd(_mm_and_pd(chosen, _mm_loadu_pd(a + i)), _mm_andnot_pd(chosen, _mm_loadu_pd(b + i)));
+		_mm_storeu_pd(out + i, v);
+	}
+	return i;
+}
+
+#endif // VECTOR_X86
+
+
+double VectorOps::Sum(const double* a, size_t n) {
+	double total = 0;
+	size_t i = 0;
+#ifdef VECTOR_X86
+	i = HasAVX() ? SumAVX(a, n, total) : SumSSE(a, n, total);
+#endif
+	for (; i < n; i++) total += a[i];
+	return total;
+}
+
+double VectorOps::Min(const double* a, size_t n) {
+	double result = a[0];
+	size_t i = 1;
+#ifdef VECTOR_X86
+	size_t done = HasAVX() ? MinMaxAVX(a, n, true, result) : MinMaxSSE(a, n, true, result);
+	if (done > 0) i = done;
+#endif
+	for (; i < n; i++) result = std::min(result, a[i]);
+	return result;
+}
+
+double VectorOps::Max(const double* a, size_t n) {
+	double result = a[0];
+	size_t i = 1;
+#ifdef VECTOR_X86
+	size_t done = HasAVX() ? MinMaxAVX(a, n, false, result) : MinMaxSSE(a, n, false, result);
+	if (done > 0) i = done;
+#endif
+	for (; i < n; i++) result = std::max(result, a[i]);
+	return result;
+}
+
+double VectorOps::Dot(const double* a, const double* b, size_t n) {
+	double total = 0;
+	size_t i = 0;
+#ifdef VECTOR_X86
+	i = HasAVX() ? DotAVX(a, b, n, total) : DotSSE(a, b, n, total);
+#endif
+	for (; i < n; i++) total += a[i] * b[i];
+	return total;
+}
+
+void VectorOps::Add(const double* a, const double* b, double* out, size_t n) {
+	size_t i = 0;
+#ifdef VECTOR_X86
+	i = HasAVX() ? AddAVX(a, b, out, n) : AddSSE(a, b, out, n);
+#endif
+	for (; i < n; i++) out[i] = a[i] + b[i];
+}
+
+void VectorOps::Mul(const double* a, const double* b, double* out, size_t n) {
+	size_t i = 0;
+#ifdef VECTOR_X86
+	i = HasAVX() ? MulAVX(a, b, out, n) : MulSSE(a, b, out, n);
+#endif
+	for (; i < n; i++) out[i] = a[i] * b[i];
+}
+
+void VectorOps::Scale(const double* a, double k, double* out, size_t n) {
+	size_t i = 0;
+#ifdef VECTOR_X86
+	i = HasAVX() ? ScaleAVX(a, k, out, n) : ScaleSSE(a, k, out, n);
+#endif
+	for (; i < n; i++) out[i] = a[i] * k;
+}
+
+void VectorOps::Where(const double* mask, const double* a, const double* b, double* out, size_t n) {
+	size_t i = 0;
+#ifdef VECTOR_X86
+	i = HasAVX() ? WhereAVX(mask, a, b, out, n) : WhereSSE(mask, a, b, out, n);
+#endif
+	for (; i < n; i++) out[i] = (mask[i] != 0) ? a[i] : b[i];
+}
+
+
+// Integers. There are no 64-bit multiplies or comparisons before AVX-512, so these are plain loops
+// that the compiler vectorizes where it can. Overflow wraps around, as it does for integer arithmetic
+
+int64_t VectorOps::Sum(const int64_t* a, size_t n) {
+	uint64_t total = 0;
+	for (size_t i = 0; i < n; i++) total += (uint64_t)a[i];
+	return (int64_t)total;
+}
+
+int64_t VectorOps::Min(const int64_t* a, size_t n) {
+	int64_t result = a[0];
+	for (size_t i = 1; i < n; i++) result = std::min(result, a[i]);
+	return result;
+}
+
+int64_t VectorOps::Max(const int64_t* a, size_t n) {
+	int64_t result = a[0];
+	for (size_t i = 1; i < n; i++) result = std::max(result, a[i]);
+	return result;
+}
+
+int64_t VectorOps::Dot(const int64_t* a, const int64_t* b, size_t n) {
+	uint64_t total = 0;
+	for (size_t i = 0; i < n; i++) total += (uint64_t)a[i] * (uint64_t)b[i];
+	return (int64_t)total;
+}
+
+void VectorOps::Add(const int64_t* a, const int64_t* b, int64_t* out, size_t n) {
+	for (size_t i = 0; i < n; i++) out[i] = (int64_t)((uint64_t)a[i] + (uint64_t)b[i]);
+}
+
+void VectorOps::Mul(const int64_t* a, const int64_t* b, int64_t* out, size_t n) {
+	for (size_t i = 0; i < n; i++) out[i] = (int64_t)((uint64_t)a[i] * (uint64_t)b[i]);
+}
+
+void VectorOps::Scale(const int64_t* a, int64_t k, int64_t* out, size_t n) {
+	for (size_t i = 0; i < n; i++) out[i] = (int64_t)((uint64_t)a[i] * (uint64_t)k);
+}
+
+void VectorOps::Where(const int64_t* mask, const int64_t* a, const int64_t* b, int64_t* out, size_t n) {
+	for (size_t i = 0; i < n; i++) out[i] = (mask[i] != 0) ? a[i] : b[i];
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+class VectorOps
+{
+	// Bulk operations on arrays of numbers, the unboxed storage of lists.
+	// Doubles use AVX when the processor supports it, SSE otherwise, and a plain loop on other architectures
+private:
+	static bool HasAVX();
+
+public:
+	static double Sum(const double* a, size_t n);
+	static double Min(const double* a, size_t n);	// n must be at least 1
+	static double Max(const double* a, size_t n);
+	static double Dot(const double* a, const double* b, size_t n);
+
+	static void Add(const double* a, const double* b, double* out, size_t n);
+	static void Mul(const double* a, const double* b, double* out, size_t n);
+	static void Scale(const double* a, double k, double* out, size_t n);
+	static void Where(const double* mask, const double* a, const double* b, double* out, size_t n);	// a where mask isn't 0, else b
+
+	static int64_t Sum(const int64_t* a, size_t n);
+	static int64_t Min(const int64_t* a, size_t n);
+	static int64_t Max(const int64_t* a, size_t n);
+	static int64_t Dot(const int64_t* a, const int64_t* b, size_t n);
+
+	static void Add(const int64_t* a, const int64_t* b, int64_t* out, size_t n);
+	static void Mul(const int64_t* a, const int64_t* b, int64_t* out, size_t n);
+	static void Scale(const int64_t* a, int64_t k, int64_t* out, size_t n);
+	static void Where(const int64_t* mask, const int64_t* a, const int64_t* b, int64_t* out, size_t n);
+};
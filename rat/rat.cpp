@@ -9,6 +9,8 @@
 
 int main(int argc, char *argv[])
 {
+    std::ios::sync_with_stdio(false);  // print has its own buffer, and the rest of the output doesn't need stdio
+
     if (argc > 2) {
         std::cout << "Usage: rats [file name]\n";
     }
@@ -55,28 +57,25 @@ void RunPrompt() {
 }
 
 int Run(std::string& src) {
-    Scanner *scanner = new Scanner(src);
-    std::vector<Token>  tokens = scanner->ScanTokens();
-
-    if (tokens.empty()) return 1; // scanner error
-    delete scanner;
+    Program *program = new Program(src);
 
-    Compiler *compiler = new Compiler(tokens);
-    RunnableValue *script = compiler->Compile();
-
-    if (!script) return 100; // compilation error
-    delete compiler;
+    int code = program->GetCompileCode();
+    if (code != 0) {
+        delete program;
+        return code; // scanner or compilation error
+    }
 
 #ifdef DEBUG_PRINT_CODE
-    Debugger *debugger = new Debugger(script->GetChunk(), (std::string)"script");
+    Debugger *debugger = new Debugger(program->GetScript()->GetChunk(), (std::string)"script");
     debugger->DisassembleScript();
     delete debugger;
 #endif // DEBUG_PRINT_CODE
 
 
-    Interpreter *interpreter = new Interpreter(script);
-    int code = interpreter->interpret();
-    delete interpreter;
+    Context *context = new Context(program);
+    code = context->Run();
+    delete context;
+    delete program;
 
     return code;
 }
@@ -1,9 +1,10 @@
 #pragma once
 
-#include "Scanner.h"
+#include "scanner.h"
 #include "Token.h"
 #include "Compiler.h"
 #include "Interpreter.h"
+#include "Hotrat.h"
 
 #ifdef DEBUG_PRINT_CODE 
 #include "Debugger.h"
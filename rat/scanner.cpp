@@ -1,5 +1,97 @@
 #include "scanner.h"
 
+// Other architectures scan a byte at a time
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#if defined(__AVX2__)
+#define SCANNER_AVX2
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SCANNER_SSE2
+#endif
+#endif
+
+
+#if defined(SCANNER_AVX2) || defined(SCANNER_SSE2)
+static int FirstSetBit(unsigned int mask) {
+	// Index of the lowest set bit. mask must be non-zero
+#if defined(_MSC_VER)
+	unsigned long index;
+	_BitScanForward(&index, mask);
+	return (int)index;
+#else
+	return __builtin_ctz(mask);
+#endif
+}
+#endif
+
+static size_t SkipBlanks(const char* src, size_t from, size_t end) {
+	// Returns the index of the first byte in [from, end) that isn't a space or a tab,
+	// or 'end' if the whole range is blank
+
+	size_t i = from;
+#if defined(SCANNER_AVX2)
+	const __m256i space32 = _mm256_set1_epi8(' ');
+	const __m256i tab32 = _mm256_set1_epi8('\t');
+	for (; i + 32 <= end; i += 32) {
+		__m256i chunk = _mm256_loadu_si256((const __m256i*)(src + i));
+		__m256i blank = _mm256_or_si256(_mm256_cmpeq_epi8(chunk, space32), _mm256_cmpeq_epi8(chunk, tab32));
+		unsigned int mask = ~(unsigned int)_mm256_movemask_epi8(blank);
+		if (mask != 0) return i + FirstSetBit(mask);
+	}
+#endif
+#if defined(SCANNER_SSE2)
+	const __m128i space16 = _mm_set1_epi8(' ');
+	const __m128i tab16 = _mm_set1_epi8('\t');
+	for (; i + 16 <= end; i += 16) {
+		__m128i chunk = _mm_loadu_si128((const __m128i*)(src + i));
+		__m128i blank = _mm_or_si128(_mm_cmpeq_epi8(chunk, space16), _mm_cmpeq_epi8(chunk, tab16));
+		unsigned int mask = ~(unsigned int)_mm_movemask_epi8(blank) & 0xFFFF;
+		if (mask != 0) return i + FirstSetBit(mask);
+	}
+#endif
+	while (i < end && (src[i] == ' ' || src[i] == '\t')) i++;
+	return i;
+}
+
+static size_t FindEither(const char* src, size_t from, size_t end, char a, char b) {
+	// Returns the index of the first occurrence of 'a' or 'b' in [from, end),
+	// or 'end' if neither appears
+
+	size_t i = from;
+#if defined(SCANNER_AVX2)
+	const __m256i a32 = _mm256_set1_epi8(a);
+	const __m256i b32 = _mm256_set1_epi8(b);
+	for (; i + 32 <= end; i += 32) {
+		__m256i chunk = _mm256_loadu_si256((const __m256i*)(src + i));
+		__m256i hit = _mm256_or_si256(_mm256_cmpeq_epi8(chunk, a32), _mm256_cmpeq_epi8(chunk, b32));
+		unsigned int mask = (unsigned int)_mm256_movemask_epi8(hit);
+		if (mask != 0) return i + FirstSetBit(mask);
+	}
+#endif
+#if defined(SCANNER_SSE2)
+	const __m128i a16 = _mm_set1_epi8(a);
+	const __m128i b16 = _mm_set1_epi8(b);
+	for (; i + 16 <= end; i += 16) {
+		__m128i chunk = _mm_loadu_si128((const __m128i*)(src + i));
+		__m128i hit = _mm_or_si128(_mm_cmpeq_epi8(chunk, a16), _mm_cmpeq_epi8(chunk, b16));
+		unsigned int mask = (unsigned int)_mm_movemask_epi8(hit);
+		if (mask != 0) return i + FirstSetBit(mask);
+	}
+#endif
+	while (i < end && src[i] != a && src[i] != b) i++;
+	return i;
+}
+
+static size_t FindByte(const char* src, size_t from, size_t end, char target) {
+	return FindEither(src, from, end, target, target);
+}
+
+
 Scanner::Scanner(std::string src) {
 	current = 0;
 	start = 0;
@@ -39,7 +131,12 @@ Token Scanner::ScanToken() {
 	switch (c) {
 		case '\0':	return Token(TOKEN_EOF, "");
 
-		case 'a': if (CheckWord("nd"))	return Token(AND, "and");	break;
+		case 'a': {
+			if (CheckWord("nd"))	return Token(AND, "and");
+			if (CheckWord("wait"))	return Token(AWAIT, "await");
+			if (CheckWord("sync"))	return Token(ASYNC, "async");
+			break;
+		}
 		case 'c': if (CheckWord("old")) return Token(COLD, "cold"); break;
 
 		case 'e': {
@@ -71,6 +168,7 @@ Token Scanner::ScanToken() {
 		case 'n': if (CheckWord("one"))		return Token(NONE, "none");			break;
 
 		case 'o': if (CheckWord("r"))		return Token(OR, "or");				break;
+		case 's': if (CheckWord("pawn"))	return Token(SPAWN, "spawn");		break;
 		case 'r': {
 			if (CheckWord("eturn"))	return Token(RETURN, "return");
 			if (CheckWord("at")) return Token(RAT, "rat");
@@ -88,6 +186,7 @@ Token Scanner::ScanToken() {
 		
 		case 'w': if (CheckWord("hile"))	return Token(WHILE, "while");	break;
 		case 'x': if (CheckWord("or"))		return Token(XOR, "xor");		break;
+		case 'y': if (CheckWord("ield"))	return Token(YIELD, "yield");	break;
 
 		case '.':	return Token(DOT, ".");
 		case ',':	return Token(COMMA, ",");
@@ -248,12 +347,14 @@ Token Scanner::String(char quote_type) {
 	// Lexes a string literal and returns an appropriate token
 
 	int newline_toks = 0;  // number of newlines in the string
-	while (peek(0) != quote_type && !IsAtEnd()) { 
-		if (peek(0) == '\n') {
-			newline_toks++;
-			line++;
-		}
-		advance(); 
+	while (true) {
+		// Jump straight to the next quote or newline, so only those are looked at one by one
+		current = FindEither(src.data(), current, src.length(), quote_type, '\n');
+		if (IsAtEnd() || peek(0) == quote_type) break;
+
+		newline_toks++;
+		line++;
+		advance();
 	}
 
 
@@ -286,7 +387,8 @@ Token Scanner::Identifier() {
 
 Token Scanner::Comment() {
 	// Lexes a comment and discards
-	while (!(match('\n') || IsAtEnd())) advance();
+	current = FindByte(src.data(), current, src.length(), '\n');
+	match('\n');
 	if (IsAtEnd()) {
 		return Token(TOKEN_EOF, "");
 	}
@@ -301,9 +403,12 @@ void Scanner::SkipWhiteSpace() {
 			case '\n':
 				tokens.push_back(Token(TOKEN_NEWLINE, "\n"));
 				line++;
+				advance();
+				break;
+
 			case '\t':
 			case ' ':
-				advance();
+				current = SkipBlanks(src.data(), current, src.length());
 				break;
 			default:
 				return;
@@ -348,6 +453,6 @@ void Scanner::error(std::string ErrorMsg) {
 }
 
 void Scanner::error(std::string ErrorMsg, char violator) {
-	std::cerr << "[Error in line " << line << " at '" << violator << "']: " << ErrorMsg << std::endl;
+	std::cerr << "[Error in line " << line << " at '" << violator << "']: " << ErrorMsg << "\n";
 	HadError = true;
 }
\ No newline at end of file
@@ -0,0 +1,21 @@
+# Runs a script with the rat interpreter and compares what it prints with the expected output.
+# Called by ctest with -DRAT=<interpreter> -DSCRIPT=<script.rat> -DEXPECTED=<script.out>.
+# The script's stdin is the .in file next to it, if there is one
+
+string(REGEX REPLACE "\\.rat$" ".in" input ${SCRIPT})
+if (NOT EXISTS ${input})
+	set(input /dev/null)
+endif()
+
+execute_process(
+	COMMAND ${RAT} ${SCRIPT}
+	INPUT_FILE ${input}
+	OUTPUT_VARIABLE output
+	ERROR_VARIABLE output
+	RESULT_VARIABLE code
+)
+
+file(READ ${EXPECTED} expected)
+if (NOT output STREQUAL expected)
+	message(FATAL_ERROR "Output of ${SCRIPT} differs, exit code ${code}. Expected:\n${expected}\nGot:\n${output}")
+endif()
@@ -0,0 +1,90 @@
+// Runs one Program in N Contexts on N threads at once, and checks that every context computes its own results.
+// Prints the time of the same work on one thread and on N, to show how the contexts scale
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Hotrat.h"
+
+static const char* Source = R"(rat calls = 0
+
+runnable work(n):
+	calls = calls + 1
+	rat total = 0
+	for i in range(0, n):
+		total = total + i * i
+	endfor
+	return total
+endrunnable
+
+runnable label(name):
+	return name + "-" + String(calls)
+endrunnable
+)";
+
+static const int64_t Iterations = 100000;
+static const int Calls = 10;
+
+static bool RunContext(Program* program, int id) {
+	// Every call has to give the same result as on its own, and the globals must be this context's alone
+	Context context(program);
+	if (context.Run() != 0) return false;
+
+	int64_t expected = 0;
+	for (int64_t i = 0; i < Iterations + id; i++) expected += i * i;
+
+	for (int c = 0; c < Calls; c++) {
+		std::vector<Value> args = { Value(Iterations + id) };
+		if (context.Call("work", args) != 0) return false;
+
+		Value result = context.GetReturnValue();
+		if (!result.IsInt() || result.GetInt() != expected) return false;
+	}
+
+	Value calls;
+	if (!context.GetGlobal("calls", calls) || !calls.IsInt() || calls.GetInt() != Calls) return false;
+
+	std::vector<Value> args = { context.NewString("context" + std::to_string(id)) };
+	if (context.Call("label", args) != 0) return false;
+	return context.GetReturnValue().ToString() == "context" + std::to_string(id) + "-" + std::to_string(Calls);
+}
+
+static double RunThreads(Program* program, int threads, std::atomic<int>& failures) {
+	auto start = std::chrono::steady_clock::now();
+
+	std::vector<std::thread> workers;
+	for (int i = 0; i < threads; i++) {
+		workers.emplace_back([program, i, &failures] {
+			if (!RunContext(program, i)) failures++;
+		});
+	}
+	for (std::thread& worker : workers) worker.join();
+
+	std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count();
+}
+
+int main() {
+	Program program(Source);
+	if (program.GetCompileCode() != 0) {
+		std::cerr << "The test program didn't compile\n";
+		return 1;
+	}
+
+	int threads = std::max(4, (int)std::thread::hardware_concurrency());
+	std::atomic<int> failures(0);
+
+	double one = RunThreads(&program, 1, failures);
+	double all = RunThreads(&program, threads, failures);
+
+	std::cout << "1 context: " << one << " ms, " << threads << " contexts in parallel: " << all << " ms\n";
+	if (failures > 0) {
+		std::cerr << failures << " contexts gave wrong results\n";
+		return 1;
+	}
+	return 0;
+}